@@ -0,0 +1,41 @@
+#!/bin/sh
+# Check that the integer only build of C4 (C4_INTEGER_ONLY) makes the same
+# decisions as the default build. The scenarios are simulated with the default
+# build of pico_sim, recording the C4 notifications, and the records are then
+# replayed with the integer only build of c4_replay, which fails if the CWIN,
+# pacing rate or state differ from the recorded values.
+#
+# Usage: scripts/check_integer_mode.sh picoquic_dir [spec_file ...]
+# Run from the root of the C4 repository.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 picoquic_dir [spec_file ...]"
+    exit 1
+fi
+PICOQUIC_DIR=$1
+shift
+SPECS="$*"
+if [ -z "$SPECS" ]; then
+    SPECS="sim_specs/c4_alone.txt sim_specs/c4_vs_c4.txt sim_specs/c4_vs_cubic.txt sim_specs/c4_wifi_fade.txt sim_specs/c4_media.txt"
+fi
+
+cmake -S . -B _build_double -DC4_INTEGER_ONLY=OFF || exit 1
+cmake --build _build_double -j || exit 1
+cmake -S . -B _build_integer -DC4_INTEGER_ONLY=ON || exit 1
+cmake --build _build_integer -j || exit 1
+
+RESULT=0
+for SPEC in $SPECS; do
+    RECORD_DIR=_records/$(basename $SPEC .txt)
+    rm -rf $RECORD_DIR
+    mkdir -p $RECORD_DIR
+    ./_build_double/pico_sim -S $PICOQUIC_DIR -R $RECORD_DIR $SPEC || exit 1
+    for RECORD in $RECORD_DIR/*.c4rec; do
+        [ -e "$RECORD" ] || continue
+        if ! ./_build_integer/c4_replay $RECORD; then
+            echo "Integer build diverges on $RECORD"
+            RESULT=1
+        fi
+    done
+done
+exit $RESULT
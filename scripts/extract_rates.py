@@ -1,4 +1,12 @@
 # Extracting the traces added as messages into the qlog.
+# "C4_rate" messages are logged on each ACK if C4 is compiled with
+# C4_WITH_LOGGING. "C4_trace" messages are dumped from the binary
+# trace ring (option 'T') when the path is deleted, and carry the
+# time of the sample as first value, but not the path bandwidth.
+# For large traces, prefer the columnar trace files written with the
+# option 'B', or pico_sim -B dir, and convert them with
+# "c4_columns -s samples.csv"; the CSV has the same columns, preceded
+# by the index of the trace file.
 
 import sys
 import pandas as pd
@@ -9,7 +17,19 @@ header_set = [ 'time', 'rate', 'n-rate', 'bytes', 'rtt', 'send-delay', 'nominal-
 line_set = []
 
 for line in open(sys.argv[1], "r"):
-    if "C4_rate" in line:
+    if "C4_trace" in line:
+        line = line.strip()
+        if line.endswith('"}],'):
+            line = line[:-4]
+        parts = line.split(',')
+
+        r = []
+        for i in range(4, len(parts) - 1):
+            r.append(int(parts[i]))
+        r.append(0)
+        r.append(int(parts[len(parts) - 1]))
+        line_set.append(r)
+    elif "C4_rate" in line:
         line = line.strip()
         if line.startswith('['):
             line = line[1:]
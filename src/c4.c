@@ -20,9 +20,17 @@
 */
 
 #include "picoquic_internal.h"
+#include "picoquic_utils.h"
 #include <stdlib.h>
 #include <string.h>
 #include "cc_common.h"
+#include "c4.h"
+#include "c4_pool.h"
+#include "c4_record.h"
+#include "c4_cache.h"
+#include "c4_store.h"
+#include "c4_stats.h"
+#include "c4_column.h"
 
 /* C4 algorithm is a work in progress. We start with some simple principles:
 * - Track delays, but this expose issue when competing with Cubic
@@ -76,7 +84,12 @@
 * - RTT min
  */
 
-#define C4_WITH_LOGGING 
+/* Per-ACK logging of rate samples as text messages is expensive, and
+* is only compiled if C4_WITH_LOGGING is defined. The binary trace ring,
+* enabled at run time with the option 'T', is the preferred alternative.
+* For offline analysis of long runs, the option 'B' writes the same
+* samples and the state transitions to a columnar trace file.
+ */
 
 #define PICOQUIC_CC_ALGO_NUMBER_C4 8
 #define C4_DELAY_THRESHOLD_MAX 25000
@@ -97,15 +110,34 @@
 #define C4_MAX_DELAY_ERA_CONGESTIONS 4
 #define C4_RTT_MARGIN_5PERCENT 51
 #define C4_MAX_JITTER 250000
-#define C4_KAPPA ((double)(1.0/4.0))
+#define C4_CR_RTT_LOW_DIVIDER 2 /* Careful resume fails if RTT < seed RTT / 2 */
+#define C4_CR_RTT_HIGH_MULTIPLIER 10 /* Careful resume fails if RTT > 10 * seed RTT */
+#define C4_MIN_RTT_HORIZON 0 /* Default window of the min RTT filter, off: C4 does not drain the queue to probe the min */
+#define C4_MAX_RTT_HORIZON 0 /* Default window of the max RTT filter, off until validated in the simulations */
+#define C4_MAX_RTT_PER_MILLE 1000 /* Default percentile of RTT samples used for the max RTT, 1000 uses the era max */
+#define C4_RTT_HISTOGRAM_MIN_OCTAVE 8 /* First bucket starts at 256 microseconds */
+#define C4_RTT_HISTOGRAM_SUB_BUCKETS 8 /* Buckets per octave, 9% resolution */
+#define C4_RTT_HISTOGRAM_NB_BUCKETS 128 /* 16 octaves, up to 16.7 seconds */
+#define C4_RTT_HISTOGRAM_MIN_COUNT 64 /* Use the raw max until this many samples */
+#define C4_RTT_HISTOGRAM_MAX_COUNT 4096 /* Halve the counts when reached */
+#define C4_RATE_FILTER_ERAS 8 /* Window of the max filter of the nominal rate, in eras */
+#define C4_ECN_GAIN_SHIFT 4 /* Smoothing gain of the CE fraction, 1/16 as in Prague */
+#define C4_TRACE_RING_SIZE 256 /* must be a power of 2 */
+#define C4_RECORD_DIRECTORY_MAX 256
 
 typedef enum {
     c4_initial = 0,
     c4_recovery,
     c4_cruising,
-    c4_pushing
+    c4_pushing,
+    c4_cr_reconnaissance, /* Careful resume: checking that the path matches the seed */
+    c4_cr_unvalidated, /* Careful resume: jump to the seed, not yet acknowledged */
+    c4_cr_validating, /* Careful resume: waiting for the jump to be acknowledged */
+    c4_cr_safe_retreat /* Careful resume: congestion during the jump */
 } c4_alg_state_t;
 
+/* Fail to compile if the path stats do not have one entry per state */
+typedef char c4_nb_states_matches_alg_states[(c4_cr_safe_retreat + 1 == C4_NB_STATES) ? 1 : -1];
 
 typedef enum {
     c4_congestion_none = 0,
@@ -114,44 +146,189 @@ typedef enum {
     c4_congestion_loss
 } c4_congestion_t;
 
+/* Fail to compile if the path stats do not have one entry per congestion type */
+typedef char c4_nb_congestion_types_matches_modes[(c4_congestion_loss + 1 == C4_NB_CONGESTION_TYPES) ? 1 : -1];
+
+typedef struct st_c4_trace_ring_t {
+    uint64_t nb_written;
+    uint64_t nb_read;
+    uint64_t nb_overwritten;
+    c4_trace_sample_t samples[C4_TRACE_RING_SIZE];
+} c4_trace_ring_t;
+
+/* Max filter of the rate samples over the last C4_RATE_FILTER_ERAS eras.
+* The entries form a monotonic queue: era indices increase and rates
+* decrease from the first entry, so the first entry is the max.
+* Every era advances the era count, including app limited eras.
+ */
+typedef struct st_c4_rate_filter_t {
+    uint64_t rate[C4_RATE_FILTER_ERAS];
+    uint32_t era[C4_RATE_FILTER_ERAS];
+    uint32_t era_count;
+    uint8_t first;
+    uint8_t nb;
+} c4_rate_filter_t;
+
+/* Windowed min or max of RTT samples over a time horizon, keeping the best,
+* second best and third best samples in the window, as in Kathleen
+* Nichols' algorithm used by BBR. Updates are O(1).
+ */
+typedef struct st_c4_minmax_sample_t {
+    uint64_t t;
+    uint32_t v;
+} c4_minmax_sample_t;
+
+typedef struct st_c4_minmax_t {
+    c4_minmax_sample_t s[3];
+} c4_minmax_t;
+
+/* Histogram of the RTT samples, in log scale buckets, used to estimate
+* a high percentile of the RTT in constant memory. The counts are halved
+* when the total reaches C4_RTT_HISTOGRAM_MAX_COUNT, so the histogram
+* follows the recent samples.
+ */
+typedef struct st_c4_rtt_histogram_t {
+    uint16_t count[C4_RTT_HISTOGRAM_NB_BUCKETS];
+    uint32_t total;
+} c4_rtt_histogram_t;
+
+/* Event counters of a path. They are only updated on state transitions
+* and congestion events, never per ACK, and survive path resets.
+ */
+typedef struct st_c4_counters_t {
+    uint64_t state_start_time;
+    uint64_t nb_state_entries[C4_NB_STATES];
+    uint64_t time_in_state[C4_NB_STATES];
+    uint64_t nb_recoveries[C4_NB_CONGESTION_TYPES];
+    uint64_t nb_push_succeeded;
+    uint64_t nb_push_failed;
+    uint64_t nb_cascades;
+    uint64_t nb_jitter_restarts;
+} c4_counters_t;
+
+/* The C4 state is split in two blocks. The hot block holds the variables
+* used on every ACK or RTT sample, narrowed so that the block fits in a
+* single cache line. The state is allocated on a cache line boundary.
+* The cold block holds the variables used on era transitions, losses,
+* resets or deletion. RTT values are kept in microseconds as 32 bits
+* integers, capped at C4_RTT_MAX.
+ */
+/* Loss rates are fractions between 0 and 1. If C4_INTEGER_ONLY is defined,
+* they are kept as integers scaled by 2^24, so that the algorithm does not
+* use floating point. Scaled constants are computed at compile time.
+ */
+#ifdef C4_INTEGER_ONLY
+typedef uint32_t c4_loss_rate_t;
+#define C4_LOSS_RATE_SHIFT 24
+#define C4_LOSS_RATE_ONE ((uint32_t)1 << C4_LOSS_RATE_SHIFT)
+#define C4_LOSS_RATE(x) ((c4_loss_rate_t)((x) * C4_LOSS_RATE_ONE))
+#define C4_LOSS_MULT(a, b) ((c4_loss_rate_t)((((uint64_t)(a)) * (b) + (C4_LOSS_RATE_ONE >> 1)) >> C4_LOSS_RATE_SHIFT))
+#else
+typedef double c4_loss_rate_t;
+#define C4_LOSS_RATE_ONE 1.0
+#define C4_LOSS_RATE(x) (x)
+#define C4_LOSS_MULT(a, b) ((a) * (b))
+#endif
+
+#define C4_RTT_MAX UINT32_MAX
+#define C4_RTT_CAP(x) (((x) > C4_RTT_MAX)?C4_RTT_MAX:(uint32_t)(x))
+
 typedef struct st_c4_state_t {
-    c4_alg_state_t alg_state;
+    /* Hot block */
     uint64_t nominal_rate; /* Control variable if not delay based. */
-    uint64_t nominal_max_rtt; /* Estimate of queue-free max RTT */
-    uint64_t running_min_rtt; /* Rough estimate of min RTT, for buffer estimation */
-    uint64_t alpha_1024_current;
-    uint64_t alpha_1024_previous;
-    uint64_t nb_packets_in_startup;
     uint64_t era_sequence; /* sequence number of first packet in era */
-    uint64_t nb_cruise_left_before_push; /* Number of cruise periods required before push */
+    uint64_t applied_cwin; /* CWIN set by the last update, to detect changes by other code */
+    uint32_t nominal_max_rtt; /* Estimate of queue-free max RTT */
+    uint32_t running_min_rtt; /* Rough estimate of min RTT, for buffer estimation */
+    uint32_t era_max_rtt;
+    uint32_t era_min_rtt;
+    uint32_t recent_delay_excess;
+    /* Inputs of the last CWIN and pacing update, used to skip redundant updates.
+     * Changes of the nominal rate are flagged by nominal_rate_changed. */
+    uint32_t applied_max_rtt;
+    uint32_t nb_skipped_since_update;
+    uint16_t delay_threshold; /* At most C4_DELAY_THRESHOLD_MAX */
+    uint16_t alpha_1024_current;
+    uint16_t alpha_1024_previous;
+    uint16_t applied_alpha;
+    uint16_t applied_mtu;
+    uint16_t alg_state : 3; /* c4_alg_state_t */
+    uint16_t applied_state : 3;
+    uint16_t recovery_event_not_delay : 1;
+    uint16_t congestion_notified : 1;
+    uint16_t push_was_not_limited : 1;
+    uint16_t use_seed_cwin : 1;
+    uint16_t initial_after_jitter : 1;
+    uint16_t do_cascade : 1;
+    uint16_t do_slow_push : 1;
+    uint16_t do_trace : 1;
+    uint16_t nominal_rate_changed : 1; /* Set by c4_set_nominal_rate, cleared by the update */
+    /* Cold block */
+    uint64_t nb_packets_in_startup;
     uint64_t seed_cwin; /* Value of CWIN remembered from previous trials */
     uint64_t seed_rate; /* data rate remembered from seed cwin. */
-
-    int nb_eras_no_increase;
-    int nb_push_no_congestion; /* Number of successive pushes with no congestion */
+    uint64_t cr_jump_cwin; /* Careful resume: CWIN during unvalidated */
+    uint64_t cr_pipe_size; /* Careful resume: bytes acknowledged since the jump */
+    uint32_t seed_rtt; /* RTT remembered with the seed cwin, 0 if unknown */
     uint64_t push_rate_old;
-    uint64_t push_alpha;
-
-    uint64_t era_max_rtt;
-    uint64_t era_min_rtt;
-
-    uint64_t delay_threshold;
-    uint64_t recent_delay_excess;
-
     uint64_t last_lost_packet_number; /* Used for computation of loss rate. Init to 0 */
-    double smoothed_drop_rate; /* Average packet loss rate */
-
-    unsigned int recovery_event_not_delay : 1;
-    unsigned int congestion_notified : 1;
-    unsigned int push_was_not_limited : 1;
-    unsigned int use_seed_cwin : 1;
-    unsigned int initial_after_jitter : 1;
-    unsigned int do_cascade : 1;
-    unsigned int do_slow_push : 1;
+    c4_loss_rate_t smoothed_drop_rate; /* Average packet loss rate */
+    int nb_eras_no_increase;
+    int nb_push_no_congestion; /* Number of successive pushes with no congestion */
+    uint16_t push_alpha;
+    uint8_t nb_cruise_left_before_push; /* Number of cruise periods required before push */
+    uint8_t do_record;
+    uint8_t do_columns;
+    uint8_t do_ecn_proportional;
+    uint8_t do_coupled;
+    uint8_t do_careful_resume;
+    uint64_t coupled_rate; /* Aggregate nominal rate of the coupled paths, 0 if not coupled */
+    uint8_t do_rate_filter;
+    uint8_t do_flight_backoff;
+    uint16_t ce_fraction_1024; /* Smoothed fraction of CE marks per era */
+    uint64_t era_ecn_ce; /* CE count reported by the peer at the start of the era */
+    uint64_t era_ecn_total; /* ECT0 + ECT1 + CE count at the start of the era */
+    uint64_t era_max_rate; /* Max rate sample in the era, for the rate filter */
+    uint8_t era_not_app_limited; /* Some packet acked in the era was sent while not app limited */
+    uint64_t hint_rate; /* Rate expected by the application, 0 if no hint */
+    uint64_t hint_burst; /* Burst expected by the application on top of the rate */
+    c4_rate_filter_t rate_filter;
+    c4_minmax_t min_rtt_filter;
+    c4_minmax_t max_rtt_filter;
+    c4_rtt_histogram_t rtt_histogram;
+    uint64_t nb_pacing_updates;
+    uint64_t nb_pacing_updates_skipped;
+    c4_counters_t counters;
+    /* Hook called on state transitions, NULL if none */
+    c4_transition_hook_fn transition_hook;
+    void* transition_hook_ctx;
     /* Handling of options. */
     char const* option_string;
+    /* Binary trace of rate samples, only allocated if do_trace is set */
+    c4_trace_ring_t* trace_ring;
+    /* Recorder of the notifications, only open if recording is enabled */
+    c4_record_t* recorder;
+    /* Writer of the columnar trace, only open if the trace is enabled */
+    c4_column_writer_t* columns;
+    /* Pool from which this state was allocated, NULL if allocated with malloc */
+    c4_pool_t* pool;
+    /* Memory returned by malloc, before alignment, NULL if allocated from pool */
+    void* raw_memory;
 } c4_state_t;
 
+/* Fail to compile if the hot block grows beyond a cache line */
+typedef char c4_state_hot_block_fits_cache_line[
+    (offsetof(c4_state_t, nb_packets_in_startup) <= C4_POOL_CACHE_LINE) ? 1 : -1];
+
+/* All changes of the nominal rate go through this function, so that
+* the next call to c4_apply_rate_and_cwin does not skip the update.
+ */
+static void c4_set_nominal_rate(c4_state_t* c4_state, uint64_t nominal_rate)
+{
+    c4_state->nominal_rate = nominal_rate;
+    c4_state->nominal_rate_changed = 1;
+}
+
 static void c4_enter_recovery(
     picoquic_path_t* path_x,
     c4_state_t* c4_state,
@@ -163,6 +340,71 @@ static void c4_enter_cruise(
     c4_state_t* c4_state,
     uint64_t current_time);
 
+void c4_notify(
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    picoquic_per_ack_state_t* ack_state,
+    uint64_t current_time);
+
+/* Access the C4 state of a path, if the connection is using C4 */
+static c4_state_t* c4_get_state(picoquic_path_t* path_x)
+{
+    c4_state_t* c4_state = NULL;
+
+    if (path_x != NULL && path_x->cnx != NULL && path_x->cnx->congestion_alg == c4_algorithm) {
+        c4_state = (c4_state_t*)path_x->congestion_alg_state;
+    }
+    return c4_state;
+}
+
+/* Coupled multipath.
+* If coupling is enabled, the paths of a connection behave together as
+* a single flow carrying the aggregate of their nominal rates. Each path
+* keeps its own max RTT, but:
+* - the sensitivity, and thus the delay threshold, the loss threshold and
+*   the loss backoff, is computed from the aggregate rate, so the paths
+*   of the connection yield to other flows as a single flow of that rate,
+* - each path backs off by beta times its own rate, i.e., its share of
+*   the backoff of the aggregate, which is beta times the aggregate rate,
+* - the push increment is divided by the number of coupled paths, so that
+*   the paths together probe no faster than a single path flow, while a
+*   path with a small share can still grow when the other paths are
+*   congested. Pushes below C4_ALPHA_PUSH_LOW_1024 cannot be measured by
+*   c4_growth_evaluate, and are then judged on congestion signals only.
+* The aggregate is computed when entering push or on congestion, not
+* on every ACK.
+ */
+static int c4_coupled_rates(picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t* aggregate_rate)
+{
+    picoquic_cnx_t* cnx = path_x->cnx;
+    int nb_coupled = 0;
+
+    *aggregate_rate = 0;
+    if (c4_state->do_coupled && cnx->nb_paths > 1) {
+        for (int i = 0; i < cnx->nb_paths; i++) {
+            c4_state_t* path_state = c4_get_state(cnx->path[i]);
+
+            if (path_state != NULL && path_state->nominal_rate > 0) {
+                *aggregate_rate += path_state->nominal_rate;
+                nb_coupled++;
+            }
+        }
+    }
+    c4_state->coupled_rate = (nb_coupled > 1) ? *aggregate_rate : 0;
+    return nb_coupled;
+}
+
+static uint64_t c4_coupled_push_alpha(picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t alpha_1024)
+{
+    uint64_t aggregate_rate;
+    int nb_coupled = c4_coupled_rates(path_x, c4_state, &aggregate_rate);
+
+    if (nb_coupled > 1 && alpha_1024 > 1024) {
+        alpha_1024 = 1024 + (alpha_1024 - 1024) / nb_coupled;
+    }
+    return alpha_1024;
+}
+
 /* The sensitivity function provides a value from 0 to 1
 * indicating how sensitive this flow is to congestion event.
 * The idea is that flow consuming lots of resource should react
@@ -184,70 +426,115 @@ static void c4_enter_cruise(
 * - 10MB/s: 1
 */
 
+/* The formulas are written without branches, as functions of
+* the state variables, so they can be shared with the bulk evaluation.
+* The sensitivity is the sum of the two slopes, each computed
+* on the rate clipped to its segment.
+ */
+static uint64_t c4_rate_sensitivity_1024(uint64_t nominal_rate)
+{
+    uint64_t rate_low = (nominal_rate < 50000) ? 50000 : ((nominal_rate > 1000000) ? 1000000 : nominal_rate);
+    uint64_t rate_high = (nominal_rate < 1000000) ? 1000000 : ((nominal_rate > 10000000) ? 10000000 : nominal_rate);
+
+    return ((rate_low - 50000) * 963 / 950000) + ((rate_high - 1000000) * 61 / 9000000);
+}
+
+/* Coupled paths are as sensitive as a single path carrying the aggregate rate */
+static uint64_t c4_sensitivity_rate(c4_state_t* c4_state)
+{
+    return (c4_state->coupled_rate > c4_state->nominal_rate) ? c4_state->coupled_rate : c4_state->nominal_rate;
+}
+
 static uint64_t c4_sensitivity_1024(c4_state_t* c4_state)
 {
-    uint64_t sensitivity = 1024;
-    if (c4_state->nominal_rate < 50000) {
-        sensitivity = 0;
-    }
-    else if (c4_state->nominal_rate > 10000000) {
-        sensitivity = 1024;
-    }
-    else if (c4_state->nominal_rate < 1000000) {
-        sensitivity = (c4_state->nominal_rate - 50000) * 963 / 950000;
-    }
-    else {
-        sensitivity = 963 + ((c4_state->nominal_rate - 1000000) * 61 / 9000000);
-    }
-    return sensitivity;
+    return c4_rate_sensitivity_1024(c4_sensitivity_rate(c4_state));
 }
 
 /* Compute the delay threshold for declaring congestion,
 * as the min of RTT/8 and c4_DELAY_THRESHOLD_MAX (25 ms) 
  */
+static uint64_t c4_rtt_delay_threshold(uint64_t sensitivity, uint64_t nominal_max_rtt)
+{
+    uint64_t fraction = 64 + MULT1024(1024 - sensitivity, 196);
+    uint64_t delay = MULT1024(fraction, nominal_max_rtt);
+
+    return (delay > C4_DELAY_THRESHOLD_MAX) ? C4_DELAY_THRESHOLD_MAX : delay;
+}
 
 uint64_t c4_delay_threshold(c4_state_t* c4_state)
 {
-    uint64_t sensitivity = c4_sensitivity_1024(c4_state);
-    uint64_t fraction = 64 + MULT1024(1024 - sensitivity, 196);
-    uint64_t delay = MULT1024(fraction, c4_state->nominal_max_rtt);
-    if (delay > C4_DELAY_THRESHOLD_MAX) {
-        delay = C4_DELAY_THRESHOLD_MAX;
-    }
-    return delay;
+    return c4_rtt_delay_threshold(c4_sensitivity_1024(c4_state), c4_state->nominal_max_rtt);
 }
 
 /* Compute the loss rate threshold for declaring a congestion event
 */
-double c4_loss_threshold(c4_state_t* c4_state)
+c4_loss_rate_t c4_loss_threshold(c4_state_t* c4_state)
 {
     uint64_t sensitivity = c4_sensitivity_1024(c4_state);
+#ifdef C4_INTEGER_ONLY
+    c4_loss_rate_t loss_threshold = C4_LOSS_RATE(0.02) +
+        (c4_loss_rate_t)(((uint64_t)(C4_LOSS_RATE_ONE >> 1) * (1024 - sensitivity)) >> 10);
+#else
     double fraction = ((double)sensitivity) / 1024.0;
     double loss_threshold = 0.02 + 0.50 * (1-fraction);
+#endif
 
     return loss_threshold;
 }
 
-/* Compute the loss rate */
-void c4_update_loss_rate(c4_state_t * c4_state, uint64_t lost_packet_number)
+/* Decay of the smoothed loss rate over gap packets, i.e., the factor
+* (1 - PICOQUIC_SMOOTHED_LOSS_FACTOR) raised to the power gap, computed
+* by repeated squaring. The gap is capped at PICOQUIC_SMOOTHED_LOSS_SCOPE,
+* so this takes at most a few multiplications, and uses no shared state.
+ */
+static c4_loss_rate_t c4_loss_decay(uint64_t gap)
 {
-    uint64_t next_number = c4_state->last_lost_packet_number;
+    c4_loss_rate_t decay = C4_LOSS_RATE_ONE;
+    c4_loss_rate_t factor = C4_LOSS_RATE_ONE - C4_LOSS_RATE(PICOQUIC_SMOOTHED_LOSS_FACTOR);
 
-    if (lost_packet_number > next_number) {
-        if (next_number + PICOQUIC_SMOOTHED_LOSS_SCOPE < lost_packet_number) {
-            next_number = lost_packet_number - PICOQUIC_SMOOTHED_LOSS_SCOPE;
+    while (gap > 0) {
+        if ((gap & 1) != 0) {
+            decay = C4_LOSS_MULT(decay, factor);
         }
-
-        while (next_number < lost_packet_number) {
-            c4_state->smoothed_drop_rate *= (1.0 - PICOQUIC_SMOOTHED_LOSS_FACTOR);
-            next_number++;
+        gap >>= 1;
+        if (gap > 0) {
+            factor = C4_LOSS_MULT(factor, factor);
         }
+    }
+    return decay;
+}
+
+static c4_loss_rate_t c4_loss_rate_after_gap(c4_loss_rate_t drop_rate, uint64_t gap)
+{
+    if (gap > PICOQUIC_SMOOTHED_LOSS_SCOPE) {
+        gap = PICOQUIC_SMOOTHED_LOSS_SCOPE;
+    }
+    drop_rate = C4_LOSS_MULT(drop_rate, c4_loss_decay(gap));
+    drop_rate += C4_LOSS_MULT(C4_LOSS_RATE_ONE - drop_rate, C4_LOSS_RATE(PICOQUIC_SMOOTHED_LOSS_FACTOR));
+    return drop_rate;
+}
+
+/* Compute the loss rate.
+* The decay for all the packets received since the last loss is
+* computed in a few multiplications, so the cost does not depend
+* on the gap between losses.
+ */
+void c4_update_loss_rate(c4_state_t * c4_state, uint64_t lost_packet_number)
+{
+    uint64_t next_number = c4_state->last_lost_packet_number;
 
-        c4_state->smoothed_drop_rate += (1.0 - c4_state->smoothed_drop_rate) * PICOQUIC_SMOOTHED_LOSS_FACTOR;
+    if (lost_packet_number > next_number) {
+        c4_state->smoothed_drop_rate = c4_loss_rate_after_gap(c4_state->smoothed_drop_rate,
+            lost_packet_number - next_number);
         c4_state->last_lost_packet_number = lost_packet_number;
     }
 }
 
+double c4_loss_rate_check(double drop_rate, uint64_t gap)
+{
+    return ((double)c4_loss_rate_after_gap(C4_LOSS_RATE(drop_rate), gap)) / ((double)C4_LOSS_RATE_ONE);
+}
+
 /*
 * c4_apply_rate_and_cwin:
 * Manage all setting of the actual cwin, pacing rate and quantum
@@ -255,19 +542,83 @@ void c4_update_loss_rate(c4_state_t * c4_state, uint64_t lost_packet_number)
 * in the other functions.
 */
 
+/* Target CWIN for the pacing rate and the nominal max RTT. When pushing,
+* the CWIN exceeds the nominal value by at least one MTU.
+ */
+static uint64_t c4_target_cwin(uint64_t pacing_rate, uint64_t nominal_rate, uint64_t nominal_max_rtt,
+    uint64_t alpha_1024, int is_pushing, uint64_t send_mtu)
+{
+    uint64_t target_cwin = (nominal_max_rtt != 0 && nominal_rate != 0) ?
+        (pacing_rate * nominal_max_rtt) / 1000000 : PICOQUIC_CWIN_INITIAL;
+    uint64_t delta_rate = MULT1024(alpha_1024 - 1024, nominal_rate);
+    uint64_t delta_cwin = (delta_rate * nominal_max_rtt) / 1000000;
+
+    return target_cwin + ((is_pushing && delta_cwin < send_mtu) ? send_mtu - delta_cwin : 0);
+}
+
+/* Set the CWIN and pacing rate of the path, and remember the inputs
+* so that the next update can be skipped if they do not change.
+ */
+static void c4_set_cwin_and_pacing(
+    picoquic_path_t* path_x,
+    c4_state_t* c4_state,
+    uint64_t target_cwin,
+    uint64_t pacing_rate)
+{
+    uint64_t quantum;
+
+    path_x->cwin = target_cwin;
+    quantum = target_cwin / 4;
+    if (quantum > 0x10000) {
+        quantum = 0x10000;
+    }
+    else if (quantum < 2 * path_x->send_mtu) {
+        quantum = 2 * path_x->send_mtu;
+    }
+    picoquic_update_pacing_rate(path_x->cnx, path_x, (double)pacing_rate, quantum);
+
+    c4_state->applied_state = c4_state->alg_state;
+    c4_state->nominal_rate_changed = 0;
+    c4_state->applied_alpha = c4_state->alpha_1024_current;
+    c4_state->applied_max_rtt = c4_state->nominal_max_rtt;
+    c4_state->applied_mtu = (uint16_t)path_x->send_mtu;
+    c4_state->applied_cwin = path_x->cwin;
+    c4_state->nb_pacing_updates++;
+    c4_state->nb_pacing_updates_skipped += c4_state->nb_skipped_since_update;
+    c4_state->nb_skipped_since_update = 0;
+}
+
 static void c4_apply_rate_and_cwin(
     picoquic_path_t* path_x,
     c4_state_t* c4_state)
 {
-
-    uint64_t pacing_rate = MULT1024(c4_state->alpha_1024_current, c4_state->nominal_rate);
-    uint64_t quantum;
-    uint64_t target_cwin = PICOQUIC_CWIN_INITIAL;
-    if (c4_state->nominal_max_rtt != 0 && c4_state->nominal_rate != 0) {
-        target_cwin = (pacing_rate * c4_state->nominal_max_rtt) / 1000000;
+    uint64_t pacing_rate;
+    uint64_t target_cwin;
+
+    /* Outside of the initial state, the CWIN and pacing rate only depend
+    * on the state, the nominal rate and max RTT, alpha and the MTU.
+    * If none of these changed since the last update, and the CWIN was
+    * not modified elsewhere, there is no need to update the pacer.
+    * In the initial state and the first phases of careful resume, they
+    * also depend on the path estimates, so we always update.
+     */
+    if (c4_state->alg_state != c4_initial &&
+        (c4_state->alg_state < c4_cr_reconnaissance || c4_state->alg_state > c4_cr_validating) &&
+        c4_state->alg_state == c4_state->applied_state &&
+        !c4_state->nominal_rate_changed &&
+        c4_state->alpha_1024_current == c4_state->applied_alpha &&
+        c4_state->nominal_max_rtt == c4_state->applied_max_rtt &&
+        path_x->send_mtu == c4_state->applied_mtu &&
+        path_x->cwin == c4_state->applied_cwin) {
+        c4_state->nb_skipped_since_update++;
+        return;
     }
 
-    if (c4_state->alg_state == c4_initial) {
+    pacing_rate = MULT1024(c4_state->alpha_1024_current, c4_state->nominal_rate);
+    target_cwin = c4_target_cwin(pacing_rate, c4_state->nominal_rate, c4_state->nominal_max_rtt,
+        c4_state->alpha_1024_current, c4_state->alg_state == c4_pushing, path_x->send_mtu);
+
+    if (c4_state->alg_state == c4_initial || c4_state->alg_state == c4_cr_reconnaissance) {
         if (target_cwin < PICOQUIC_CWIN_INITIAL) {
             /* target CWIN is always at least PICOQUIC_CWIN_INITIAL.
             * If that is too much, C4 will detect congestion and exit the
@@ -297,31 +648,54 @@ static void c4_apply_rate_and_cwin(
         /* Increase pacing rate by factor 1.25 to allow for bunching of packets */
         pacing_rate = MULT1024(1024+256, pacing_rate);
     }
-    else if (c4_state->alg_state == c4_pushing) {
-        uint64_t delta_alpha = c4_state->alpha_1024_current - 1024;
-        uint64_t delta_rate = MULT1024(delta_alpha, c4_state->nominal_rate);
-        uint64_t delta_cwin = (delta_rate * c4_state->nominal_max_rtt) / 1000000;
-        if (delta_cwin < path_x->send_mtu) {
-            target_cwin += path_x->send_mtu - delta_cwin;
+    else if (c4_state->alg_state == c4_cr_unvalidated) {
+        /* Careful resume jump: the CWIN is set to the jump window,
+         * paced over the current RTT. */
+        uint64_t jump_rate = (c4_state->cr_jump_cwin * 1000000) / path_x->smoothed_rtt;
+        if (c4_state->cr_jump_cwin > target_cwin) {
+            target_cwin = c4_state->cr_jump_cwin;
+        }
+        if (jump_rate > pacing_rate) {
+            pacing_rate = jump_rate;
         }
     }
-
-    path_x->cwin = target_cwin;
-    quantum = target_cwin / 4;
-    if (quantum > 0x10000) {
-        quantum = 0x10000;
+    else if (c4_state->alg_state == c4_cr_validating) {
+        /* Keep enough CWIN for the bytes that were acknowledged since the jump */
+        if (c4_state->cr_pipe_size > target_cwin) {
+            target_cwin = c4_state->cr_pipe_size;
+        }
     }
-    else if (quantum < 2 * path_x->send_mtu) {
-        quantum = 2 * path_x->send_mtu;
+
+    c4_set_cwin_and_pacing(path_x, c4_state, target_cwin, pacing_rate);
+}
+
+int c4_apply_check(picoquic_path_t* path_x, int alg_state, uint64_t nominal_rate,
+    uint32_t nominal_max_rtt, uint32_t alpha_1024)
+{
+    int ret = -1;
+    c4_state_t* c4_state = c4_get_state(path_x);
+
+    if (c4_state != NULL && alg_state >= 0 && alg_state < C4_NB_STATES) {
+        c4_state->alg_state = (c4_alg_state_t)alg_state;
+        c4_state->nominal_rate = nominal_rate;
+        c4_state->nominal_max_rtt = nominal_max_rtt;
+        c4_state->alpha_1024_current = alpha_1024;
+        c4_state->nominal_rate_changed = 1;
+        c4_apply_rate_and_cwin(path_x, c4_state);
+        ret = 0;
     }
-    picoquic_update_pacing_rate(path_x->cnx, path_x, (double)pacing_rate, quantum);
+    return ret;
 }
 
 /* Perform evaluation. Assess whether the previous era resulted
  * in a significant increase or not.
  */
-static void c4_growth_evaluate(c4_state_t* c4_state)
+/* Returns 1 if the rate grew, -1 if it did not although the sender was
+* not app limited, 0 if the era does not tell.
+ */
+static int c4_growth_evaluate(c4_state_t* c4_state)
 {
+    int ret = 0;
     int is_growing = 0;
     if (c4_state->push_alpha > C4_ALPHA_PUSH_LOW_1024) {
         /* If the value of "push_alpha" was large enough, we can reasonably
@@ -340,11 +714,14 @@ static void c4_growth_evaluate(c4_state_t* c4_state)
     if (is_growing) {
         c4_state->nb_push_no_congestion++;
         c4_state->nb_eras_no_increase = 0;
+        ret = 1;
     }
     else if (c4_state->push_was_not_limited) {
         c4_state->nb_push_no_congestion = 0;
         c4_state->nb_eras_no_increase++;
+        ret = -1;
     }
+    return ret;
 }
 
 static void c4_growth_reset(c4_state_t* c4_state)
@@ -373,22 +750,399 @@ static int c4_era_check(
     }
 }
 
+/* ECN counts reported by the peer for the packets sent on the path.
+* The counts are kept in the same packet context as the sequence numbers.
+ */
+static void c4_ecn_get_counts(picoquic_path_t* path_x, uint64_t* nb_ce, uint64_t* nb_total)
+{
+    picoquic_packet_context_t* pkt_ctx = (path_x->cnx->is_multipath_enabled) ?
+        &path_x->pkt_ctx : &path_x->cnx->pkt_ctx[picoquic_packet_context_application];
+
+    *nb_ce = pkt_ctx->ecn_ce_total_remote;
+    *nb_total = pkt_ctx->ecn_ect0_total_remote + pkt_ctx->ecn_ect1_total_remote + *nb_ce;
+}
+
+/* Fraction of CE marks since the start of the era, or 0 if no ECN count was received. */
+static uint64_t c4_ecn_era_fraction_1024(picoquic_path_t* path_x, c4_state_t* c4_state)
+{
+    uint64_t nb_ce;
+    uint64_t nb_total;
+    uint64_t fraction = 0;
+
+    c4_ecn_get_counts(path_x, &nb_ce, &nb_total);
+    if (nb_total > c4_state->era_ecn_total && nb_ce >= c4_state->era_ecn_ce) {
+        fraction = ((nb_ce - c4_state->era_ecn_ce) * 1024) / (nb_total - c4_state->era_ecn_total);
+    }
+    return (fraction > 1024) ? 1024 : fraction;
+}
+
+/* Start a new ECN measurement, without using the marks of the current era */
+static void c4_ecn_era_restart(picoquic_path_t* path_x, c4_state_t* c4_state)
+{
+    c4_ecn_get_counts(path_x, &c4_state->era_ecn_ce, &c4_state->era_ecn_total);
+}
+
+/* At the end of an era, fold its fraction of CE marks in the smoothed fraction */
+static void c4_ecn_era_update(picoquic_path_t* path_x, c4_state_t* c4_state)
+{
+    uint64_t nb_ce;
+    uint64_t nb_total;
+
+    c4_ecn_get_counts(path_x, &nb_ce, &nb_total);
+    if (nb_total > c4_state->era_ecn_total) {
+        uint64_t fraction = c4_ecn_era_fraction_1024(path_x, c4_state);
+        c4_state->ce_fraction_1024 = (uint16_t)((((uint64_t)c4_state->ce_fraction_1024 << C4_ECN_GAIN_SHIFT) -
+            c4_state->ce_fraction_1024 + fraction) >> C4_ECN_GAIN_SHIFT);
+    }
+    c4_state->era_ecn_ce = nb_ce;
+    c4_state->era_ecn_total = nb_total;
+}
+
+/* Restart the rate filter from the nominal rate, after it was set
+* by careful resume. The samples of the current era are discarded.
+ */
+static void c4_rate_filter_reset(c4_state_t* c4_state)
+{
+    c4_rate_filter_t* filter = &c4_state->rate_filter;
+
+    filter->first = 0;
+    filter->nb = 1;
+    filter->rate[0] = c4_state->nominal_rate;
+    filter->era[0] = filter->era_count;
+    c4_state->era_max_rate = 0;
+}
+
+/* Apply the rate reduction of a congestion event to the filter entries.
+* The entries keep their era, so that a spike still expires on time.
+ */
+static void c4_rate_filter_reduce(c4_state_t* c4_state, uint64_t beta)
+{
+    c4_rate_filter_t* filter = &c4_state->rate_filter;
+
+    for (int i = 0; i < filter->nb; i++) {
+        int x = (filter->first + i) % C4_RATE_FILTER_ERAS;
+        filter->rate[x] -= MULT1024(beta, filter->rate[x]);
+    }
+    c4_state->era_max_rate -= MULT1024(beta, c4_state->era_max_rate);
+}
+
+/* At the end of an era, add the max rate sample of the era to the filter,
+* and set the nominal rate to the filtered value. This is the only place
+* where the filter raises the nominal rate, so a spike caused by ACK
+* compression only lasts C4_RATE_FILTER_ERAS eras. The window ages even
+* if the era was app limited. App limited eras usually have no sample,
+* since app limited samples only count if they exceed the nominal rate.
+* If the window empties, the nominal rate is kept.
+ */
+static void c4_rate_filter_update(c4_state_t* c4_state)
+{
+    c4_rate_filter_t* filter = &c4_state->rate_filter;
+    uint64_t rate = c4_state->era_max_rate;
+
+    c4_state->era_max_rate = 0;
+    filter->era_count++;
+    while (filter->nb > 0 && filter->era[filter->first] + C4_RATE_FILTER_ERAS <= filter->era_count) {
+        filter->first = (filter->first + 1) % C4_RATE_FILTER_ERAS;
+        filter->nb--;
+    }
+    if (rate == 0) {
+        return;
+    }
+    /* Remove the entries that are smaller than the new sample */
+    while (filter->nb > 0) {
+        int last = (filter->first + filter->nb - 1) % C4_RATE_FILTER_ERAS;
+        if (filter->rate[last] > rate) {
+            break;
+        }
+        filter->nb--;
+    }
+    if (filter->nb == 0 || filter->era[(filter->first + filter->nb - 1) % C4_RATE_FILTER_ERAS] != filter->era_count) {
+        int next = (filter->first + filter->nb) % C4_RATE_FILTER_ERAS;
+        filter->rate[next] = rate;
+        filter->era[next] = filter->era_count;
+        filter->nb++;
+    }
+    if (c4_state->nominal_rate != filter->rate[filter->first]) {
+        c4_set_nominal_rate(c4_state, filter->rate[filter->first]);
+        c4_state->delay_threshold = (uint16_t)c4_delay_threshold(c4_state);
+    }
+}
+
 static void c4_era_reset(
     picoquic_path_t* path_x,
     c4_state_t* c4_state)
 {
+    c4_ecn_era_update(path_x, c4_state);
     c4_state->era_sequence = picoquic_cc_get_sequence_number(path_x->cnx, path_x);
     c4_state->era_max_rtt = 0;
-    c4_state->era_min_rtt = UINT64_MAX;
+    c4_state->era_min_rtt = C4_RTT_MAX;
+    c4_state->era_not_app_limited = 0;
     c4_state->alpha_1024_previous = c4_state->alpha_1024_current;
 }
 
+/* Horizons of the RTT filters, shared by all the paths. A horizon of
+* zero disables the window, and the RTT estimates decay once per era.
+* The horizons are read without lock by the network threads, so they
+* can only be changed before the first C4 path is initialized.
+ */
+static uint64_t c4_min_rtt_horizon = C4_MIN_RTT_HORIZON;
+static uint64_t c4_max_rtt_horizon = C4_MAX_RTT_HORIZON;
+static int c4_rtt_horizons_in_use = 0;
+
+int c4_set_rtt_horizons(uint64_t min_rtt_horizon, uint64_t max_rtt_horizon)
+{
+    int ret = 0;
+
+    if (c4_rtt_horizons_in_use) {
+        ret = -1;
+    }
+    else {
+        c4_min_rtt_horizon = min_rtt_horizon;
+        c4_max_rtt_horizon = max_rtt_horizon;
+    }
+    return ret;
+}
+
+static uint32_t c4_minmax_reset(c4_minmax_t* m, uint64_t t, uint32_t v)
+{
+    m->s[0].t = t;
+    m->s[0].v = v;
+    m->s[1] = m->s[0];
+    m->s[2] = m->s[0];
+    return v;
+}
+
+/* Age the samples after a new sample was inserted. The second and third
+* samples are refreshed after a quarter and half of the window, so that
+* a replacement is available when the best sample expires.
+ */
+static uint32_t c4_minmax_subwin_update(c4_minmax_t* m, uint64_t win, c4_minmax_sample_t const* val)
+{
+    uint64_t dt = val->t - m->s[0].t;
+
+    if (dt > win) {
+        m->s[0] = m->s[1];
+        m->s[1] = m->s[2];
+        m->s[2] = *val;
+        if (val->t - m->s[0].t > win) {
+            m->s[0] = m->s[1];
+            m->s[1] = m->s[2];
+            m->s[2] = *val;
+        }
+    }
+    else if (m->s[1].t == m->s[0].t && dt > win / 4) {
+        m->s[2] = *val;
+        m->s[1] = *val;
+    }
+    else if (m->s[2].t == m->s[1].t && dt > win / 2) {
+        m->s[2] = *val;
+    }
+    return m->s[0].v;
+}
+
+static uint32_t c4_minmax_running_min(c4_minmax_t* m, uint64_t win, uint64_t t, uint32_t v)
+{
+    c4_minmax_sample_t val;
+
+    if (v <= m->s[0].v || t - m->s[2].t > win) {
+        return c4_minmax_reset(m, t, v);
+    }
+    val.t = t;
+    val.v = v;
+    if (v <= m->s[1].v) {
+        m->s[1] = val;
+        m->s[2] = val;
+    }
+    else if (v <= m->s[2].v) {
+        m->s[2] = val;
+    }
+    return c4_minmax_subwin_update(m, win, &val);
+}
+
+static uint32_t c4_minmax_running_max(c4_minmax_t* m, uint64_t win, uint64_t t, uint32_t v)
+{
+    c4_minmax_sample_t val;
+
+    if (v >= m->s[0].v || t - m->s[2].t > win) {
+        return c4_minmax_reset(m, t, v);
+    }
+    val.t = t;
+    val.v = v;
+    if (v >= m->s[1].v) {
+        m->s[1] = val;
+        m->s[2] = val;
+    }
+    else if (v >= m->s[2].v) {
+        m->s[2] = val;
+    }
+    return c4_minmax_subwin_update(m, win, &val);
+}
+
+/* Reduce the samples in the window by the fraction beta, after a loss */
+static void c4_minmax_reduce(c4_minmax_t* m, uint64_t beta)
+{
+    for (int i = 0; i < 3; i++) {
+        m->s[i].v -= (uint32_t)MULT1024(beta, (uint64_t)m->s[i].v);
+    }
+}
+
+/* Percentile of the RTT samples used as max RTT, per mille, shared by
+* all the paths. 1000 or more uses the max of the samples of each era.
+ */
+static uint32_t c4_max_rtt_per_mille = C4_MAX_RTT_PER_MILLE;
+
+void c4_set_max_rtt_percentile(uint32_t per_mille)
+{
+    c4_max_rtt_per_mille = per_mille;
+}
+
+static int c4_rtt_histogram_bucket(uint32_t rtt)
+{
+    uint32_t x = rtt >> C4_RTT_HISTOGRAM_MIN_OCTAVE;
+    int octave = 0;
+    int bucket;
+
+    if (x == 0) {
+        return 0;
+    }
+    if (x >= (1 << 16)) { x >>= 16; octave += 16; }
+    if (x >= (1 << 8)) { x >>= 8; octave += 8; }
+    if (x >= (1 << 4)) { x >>= 4; octave += 4; }
+    if (x >= (1 << 2)) { x >>= 2; octave += 2; }
+    if (x >= (1 << 1)) { octave += 1; }
+    /* The 3 bits after the most significant bit select the sub bucket */
+    bucket = octave * C4_RTT_HISTOGRAM_SUB_BUCKETS +
+        (int)((rtt >> (octave + C4_RTT_HISTOGRAM_MIN_OCTAVE - 3)) & (C4_RTT_HISTOGRAM_SUB_BUCKETS - 1));
+    return (bucket < C4_RTT_HISTOGRAM_NB_BUCKETS) ? bucket : C4_RTT_HISTOGRAM_NB_BUCKETS - 1;
+}
+
+static void c4_rtt_histogram_add(c4_rtt_histogram_t* histogram, uint32_t rtt)
+{
+    histogram->count[c4_rtt_histogram_bucket(rtt)]++;
+    histogram->total++;
+    if (histogram->total >= C4_RTT_HISTOGRAM_MAX_COUNT) {
+        histogram->total = 0;
+        for (int i = 0; i < C4_RTT_HISTOGRAM_NB_BUCKETS; i++) {
+            histogram->count[i] >>= 1;
+            histogram->total += histogram->count[i];
+        }
+    }
+}
+
+/* Returns the upper bound of the bucket holding the percentile, so that
+* the quantization does not lower the max RTT below the samples.
+ */
+static uint32_t c4_rtt_histogram_percentile(c4_rtt_histogram_t const* histogram, uint32_t per_mille)
+{
+    uint32_t nb_above_max = (uint32_t)(((uint64_t)histogram->total * (1000 - per_mille)) / 1000);
+    uint32_t nb_above = 0;
+    int i = C4_RTT_HISTOGRAM_NB_BUCKETS - 1;
+    int octave;
+
+    while (i > 0) {
+        nb_above += histogram->count[i];
+        if (nb_above > nb_above_max) {
+            break;
+        }
+        i--;
+    }
+    octave = i / C4_RTT_HISTOGRAM_SUB_BUCKETS + C4_RTT_HISTOGRAM_MIN_OCTAVE;
+    return (uint32_t)((C4_RTT_HISTOGRAM_SUB_BUCKETS + (i % C4_RTT_HISTOGRAM_SUB_BUCKETS) + 1) << (octave - 3));
+}
+
+static uint32_t c4_column_clamp(uint64_t v)
+{
+    return (v > UINT32_MAX) ? UINT32_MAX : (uint32_t)v;
+}
+
+/* Stop writing the columnar trace if the file cannot be written */
+static void c4_column_check(c4_state_t* c4_state, int ret)
+{
+    if (ret != 0) {
+        (void)c4_column_close(c4_state->columns);
+        c4_state->columns = NULL;
+    }
+}
+
+static void c4_column_record_transition(c4_state_t* c4_state, c4_alg_state_t old_state, c4_alg_state_t new_state,
+    uint64_t current_time)
+{
+    c4_column_transition_t transition;
+
+    transition.current_time = current_time;
+    transition.nominal_rate = c4_state->nominal_rate;
+    transition.nominal_max_rtt = c4_state->nominal_max_rtt;
+    transition.running_min_rtt = c4_state->running_min_rtt;
+    transition.old_state = (uint8_t)old_state;
+    transition.new_state = (uint8_t)new_state;
+    c4_column_check(c4_state, c4_column_add_transition(c4_state->columns, &transition));
+}
+
+/* Transition hooks.
+* The default hook is copied in the state of new paths, so that checking
+* whether a hook is installed costs a single test of a field of the state.
+* The rate passed to the hook as the new rate is the nominal rate times
+* the gain of the new state, so the enter functions set the gain before
+* changing the state.
+ */
+static c4_transition_hook_fn c4_default_transition_hook;
+static void* c4_default_transition_hook_ctx;
+
+void c4_set_default_transition_hook(c4_transition_hook_fn hook, void* hook_ctx)
+{
+    c4_default_transition_hook = hook;
+    c4_default_transition_hook_ctx = hook_ctx;
+}
+
+static void c4_call_transition_hook(picoquic_path_t* path_x, c4_state_t* c4_state, c4_alg_state_t old_state,
+    c4_congestion_t c_mode, uint64_t current_time)
+{
+    c4_transition_t transition;
+
+    transition.current_time = current_time;
+    transition.old_state = old_state;
+    transition.new_state = c4_state->alg_state;
+    transition.congestion_type = c_mode;
+    transition.old_rate = path_x->pacing_rate;
+    transition.new_rate = MULT1024(c4_state->alpha_1024_current, c4_state->nominal_rate);
+    transition.nominal_rate = c4_state->nominal_rate;
+    transition.nominal_max_rtt = c4_state->nominal_max_rtt;
+    c4_state->transition_hook(path_x, &transition, c4_state->transition_hook_ctx);
+}
+
+/* All state changes go through this function, which maintains the
+* number of entries and the time spent in each state, and calls the
+* transition hook. The congestion type is the signal that caused the
+* transition, c4_congestion_none if there was none.
+ */
+static void c4_set_state(picoquic_path_t* path_x, c4_state_t* c4_state, c4_alg_state_t alg_state,
+    c4_congestion_t c_mode, uint64_t current_time)
+{
+    if (alg_state != c4_state->alg_state) {
+        c4_counters_t* counters = &c4_state->counters;
+        c4_alg_state_t old_state = (c4_alg_state_t)c4_state->alg_state;
+
+        if (c4_state->columns != NULL) {
+            c4_column_record_transition(c4_state, old_state, alg_state, current_time);
+        }
+        if (current_time > counters->state_start_time) {
+            counters->time_in_state[old_state] += current_time - counters->state_start_time;
+        }
+        counters->state_start_time = current_time;
+        counters->nb_state_entries[alg_state]++;
+        c4_state->alg_state = alg_state;
+        if (c4_state->transition_hook != NULL) {
+            c4_call_transition_hook(path_x, c4_state, old_state, c_mode, current_time);
+        }
+    }
+}
+
 static void c4_enter_initial(picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t current_time)
 {
-    c4_state->alg_state = c4_initial;
     c4_state->nb_push_no_congestion = 0;
     c4_state->alpha_1024_current = C4_ALPHA_INITIAL;
     c4_state->nb_packets_in_startup = 0;
+    c4_set_state(path_x, c4_state, c4_initial, c4_congestion_none, current_time);
     c4_era_reset(path_x, c4_state);
     c4_state->nb_eras_no_increase = 0;
     c4_growth_reset(c4_state);
@@ -416,6 +1170,45 @@ static void c4_set_options(c4_state_t* c4_state)
             case 'o': /* disallow the slow push behavior */
                 c4_state->do_slow_push = 0;
                 break;
+            case 'T': /* record rate samples in the binary trace ring */
+                c4_state->do_trace = 1;
+                break;
+            case 'R': /* record the notifications, for replay */
+                c4_state->do_record = 1;
+                break;
+            case 'B': /* write rate samples and transitions to a columnar trace file */
+                c4_state->do_columns = 1;
+                break;
+            case 'E': /* proportional response to ECN marks, as in L4S */
+                c4_state->do_ecn_proportional = 1;
+                break;
+            case 'e': /* fixed response to ECN marks, same as losses */
+                c4_state->do_ecn_proportional = 0;
+                break;
+            case 'C': /* couple the paths of a multipath connection */
+                c4_state->do_coupled = 1;
+                break;
+            case 'c': /* run each path independently */
+                c4_state->do_coupled = 0;
+                break;
+            case 'W': /* nominal rate is the max rate sample of the last eras */
+                c4_state->do_rate_filter = 1;
+                break;
+            case 'w': /* nominal rate is raised by any single rate sample */
+                c4_state->do_rate_filter = 0;
+                break;
+            case 'U': /* use careful resume when a seed is available */
+                c4_state->do_careful_resume = 1;
+                break;
+            case 'u': /* average the seed with the initial CWIN */
+                c4_state->do_careful_resume = 0;
+                break;
+            case 'F': /* size the delay backoff to drain the queue in flight */
+                c4_state->do_flight_backoff = 1;
+                break;
+            case 'f': /* size the delay backoff from the excess delay */
+                c4_state->do_flight_backoff = 0;
+                break;
             default:
                 ended = 1;
                 break;
@@ -426,21 +1219,72 @@ static void c4_set_options(c4_state_t* c4_state)
 
 void c4_reset(c4_state_t* c4_state, picoquic_path_t* path_x, char const* option_string, uint64_t current_time)
 {
+    /* The trace ring survives resets, so samples are not lost */
+    c4_trace_ring_t* trace_ring = c4_state->trace_ring;
+    c4_record_t* recorder = c4_state->recorder;
+    c4_column_writer_t* columns = c4_state->columns;
+    c4_transition_hook_fn transition_hook = c4_state->transition_hook;
+    void* transition_hook_ctx = c4_state->transition_hook_ctx;
+    c4_pool_t* pool = c4_state->pool;
+    void* raw_memory = c4_state->raw_memory;
+    /* The rate hint comes from the application, it survives path resets */
+    uint64_t hint_rate = c4_state->hint_rate;
+    uint64_t hint_burst = c4_state->hint_burst;
+    c4_counters_t counters = c4_state->counters;
+    c4_alg_state_t alg_state = (c4_alg_state_t)c4_state->alg_state;
+
     memset(c4_state, 0, sizeof(c4_state_t));
+    c4_state->recorder = recorder;
+    c4_state->columns = columns;
+    c4_state->transition_hook = transition_hook;
+    c4_state->transition_hook_ctx = transition_hook_ctx;
+    c4_state->pool = pool;
+    c4_state->raw_memory = raw_memory;
+    c4_state->hint_rate = hint_rate;
+    c4_state->hint_burst = hint_burst;
+    /* Restart in the initial state, and account for the time spent in
+     * the state before the reset, if any. */
+    if (counters.nb_state_entries[alg_state] > 0 && current_time > counters.state_start_time) {
+        counters.time_in_state[alg_state] += current_time - counters.state_start_time;
+    }
+    counters.state_start_time = current_time;
+    counters.nb_state_entries[c4_initial]++;
+    c4_state->counters = counters;
     c4_state->option_string = option_string;
-    c4_state->running_min_rtt = UINT64_MAX;
+    c4_state->running_min_rtt = C4_RTT_MAX;
+    c4_minmax_reset(&c4_state->min_rtt_filter, current_time, C4_RTT_MAX);
+    c4_minmax_reset(&c4_state->max_rtt_filter, current_time, 0);
     c4_state->alpha_1024_current = C4_ALPHA_INITIAL;
     c4_state->do_slow_push = 1;
     c4_state->do_cascade = 1;
     c4_set_options(c4_state);
+    if (c4_state->do_trace && trace_ring == NULL) {
+        trace_ring = (c4_trace_ring_t*)calloc(1, sizeof(c4_trace_ring_t));
+    }
+    c4_state->trace_ring = trace_ring;
+    if (alg_state != c4_initial) {
+        if (columns != NULL) {
+            c4_column_record_transition(c4_state, alg_state, c4_initial, current_time);
+        }
+        if (transition_hook != NULL) {
+            c4_call_transition_hook(path_x, c4_state, alg_state, c4_congestion_none, current_time);
+        }
+    }
     c4_enter_initial(path_x, c4_state, current_time);
 }
 
-void c4_seed_cwin(c4_state_t* c4_state, picoquic_path_t* path_x, uint64_t bytes_in_flight)
+void c4_seed_cwin(c4_state_t* c4_state, picoquic_path_t* path_x, uint64_t bytes_in_flight, uint64_t seed_rtt, uint64_t current_time)
 {
     if (c4_state->alg_state == c4_initial) {
-        c4_state->use_seed_cwin = 1;
         c4_state->seed_cwin = bytes_in_flight;
+        if (c4_state->do_careful_resume && seed_rtt > 0 && bytes_in_flight > PICOQUIC_CWIN_INITIAL) {
+            /* Do not use the seed until the path is checked */
+            c4_state->seed_rtt = C4_RTT_CAP(seed_rtt);
+            c4_set_state(path_x, c4_state, c4_cr_reconnaissance, c4_congestion_none, current_time);
+        }
+        else {
+            c4_state->use_seed_cwin = 1;
+        }
     }
 }
 
@@ -477,9 +1321,9 @@ static void c4_initial_handle_loss(picoquic_path_t* path_x, c4_state_t* c4_state
     }
 }
 
-static void c4_initial_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_ack_state_t* ack_state, uint64_t current_time)
+static void c4_initial_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, size_t nb_acks, uint64_t current_time)
 {
-    c4_state->nb_packets_in_startup += 1;
+    c4_state->nb_packets_in_startup += nb_acks;
     if (c4_state->use_seed_cwin && c4_state->seed_rate > 0 &&
         c4_state->nominal_rate >= c4_state->seed_rate) {
         /* The nominal bandwidth is larger than the seed. The seed has been validated. */
@@ -493,9 +1337,11 @@ static void c4_initial_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state,
         * which is not good either. If we don't check if the app limited,
         * we lose in the very common case where the server sends almost
         * nothing for several RTT, until the client asks for some data.
-        * So we test that we have seen at least some data.
+        * So we count the eras in which some packets were sent while not
+        * app limited, or in which more than a nominal CWIN was delivered
+        * after an app limited packet was sent.
         */
-        c4_growth_evaluate(c4_state);
+        (void)c4_growth_evaluate(c4_state);
         c4_era_reset(path_x, c4_state);
         if (c4_state->nb_eras_no_increase >= 3) {
             c4_exit_initial(path_x, c4_state, picoquic_congestion_notification_acknowledgement, current_time);
@@ -507,6 +1353,567 @@ static void c4_initial_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state,
     }
 }
 
+/* Pools of C4 states, one per QUIC context.
+* The contexts are kept in a list, protected by a mutex because paths
+* are created by the network threads while pools may be set or released
+* for other QUIC contexts. The mutex is created when the first pool is
+* set, before any network thread uses a pool, and is kept until the
+* process exits. The entry of a QUIC context is removed when its pool
+* is released, which must happen before the QUIC context is freed, so
+* that a new context allocated at the same address does not find it.
+ */
+typedef struct st_c4_pool_context_t {
+    struct st_c4_pool_context_t* next_context;
+    picoquic_quic_t* quic;
+    c4_pool_t* pool;
+} c4_pool_context_t;
+
+static c4_pool_context_t* c4_pool_contexts;
+static picoquic_mutex_t c4_pool_contexts_mutex;
+static int c4_pool_contexts_mutex_created;
+
+static c4_pool_t* c4_find_state_pool(picoquic_quic_t* quic)
+{
+    c4_pool_t* pool = NULL;
+
+    if (quic != NULL && c4_pool_contexts_mutex_created) {
+        (void)picoquic_lock_mutex(&c4_pool_contexts_mutex);
+        for (c4_pool_context_t* context = c4_pool_contexts; context != NULL; context = context->next_context) {
+            if (context->quic == quic) {
+                pool = context->pool;
+                break;
+            }
+        }
+        (void)picoquic_unlock_mutex(&c4_pool_contexts_mutex);
+    }
+    return pool;
+}
+
+int c4_set_state_pool(picoquic_quic_t* quic, size_t nb_slots_per_chunk)
+{
+    int ret = -1;
+    c4_pool_context_t* context = NULL;
+
+    if (!c4_pool_contexts_mutex_created && picoquic_create_mutex(&c4_pool_contexts_mutex) == 0) {
+        c4_pool_contexts_mutex_created = 1;
+    }
+    if (quic != NULL && c4_pool_contexts_mutex_created && c4_find_state_pool(quic) == NULL &&
+        (context = (c4_pool_context_t*)malloc(sizeof(c4_pool_context_t))) != NULL) {
+        memset(context, 0, sizeof(c4_pool_context_t));
+        if ((context->pool = c4_pool_create(sizeof(c4_state_t), nb_slots_per_chunk)) == NULL) {
+            free(context);
+        }
+        else {
+            context->quic = quic;
+            (void)picoquic_lock_mutex(&c4_pool_contexts_mutex);
+            context->next_context = c4_pool_contexts;
+            c4_pool_contexts = context;
+            (void)picoquic_unlock_mutex(&c4_pool_contexts_mutex);
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+void c4_release_state_pool(picoquic_quic_t* quic)
+{
+    c4_pool_context_t* context = NULL;
+
+    if (quic != NULL && c4_pool_contexts_mutex_created) {
+        c4_pool_context_t** previous = &c4_pool_contexts;
+
+        (void)picoquic_lock_mutex(&c4_pool_contexts_mutex);
+        while ((context = *previous) != NULL) {
+            if (context->quic == quic) {
+                *previous = context->next_context;
+                break;
+            }
+            previous = &context->next_context;
+        }
+        (void)picoquic_unlock_mutex(&c4_pool_contexts_mutex);
+    }
+    if (context != NULL) {
+        /* If paths still use the pool, the actual deletion happens
+         * when the last of them is deleted. */
+        c4_pool_delete(context->pool);
+        free(context);
+    }
+}
+
+int c4_get_state_pool_stats(picoquic_quic_t* quic, c4_pool_stats_t* stats)
+{
+    int ret = -1;
+    c4_pool_t* pool = c4_find_state_pool(quic);
+
+    if (pool != NULL) {
+        c4_pool_get_stats(pool, stats);
+        ret = 0;
+    }
+    return ret;
+}
+
+/* Allocate a C4 state, aligned on a cache line so that the hot
+* block only occupies one line. The state is taken from the pool
+* of the QUIC context if there is one.
+ */
+static c4_state_t* c4_state_alloc(picoquic_quic_t* quic)
+{
+    c4_state_t* c4_state = NULL;
+    c4_pool_t* pool = c4_find_state_pool(quic);
+    void* raw_memory = NULL;
+
+    if (pool != NULL) {
+        c4_state = (c4_state_t*)c4_pool_alloc(pool);
+    }
+    else if ((raw_memory = malloc(sizeof(c4_state_t) + C4_POOL_CACHE_LINE - 1)) != NULL) {
+        c4_state = (c4_state_t*)(((uintptr_t)raw_memory + C4_POOL_CACHE_LINE - 1) &
+            ~((uintptr_t)C4_POOL_CACHE_LINE - 1));
+    }
+    if (c4_state != NULL) {
+        memset(c4_state, 0, sizeof(c4_state_t));
+        c4_state->pool = pool;
+        c4_state->raw_memory = raw_memory;
+        c4_state->transition_hook = c4_default_transition_hook;
+        c4_state->transition_hook_ctx = c4_default_transition_hook_ctx;
+    }
+    return c4_state;
+}
+
+static void c4_state_free(c4_state_t* c4_state)
+{
+    if (c4_state->pool != NULL) {
+        c4_pool_free(c4_state->pool, c4_state);
+    }
+    else {
+        free(c4_state->raw_memory);
+    }
+}
+
+/* Bulk evaluation, in structure of arrays form.
+* All the arrays are carved from a single allocation, each starting
+* on a cache line boundary.
+ */
+struct st_c4_bulk_t {
+    size_t nb_paths;
+    size_t nb_paths_max;
+    /* Inputs */
+    uint64_t* nominal_rate;
+    uint64_t* sensitivity_rate;
+    uint32_t* nominal_max_rtt;
+    uint32_t* alpha_1024;
+    uint32_t* send_mtu;
+    uint32_t* alg_state;
+    /* Outputs */
+    uint32_t* sensitivity_1024;
+    uint32_t* delay_threshold;
+    uint64_t* target_cwin;
+    uint64_t* pacing_rate;
+    /* Memory holding all the arrays */
+    void* raw_memory;
+};
+
+#define C4_BULK_ARRAY_SIZE(nb, t) ((((nb) * sizeof(t)) + C4_POOL_CACHE_LINE - 1) & ~((size_t)C4_POOL_CACHE_LINE - 1))
+
+c4_bulk_t* c4_bulk_create(size_t nb_paths_max)
+{
+    c4_bulk_t* bulk = NULL;
+    size_t size_64 = C4_BULK_ARRAY_SIZE(nb_paths_max, uint64_t);
+    size_t size_32 = C4_BULK_ARRAY_SIZE(nb_paths_max, uint32_t);
+    uint8_t* raw_memory = NULL;
+
+    if (nb_paths_max == 0 || nb_paths_max > SIZE_MAX / (8 * sizeof(uint64_t))) {
+        return NULL;
+    }
+    if ((bulk = (c4_bulk_t*)malloc(sizeof(c4_bulk_t))) != NULL) {
+        memset(bulk, 0, sizeof(c4_bulk_t));
+        if ((raw_memory = (uint8_t*)malloc(4 * size_64 + 6 * size_32 + C4_POOL_CACHE_LINE - 1)) == NULL) {
+            free(bulk);
+            bulk = NULL;
+        }
+        else {
+            uint8_t* x = (uint8_t*)(((uintptr_t)raw_memory + C4_POOL_CACHE_LINE - 1) &
+                ~((uintptr_t)C4_POOL_CACHE_LINE - 1));
+
+            bulk->raw_memory = raw_memory;
+            bulk->nb_paths_max = nb_paths_max;
+            bulk->nominal_rate = (uint64_t*)x;
+            x += size_64;
+            bulk->sensitivity_rate = (uint64_t*)x;
+            x += size_64;
+            bulk->target_cwin = (uint64_t*)x;
+            x += size_64;
+            bulk->pacing_rate = (uint64_t*)x;
+            x += size_64;
+            bulk->nominal_max_rtt = (uint32_t*)x;
+            x += size_32;
+            bulk->alpha_1024 = (uint32_t*)x;
+            x += size_32;
+            bulk->send_mtu = (uint32_t*)x;
+            x += size_32;
+            bulk->alg_state = (uint32_t*)x;
+            x += size_32;
+            bulk->sensitivity_1024 = (uint32_t*)x;
+            x += size_32;
+            bulk->delay_threshold = (uint32_t*)x;
+        }
+    }
+    return bulk;
+}
+
+void c4_bulk_delete(c4_bulk_t* bulk)
+{
+    free(bulk->raw_memory);
+    free(bulk);
+}
+
+size_t c4_bulk_load(c4_bulk_t* bulk, picoquic_path_t** paths, size_t nb_paths)
+{
+    if (nb_paths > bulk->nb_paths_max) {
+        nb_paths = bulk->nb_paths_max;
+    }
+    for (size_t i = 0; i < nb_paths; i++) {
+        c4_state_t* c4_state = c4_get_state(paths[i]);
+
+        if (c4_state != NULL) {
+            bulk->nominal_rate[i] = c4_state->nominal_rate;
+            bulk->sensitivity_rate[i] = c4_sensitivity_rate(c4_state);
+            bulk->nominal_max_rtt[i] = c4_state->nominal_max_rtt;
+            bulk->alpha_1024[i] = c4_state->alpha_1024_current;
+            bulk->send_mtu[i] = (uint32_t)paths[i]->send_mtu;
+            bulk->alg_state[i] = c4_state->alg_state;
+        }
+        else {
+            bulk->nominal_rate[i] = 0;
+            bulk->sensitivity_rate[i] = 0;
+            bulk->nominal_max_rtt[i] = 0;
+            bulk->alpha_1024[i] = 0;
+            bulk->send_mtu[i] = 0;
+            bulk->alg_state[i] = 0;
+        }
+    }
+    bulk->nb_paths = nb_paths;
+    return nb_paths;
+}
+
+void c4_bulk_evaluate(c4_bulk_t* bulk)
+{
+    size_t nb_paths = bulk->nb_paths;
+    uint64_t* nominal_rate = bulk->nominal_rate;
+    uint32_t* nominal_max_rtt = bulk->nominal_max_rtt;
+    uint32_t* sensitivity_1024 = bulk->sensitivity_1024;
+    uint32_t* delay_threshold = bulk->delay_threshold;
+    uint64_t* pacing_rate = bulk->pacing_rate;
+    uint64_t* target_cwin = bulk->target_cwin;
+
+    /* Separate loops, so that each one only touches a few arrays */
+    for (size_t i = 0; i < nb_paths; i++) {
+        sensitivity_1024[i] = (uint32_t)c4_rate_sensitivity_1024(bulk->sensitivity_rate[i]);
+    }
+    for (size_t i = 0; i < nb_paths; i++) {
+        delay_threshold[i] = (uint32_t)c4_rtt_delay_threshold(sensitivity_1024[i], nominal_max_rtt[i]);
+    }
+    for (size_t i = 0; i < nb_paths; i++) {
+        uint64_t rate = MULT1024((uint64_t)bulk->alpha_1024[i], nominal_rate[i]);
+        uint64_t cwin = c4_target_cwin(rate, nominal_rate[i], nominal_max_rtt[i],
+            bulk->alpha_1024[i], bulk->alg_state[i] == c4_pushing, bulk->send_mtu[i]);
+        int is_initial = (bulk->alg_state[i] == c4_initial || bulk->alg_state[i] == c4_cr_reconnaissance);
+
+        target_cwin[i] = (is_initial && cwin < PICOQUIC_CWIN_INITIAL) ? PICOQUIC_CWIN_INITIAL : cwin;
+        pacing_rate[i] = (is_initial) ? MULT1024(1024 + 256, rate) : rate;
+    }
+}
+
+size_t c4_bulk_apply(c4_bulk_t* bulk, picoquic_path_t** paths, size_t nb_paths)
+{
+    size_t nb_applied = 0;
+
+    if (nb_paths > bulk->nb_paths) {
+        nb_paths = bulk->nb_paths;
+    }
+    for (size_t i = 0; i < nb_paths; i++) {
+        c4_state_t* c4_state = c4_get_state(paths[i]);
+
+        if (c4_state != NULL &&
+            c4_state->alg_state != c4_initial &&
+            (c4_state->alg_state < c4_cr_reconnaissance || c4_state->alg_state > c4_cr_validating) &&
+            c4_state->alg_state == bulk->alg_state[i] &&
+            c4_state->nominal_rate == bulk->nominal_rate[i] &&
+            c4_sensitivity_rate(c4_state) == bulk->sensitivity_rate[i] &&
+            c4_state->nominal_max_rtt == bulk->nominal_max_rtt[i] &&
+            c4_state->alpha_1024_current == bulk->alpha_1024[i] &&
+            paths[i]->send_mtu == bulk->send_mtu[i]) {
+            c4_state->delay_threshold = (uint16_t)bulk->delay_threshold[i];
+            c4_set_cwin_and_pacing(paths[i], c4_state, bulk->target_cwin[i], bulk->pacing_rate[i]);
+            nb_applied++;
+        }
+    }
+    return nb_applied;
+}
+
+/* Recording of notifications.
+* When recording is enabled, the calls to c4_init, c4_notify, c4_notify_ack_batch
+* and c4_delete are written to a record file, with the path variables read by C4
+* and the CWIN and pacing rate decided after the call. There is one file per path,
+* named after the initial connection ID and the path identifier. Recording is
+* enabled for all connections if a record directory is set, or per connection
+* with the option 'R', in which case files are written in the current directory.
+ */
+static char c4_record_directory[C4_RECORD_DIRECTORY_MAX];
+
+int c4_set_record_directory(char const* directory)
+{
+    int ret = 0;
+
+    if (directory == NULL) {
+        c4_record_directory[0] = 0;
+    }
+    else if (strlen(directory) >= C4_RECORD_DIRECTORY_MAX) {
+        ret = -1;
+    }
+    else {
+        memcpy(c4_record_directory, directory, strlen(directory) + 1);
+    }
+    return ret;
+}
+
+/* The notification is only set by the caller for notify records, the
+* other records do not carry one.
+ */
+static void c4_record_prepare(c4_record_event_t* ev, picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    c4_record_type_enum record_type, picoquic_per_ack_state_t* ack_states, size_t nb_ack_states, uint64_t current_time)
+{
+    ev->record_type = record_type;
+    ev->current_time = current_time;
+    ev->has_ack_state = (ack_states != NULL && nb_ack_states > 0);
+    ev->nb_ack_states = nb_ack_states;
+    ev->ack_states = ack_states;
+    ev->option_string[0] = 0;
+    c4_record_capture_path(ev, cnx, path_x);
+}
+
+static void c4_record_finish(c4_state_t* c4_state, c4_record_event_t* ev, picoquic_path_t* path_x)
+{
+    c4_record_capture_decision(ev, path_x, c4_state->alg_state);
+    if (c4_record_write(c4_state->recorder, ev) != 0) {
+        /* Stop recording if the file cannot be written */
+        c4_record_close(c4_state->recorder);
+        c4_state->recorder = NULL;
+    }
+}
+
+/* Name the file of a path after the initial connection ID and the path
+* identifier, in the directory, or in the current directory if none is set.
+* Returns -1 if the name does not fit.
+ */
+static int c4_path_file_name(char* file_name, size_t file_name_max, char const* directory,
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x, char const* extension)
+{
+    char icid_text[2 * sizeof(cnx->initial_cnxid.id) + 1];
+    static const char hex_digits[] = "0123456789abcdef";
+    size_t icid_len = (cnx->initial_cnxid.id_len < sizeof(cnx->initial_cnxid.id)) ?
+        cnx->initial_cnxid.id_len : sizeof(cnx->initial_cnxid.id);
+    int len;
+
+    for (size_t i = 0; i < icid_len; i++) {
+        icid_text[2 * i] = hex_digits[cnx->initial_cnxid.id[i] >> 4];
+        icid_text[2 * i + 1] = hex_digits[cnx->initial_cnxid.id[i] & 0xf];
+    }
+    icid_text[2 * icid_len] = 0;
+    len = snprintf(file_name, file_name_max, "%s/c4_%s_%" PRIu64 ".%s",
+        (directory[0] != 0) ? directory : ".", icid_text, path_x->unique_path_id, extension);
+
+    return (len > 0 && (size_t)len < file_name_max) ? 0 : -1;
+}
+
+static void c4_record_start(picoquic_cnx_t* cnx, picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t current_time)
+{
+    char file_name[C4_RECORD_DIRECTORY_MAX + 64];
+
+    if (c4_path_file_name(file_name, sizeof(file_name), c4_record_directory, cnx, path_x, "c4rec") == 0 &&
+        (c4_state->recorder = c4_record_open(file_name)) != NULL) {
+        c4_record_event_t ev;
+        size_t option_len = 0;
+
+        c4_record_prepare(&ev, cnx, path_x, c4_record_init, NULL, 0, current_time);
+        if (c4_state->option_string != NULL) {
+            while (option_len < C4_RECORD_MAX_OPTIONS && c4_state->option_string[option_len] != 0) {
+                ev.option_string[option_len] = c4_state->option_string[option_len];
+                option_len++;
+            }
+        }
+        ev.option_string[option_len] = 0;
+        c4_record_finish(c4_state, &ev, path_x);
+    }
+}
+
+/* Columnar trace of the rate samples and state transitions.
+* The samples are the same as those of the trace ring, and the file is
+* named like the record file. The trace is enabled for all connections
+* if a trace directory is set, or per connection with the option 'B'.
+ */
+static char c4_column_directory[C4_RECORD_DIRECTORY_MAX];
+
+int c4_set_column_directory(char const* directory)
+{
+    int ret = 0;
+
+    if (directory == NULL) {
+        c4_column_directory[0] = 0;
+    }
+    else if (strlen(directory) >= C4_RECORD_DIRECTORY_MAX) {
+        ret = -1;
+    }
+    else {
+        memcpy(c4_column_directory, directory, strlen(directory) + 1);
+    }
+    return ret;
+}
+
+static void c4_column_start(picoquic_cnx_t* cnx, picoquic_path_t* path_x, c4_state_t* c4_state)
+{
+    char file_name[C4_RECORD_DIRECTORY_MAX + 64];
+
+    if (c4_path_file_name(file_name, sizeof(file_name), c4_column_directory, cnx, path_x, "c4col") == 0) {
+        c4_state->columns = c4_column_open(file_name);
+    }
+}
+
+/* Cache of estimates, shared by all the connections of the process.
+* When a path that left the initial state is deleted, its nominal rate,
+* max RTT and min RTT are stored under the prefix of the peer address.
+* New paths to the same prefix are seeded with the product of the cached
+* rate and min RTT, through the same seed CWIN notification used by
+* picoquic for resumed connections. This is recorded like any other
+* notification, so replays do not need the cache.
+* The same estimates can also be kept in a store file, which survives
+* restarts and can be shared between processes. The store is only read
+* if the cache has no estimate for the prefix.
+ */
+static c4_cache_t* c4_estimate_cache;
+static c4_store_t* c4_estimate_store;
+static uint64_t c4_estimate_store_ttl;
+
+int c4_set_estimate_cache(size_t nb_entries_max, uint64_t ttl)
+{
+    int ret = -1;
+
+    if (c4_estimate_cache == NULL &&
+        (c4_estimate_cache = c4_cache_create(nb_entries_max, ttl)) != NULL) {
+        ret = 0;
+    }
+    return ret;
+}
+
+void c4_release_estimate_cache(void)
+{
+    c4_cache_delete(c4_estimate_cache);
+    c4_estimate_cache = NULL;
+}
+
+int c4_get_estimate_cache_stats(c4_cache_stats_t* stats)
+{
+    int ret = -1;
+
+    if (c4_estimate_cache != NULL) {
+        c4_cache_get_stats(c4_estimate_cache, stats);
+        ret = 0;
+    }
+    return ret;
+}
+
+int c4_set_estimate_store(char const* file_name, size_t nb_records_max, uint64_t ttl)
+{
+    int ret = -1;
+
+    if (c4_estimate_store == NULL &&
+        (c4_estimate_store = c4_store_open(file_name, nb_records_max)) != NULL) {
+        c4_estimate_store_ttl = ttl;
+        ret = 0;
+    }
+    return ret;
+}
+
+void c4_release_estimate_store(void)
+{
+    c4_store_close(c4_estimate_store);
+    c4_estimate_store = NULL;
+}
+
+/* The confidence is the number of paths merged in the estimate. The
+* entries of the cache come from a single path.
+ */
+static int c4_estimate_lookup(picoquic_path_t* path_x, c4_estimate_t* estimate, uint16_t* confidence, uint64_t current_time)
+{
+    struct sockaddr* peer_addr = (struct sockaddr*)&path_x->first_tuple->peer_addr;
+    int ret = c4_cache_lookup(c4_estimate_cache, peer_addr, estimate, current_time);
+
+    *confidence = 1;
+    if (ret != 0 && c4_estimate_store != NULL) {
+        c4_store_record_t record;
+
+        if ((ret = c4_store_lookup(c4_estimate_store, peer_addr, &record, current_time, c4_estimate_store_ttl)) == 0) {
+            *estimate = record.estimate;
+            *confidence = record.confidence;
+        }
+    }
+    return ret;
+}
+
+/* Seed CWIN derived from an estimate, scaled by its confidence: from
+* 9/16 of the estimated BDP for a single path to all of it once
+* C4_STORE_CONFIDENCE_MAX paths were merged.
+ */
+static uint64_t c4_estimate_seed_cwin(c4_estimate_t const* estimate, uint16_t confidence)
+{
+    uint64_t bdp = (estimate->nominal_rate * estimate->running_min_rtt) / 1000000;
+
+    if (confidence > C4_STORE_CONFIDENCE_MAX) {
+        confidence = C4_STORE_CONFIDENCE_MAX;
+    }
+    return (bdp * (C4_STORE_CONFIDENCE_MAX + confidence)) / (2 * C4_STORE_CONFIDENCE_MAX);
+}
+
+/* The estimates are cached per prefix, so they may come from another host
+* of the same /24 or /48. They are only used with careful resume, which
+* validates the seed in reconnaissance before the jump.
+ */
+static void c4_estimate_seed(picoquic_cnx_t* cnx, picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t current_time)
+{
+    c4_estimate_t estimate;
+    uint16_t confidence;
+
+    if (c4_state->do_careful_resume && path_x->first_tuple != NULL &&
+        c4_estimate_lookup(path_x, &estimate, &confidence, current_time) == 0) {
+        uint64_t seed_cwin = c4_estimate_seed_cwin(&estimate, confidence);
+
+        if (seed_cwin > PICOQUIC_CWIN_INITIAL && estimate.running_min_rtt > 0) {
+            picoquic_per_ack_state_t ack_state = { 0 };
+
+            ack_state.nb_bytes_acknowledged = seed_cwin;
+            ack_state.rtt_measurement = estimate.running_min_rtt;
+            c4_notify(cnx, path_x, picoquic_congestion_notification_seed_cwin, &ack_state, current_time);
+        }
+    }
+}
+
+static void c4_estimate_save(picoquic_path_t* path_x, c4_state_t* c4_state)
+{
+    if (path_x->cnx != NULL && path_x->first_tuple != NULL &&
+        (c4_state->alg_state == c4_recovery || c4_state->alg_state == c4_cruising ||
+            c4_state->alg_state == c4_pushing) && c4_state->nominal_rate > 0 &&
+        c4_state->nominal_max_rtt > 0 && c4_state->running_min_rtt < C4_RTT_MAX) {
+        c4_estimate_t estimate;
+        struct sockaddr* peer_addr = (struct sockaddr*)&path_x->first_tuple->peer_addr;
+        uint64_t current_time = picoquic_get_quic_time(path_x->cnx->quic);
+
+        estimate.nominal_rate = c4_state->nominal_rate;
+        estimate.nominal_max_rtt = c4_state->nominal_max_rtt;
+        estimate.running_min_rtt = c4_state->running_min_rtt;
+        c4_cache_store(c4_estimate_cache, peer_addr, &estimate, current_time);
+        c4_store_update(c4_estimate_store, peer_addr, &estimate, current_time, c4_estimate_store_ttl);
+    }
+}
+
 void c4_init(picoquic_cnx_t * cnx, picoquic_path_t* path_x, char const* option_string, uint64_t current_time)
 {
     /* Initialize the state of the congestion control algorithm */
@@ -516,16 +1923,29 @@ void c4_init(picoquic_cnx_t * cnx, picoquic_path_t* path_x, char const* option_s
 #endif
     
     if (c4_state == NULL) {
-        c4_state = (c4_state_t*)malloc(sizeof(c4_state_t));
+        c4_state = c4_state_alloc(cnx->quic);
     }
     
     if (c4_state != NULL){
         cnx->is_lost_feedback_notification_required = 1;
+        if (!c4_rtt_horizons_in_use) {
+            c4_rtt_horizons_in_use = 1;
+        }
         
         c4_reset(c4_state, path_x, option_string, current_time);
+        if (c4_state->recorder == NULL && (c4_state->do_record || c4_record_directory[0] != 0)) {
+            c4_record_start(cnx, path_x, c4_state, current_time);
+        }
+        if (c4_state->columns == NULL && (c4_state->do_columns || c4_column_directory[0] != 0)) {
+            c4_column_start(cnx, path_x, c4_state);
+        }
     }
 
     path_x->congestion_alg_state = (void*)c4_state;
+
+    if (c4_state != NULL && (c4_estimate_cache != NULL || c4_estimate_store != NULL)) {
+        c4_estimate_seed(cnx, path_x, c4_state, current_time);
+    }
 }
 
 /*
@@ -549,14 +1969,15 @@ static void c4_enter_recovery(
     }
     c4_state->alpha_1024_current = C4_ALPHA_RECOVER_1024;
 
-    if (c4_state->alg_state == c4_initial) {
+    if (c4_state->alg_state == c4_initial || c4_state->alg_state == c4_cr_reconnaissance) {
         c4_growth_reset(c4_state);
     }
     /* There may be multiple congestion signals coming in, but we 
     * will not reinitialize the state if C4 is already in recovery.
      */
     if (c4_state->alg_state != c4_recovery) {
-        c4_state->alg_state = c4_recovery;
+        c4_state->counters.nb_recoveries[c_mode]++;
+        c4_set_state(path_x, c4_state, c4_recovery, c_mode, current_time);
         c4_era_reset(path_x, c4_state);
     }
 }
@@ -572,7 +1993,17 @@ static void c4_exit_recovery(
     c4_state_t* c4_state, uint64_t current_time)
 {
     /* Assess growth */
-    c4_growth_evaluate(c4_state);
+    int growth = c4_growth_evaluate(c4_state);
+
+    if (c4_state->push_alpha > 1024) {
+        /* The recovery followed a push */
+        if (growth > 0) {
+            c4_state->counters.nb_push_succeeded++;
+        }
+        else if (growth < 0) {
+            c4_state->counters.nb_push_failed++;
+        }
+    }
     c4_growth_reset(c4_state);
     /* Reset the delay excess to avoid bounces of delay event */
     c4_state->recent_delay_excess = 0;
@@ -580,11 +2011,14 @@ static void c4_exit_recovery(
     * so that the next measurements reflect the new parameters.
     */
     c4_state->smoothed_drop_rate = 0;
-    /* The same should be done for ECN */
-
+    /* Same for ECN: the marks received during recovery reflect the rate
+    * before the reduction, so they are not folded in the CE fraction.
+     */
+    c4_ecn_era_restart(path_x, c4_state);
 
     /* Trigger the cascade if we have many successful pushes */
     if (c4_state->nb_push_no_congestion >= C4_NB_PUSH_BEFORE_RESET) {
+        c4_state->counters.nb_cascades++;
         c4_enter_initial(path_x, c4_state, current_time);
     }
     else {
@@ -611,7 +2045,25 @@ static void c4_enter_cruise(
         c4_state->nb_cruise_left_before_push = C4_NB_CRUISE_BEFORE_PUSH;
     }
     c4_state->alpha_1024_current = C4_ALPHA_CRUISE_1024;
-    c4_state->alg_state = c4_cruising;
+    c4_set_state(path_x, c4_state, c4_cruising, c4_congestion_none, current_time);
+}
+
+/* Application rate hint.
+* If the application announced the rate and burst that it will send, there
+* is no need to push while the nominal rate and the cruising CWIN already
+* cover them. Pushing would only add queues, without benefit to the
+* application.
+ */
+static int c4_hint_covers_demand(c4_state_t* c4_state)
+{
+    int is_covered = 0;
+
+    if (c4_state->hint_rate > 0 && c4_state->hint_rate <= c4_state->nominal_rate) {
+        uint64_t cruise_cwin = MULT1024(C4_ALPHA_CRUISE_1024,
+            (c4_state->nominal_rate * c4_state->nominal_max_rtt) / 1000000);
+        is_covered = (c4_state->hint_burst <= cruise_cwin);
+    }
+    return is_covered;
 }
 
 /* Enter push.
@@ -630,26 +2082,146 @@ static void c4_enter_push(
     else {
         c4_state->alpha_1024_current = C4_ALPHA_PUSH_1024;
     }
+    if (c4_state->hint_rate > 0 && c4_state->nominal_rate > 0) {
+        /* If the application expects a rate just above the nominal rate,
+         * push only as much as needed to reach it, but not less than the
+         * low push. */
+        uint64_t hint_alpha = (c4_state->hint_rate * 1024) / c4_state->nominal_rate;
+        if (hint_alpha < C4_ALPHA_PUSH_LOW_1024) {
+            hint_alpha = C4_ALPHA_PUSH_LOW_1024;
+        }
+        if (hint_alpha < c4_state->alpha_1024_current) {
+            c4_state->alpha_1024_current = (uint16_t)hint_alpha;
+        }
+    }
+    if (c4_state->do_coupled) {
+        c4_state->alpha_1024_current = (uint16_t)c4_coupled_push_alpha(path_x, c4_state, c4_state->alpha_1024_current);
+    }
     c4_state->push_alpha = c4_state->alpha_1024_current;
     c4_era_reset(path_x, c4_state);
-    c4_state->alg_state = c4_pushing;
+    c4_set_state(path_x, c4_state, c4_pushing, c4_congestion_none, current_time);
+}
+
+/* Careful resume.
+* When the seed CWIN comes with the RTT of the previous connection, C4
+* does not trust it immediately, but follows the phases of careful resume:
+* - reconnaissance: behave as in the initial state, and check that the
+*   min RTT is within C4_CR_RTT_LOW_DIVIDER and C4_CR_RTT_HIGH_MULTIPLIER
+*   of the seed RTT. If not, or if congestion is detected, the seed is
+*   ignored and C4 continues in the initial state.
+* - unvalidated: once the sender is limited by the CWIN, jump to half the
+*   seed CWIN, paced over the current RTT. The jump is reduced in proportion
+*   if the current RTT is smaller than the seed RTT.
+* - validating: after the first packet of the jump is acknowledged, keep
+*   the CWIN at the bytes acknowledged since the jump, until the packets
+*   sent during the jump are acknowledged. The nominal rate then reflects
+*   the rate delivered during the jump, and C4 continues in the initial
+*   state from that rate.
+* - safe retreat: on congestion during the jump or the validation, the
+*   rate is set to half the bytes acknowledged since the jump per RTT,
+*   and C4 exits as from recovery once the packets in flight are acked.
+ */
+static void c4_cr_enter_unvalidated(picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t current_time)
+{
+    uint64_t jump_cwin = c4_state->seed_cwin / 2;
+
+    if (c4_state->running_min_rtt < c4_state->seed_rtt) {
+        jump_cwin = (jump_cwin * c4_state->running_min_rtt) / c4_state->seed_rtt;
+    }
+    if (jump_cwin <= path_x->cwin) {
+        /* Nothing to gain from the jump */
+        c4_set_state(path_x, c4_state, c4_initial, c4_congestion_none, current_time);
+    }
+    else {
+        c4_state->cr_jump_cwin = jump_cwin;
+        c4_state->cr_pipe_size = 0;
+        /* The jump replaces the growth of the initial state */
+        c4_state->alpha_1024_current = C4_ALPHA_CRUISE_1024;
+        c4_set_state(path_x, c4_state, c4_cr_unvalidated, c4_congestion_none, current_time);
+        c4_era_reset(path_x, c4_state);
+    }
+}
+
+static void c4_cr_reconnaissance_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, size_t nb_acks, uint64_t current_time)
+{
+    c4_initial_handle_ack(path_x, c4_state, nb_acks, current_time);
+
+    if (c4_state->alg_state == c4_cr_reconnaissance && c4_state->running_min_rtt < C4_RTT_MAX) {
+        if (C4_CR_RTT_LOW_DIVIDER * (uint64_t)c4_state->running_min_rtt < c4_state->seed_rtt ||
+            c4_state->running_min_rtt > C4_CR_RTT_HIGH_MULTIPLIER * (uint64_t)c4_state->seed_rtt) {
+            /* The path does not match the seed */
+            c4_set_state(path_x, c4_state, c4_initial, c4_congestion_none, current_time);
+        }
+        else if (c4_state->era_not_app_limited) {
+            c4_cr_enter_unvalidated(path_x, c4_state, current_time);
+        }
+    }
+}
+
+static void c4_cr_enter_safe_retreat(picoquic_path_t* path_x, c4_state_t* c4_state, c4_congestion_t c_mode, uint64_t current_time)
+{
+    uint64_t rtt = (c4_state->running_min_rtt < C4_RTT_MAX) ? c4_state->running_min_rtt : path_x->smoothed_rtt;
+    uint64_t retreat_rate = ((c4_state->cr_pipe_size / 2) * 1000000) / rtt;
+    uint64_t min_rate = ((uint64_t)PICOQUIC_CWIN_INITIAL * 1000000) / rtt;
+
+    c4_set_nominal_rate(c4_state, (retreat_rate > min_rate) ? retreat_rate : min_rate);
+    c4_state->delay_threshold = (uint16_t)c4_delay_threshold(c4_state);
+    if (c4_state->do_rate_filter) {
+        c4_rate_filter_reset(c4_state);
+    }
+    c4_state->alpha_1024_current = C4_ALPHA_RECOVER_1024;
+    c4_state->nb_push_no_congestion = 0;
+    c4_state->recent_delay_excess = 0;
+    c4_growth_reset(c4_state);
+    c4_set_state(path_x, c4_state, c4_cr_safe_retreat, c_mode, current_time);
+    c4_era_reset(path_x, c4_state);
+}
+
+/* Congestion signals during careful resume. Returns 1 if the signal was
+* handled, 0 if it shall be processed as in the initial state.
+ */
+static int c4_cr_handle_congestion(picoquic_path_t* path_x, c4_state_t* c4_state, c4_congestion_t c_mode, uint64_t current_time)
+{
+    int ret = 1;
+
+    switch (c4_state->alg_state) {
+    case c4_cr_reconnaissance:
+        c4_set_state(path_x, c4_state, c4_initial, c_mode, current_time);
+        ret = 0;
+        break;
+    case c4_cr_unvalidated:
+    case c4_cr_validating:
+        c4_state->congestion_notified = 1;
+        c4_cr_enter_safe_retreat(path_x, c4_state, c_mode, current_time);
+        c4_apply_rate_and_cwin(path_x, c4_state);
+        path_x->is_ssthresh_initialized = 1;
+        break;
+    default:
+        /* Already retreating */
+        break;
+    }
+    return ret;
 }
 
-void c4_update_min_max_rtt(picoquic_path_t* path_x, c4_state_t* c4_state)
+void c4_update_min_max_rtt(picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t current_time)
 {
     /* Include the last sample, to deal with order of arrivals between ACK and RTT */
     if (path_x->rtt_sample > c4_state->era_max_rtt) {
-        c4_state->era_max_rtt = path_x->rtt_sample;
+        c4_state->era_max_rtt = C4_RTT_CAP(path_x->rtt_sample);
     }
     if (path_x->rtt_sample < c4_state->era_min_rtt) {
-        c4_state->era_min_rtt = path_x->rtt_sample;
+        c4_state->era_min_rtt = (uint32_t)path_x->rtt_sample;
     }
-    /* Update the running min RTT, as the max RTT computation depends on it. */
-    if (c4_state->era_min_rtt < c4_state->running_min_rtt) {
-        c4_state->running_min_rtt = c4_state->era_min_rtt;
-    }
-    else if (c4_state->alpha_1024_previous <= C4_ALPHA_PREVIOUS_LOW) {
-        c4_state->running_min_rtt = (7 * c4_state->running_min_rtt + c4_state->era_min_rtt) / 8;
+    /* Update the running min RTT, as the max RTT computation depends on it.
+    * If the min RTT filter is used, it is updated with each RTT sample.
+     */
+    if (c4_min_rtt_horizon == 0) {
+        if (c4_state->era_min_rtt < c4_state->running_min_rtt) {
+            c4_state->running_min_rtt = c4_state->era_min_rtt;
+        }
+        else if (c4_state->alpha_1024_previous <= C4_ALPHA_PREVIOUS_LOW) {
+            c4_state->running_min_rtt = (uint32_t)((7 * (uint64_t)c4_state->running_min_rtt + c4_state->era_min_rtt) / 8);
+        }
     }
     /* Update the max RTT */
     if (c4_state->nominal_max_rtt == 0) {
@@ -659,27 +2231,116 @@ void c4_update_min_max_rtt(picoquic_path_t* path_x, c4_state_t* c4_state)
         /* We want to increase the max RTT, but we want to limit the jitter
          * measurement to avoid aberrant behavior.
          */
-        uint64_t corrected_max = (c4_state->era_max_rtt < c4_state->running_min_rtt + C4_MAX_JITTER) ?
-            c4_state->era_max_rtt : c4_state->running_min_rtt + C4_MAX_JITTER;
+        uint64_t max_jitter_rtt = (uint64_t)c4_state->running_min_rtt + C4_MAX_JITTER;
+        uint64_t era_max_rtt = c4_state->era_max_rtt;
+        uint64_t corrected_max;
+
+        if (c4_max_rtt_per_mille < 1000 && c4_state->rtt_histogram.total >= C4_RTT_HISTOGRAM_MIN_COUNT) {
+            /* Use a high percentile of the recent samples, so that a single
+             * outlier does not inflate the CWIN. The histogram remembers
+             * more than one era, so the percentile only lowers the era max. */
+            uint32_t percentile_rtt = c4_rtt_histogram_percentile(&c4_state->rtt_histogram, c4_max_rtt_per_mille);
+            if (percentile_rtt < era_max_rtt) {
+                era_max_rtt = percentile_rtt;
+            }
+        }
+        corrected_max = (era_max_rtt < max_jitter_rtt) ? era_max_rtt : max_jitter_rtt;
 
-        if (corrected_max > c4_state->nominal_max_rtt) {
-            c4_state->nominal_max_rtt = corrected_max;
+        if (c4_max_rtt_horizon > 0) {
+            if (corrected_max > 0) {
+                c4_state->nominal_max_rtt = c4_minmax_running_max(&c4_state->max_rtt_filter, c4_max_rtt_horizon,
+                    current_time, C4_RTT_CAP(corrected_max));
+            }
+        }
+        else if (corrected_max > c4_state->nominal_max_rtt) {
+            c4_state->nominal_max_rtt = C4_RTT_CAP(corrected_max);
         }
         else if (c4_state->alpha_1024_previous <= C4_ALPHA_PREVIOUS_LOW) {
             /* If not growing, slowly diminish the max rtt */
-            c4_state->nominal_max_rtt = (7 * c4_state->nominal_max_rtt + corrected_max) / 8;
+            c4_state->nominal_max_rtt = (uint32_t)((7 * (uint64_t)c4_state->nominal_max_rtt + corrected_max) / 8);
         }
     }
     /* Recompute the delay threshold if the max RTT was updated. */
-    c4_state->delay_threshold = c4_delay_threshold(c4_state);
+    c4_state->delay_threshold = (uint16_t)c4_delay_threshold(c4_state);
 }
 
-/* Handle data ack event.
+/* Record a rate sample in the trace ring.
+* This is called on every ACK, so we only copy the raw values.
+* If the ring is full, the oldest sample is overwritten.
  */
-void c4_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_ack_state_t* ack_state, uint64_t current_time)
+static void c4_trace_record(c4_state_t* c4_state, picoquic_per_ack_state_t* ack_state,
+    uint64_t rate_measurement, uint64_t current_time)
+{
+    c4_trace_ring_t* ring = c4_state->trace_ring;
+    c4_trace_sample_t* sample;
+
+    if (ring->nb_written - ring->nb_read >= C4_TRACE_RING_SIZE) {
+        ring->nb_read++;
+        ring->nb_overwritten++;
+    }
+    sample = &ring->samples[ring->nb_written & (C4_TRACE_RING_SIZE - 1)];
+    sample->current_time = current_time;
+    sample->rate_measurement = rate_measurement;
+    sample->nominal_rate = c4_state->nominal_rate;
+    sample->bytes_delivered = ack_state->nb_bytes_delivered_since_packet_sent;
+    sample->rtt = ack_state->rtt_measurement;
+    sample->send_delay = ack_state->send_delay;
+    sample->nominal_max_rtt = c4_state->nominal_max_rtt;
+    sample->alg_state = (uint8_t)c4_state->alg_state;
+    sample->congestion_notified = (uint8_t)c4_state->congestion_notified;
+    ring->nb_written++;
+}
+
+/* Dump the samples remaining in the trace ring to the connection log.
+* This is only done when the path is deleted, out of the ACK path.
+ */
+static void c4_trace_dump(picoquic_path_t* path_x, c4_trace_ring_t* ring)
+{
+    while (ring->nb_read < ring->nb_written) {
+        c4_trace_sample_t* sample = &ring->samples[ring->nb_read & (C4_TRACE_RING_SIZE - 1)];
+        picoquic_log_app_message(path_x->cnx,
+            "C4_trace, %" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d, %d",
+            sample->current_time, sample->rate_measurement, sample->nominal_rate,
+            sample->bytes_delivered, sample->rtt, sample->send_delay,
+            sample->nominal_max_rtt, (int)sample->alg_state, (int)sample->congestion_notified);
+        ring->nb_read++;
+    }
+}
+
+/* Write the rate sample to the columnar trace. */
+static void c4_column_record_sample(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_ack_state_t* ack_state,
+    uint64_t rate_measurement, uint64_t current_time)
+{
+    c4_column_sample_t sample;
+
+    sample.current_time = current_time;
+    sample.rate_measurement = rate_measurement;
+    sample.nominal_rate = c4_state->nominal_rate;
+    sample.bytes_delivered = ack_state->nb_bytes_delivered_since_packet_sent;
+    sample.bandwidth_estimate = path_x->bandwidth_estimate;
+    sample.rtt = c4_column_clamp(ack_state->rtt_measurement);
+    sample.send_delay = c4_column_clamp(ack_state->send_delay);
+    sample.nominal_max_rtt = c4_state->nominal_max_rtt;
+    sample.alg_state = (uint8_t)c4_state->alg_state;
+    sample.congestion_notified = (uint8_t)c4_state->congestion_notified;
+    c4_column_check(c4_state, c4_column_add_sample(c4_state->columns, &sample));
+}
+
+/* Process the rate sample carried in an acknowledgement.
+* Update the nominal rate and the rate limited status, but
+* do not otherwise change the state.
+ */
+static void c4_handle_rate_sample(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_ack_state_t* ack_state, uint64_t current_time)
 {
-    uint64_t previous_rate = c4_state->nominal_rate;
     uint64_t rate_measurement = 0;
+    int can_grow;
+
+    if (c4_state->alg_state == c4_cr_unvalidated || c4_state->alg_state == c4_cr_validating) {
+        c4_state->cr_pipe_size += ack_state->nb_bytes_acknowledged;
+    }
+    if (!ack_state->is_app_limited) {
+        c4_state->era_not_app_limited = 1;
+    }
 
     if (ack_state->rtt_measurement > 0 && ack_state->nb_bytes_delivered_since_packet_sent > 0) {
         uint64_t verified_rtt = (ack_state->rtt_measurement > ack_state->send_delay) ?
@@ -695,38 +2356,71 @@ void c4_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_a
             ack_state->nb_bytes_delivered_since_packet_sent, ack_state->rtt_measurement, ack_state->send_delay,
             c4_state->nominal_max_rtt, (int)c4_state->alg_state, path_x->bandwidth_estimate, c4_state->congestion_notified);
 #endif
+        if (c4_state->trace_ring != NULL) {
+            c4_trace_record(c4_state, ack_state, rate_measurement, current_time);
+        }
+        if (c4_state->columns != NULL) {
+            c4_column_record_sample(path_x, c4_state, ack_state, rate_measurement, current_time);
+        }
 
-        /* Assessment of rate limited status */
-        if (rate_measurement > c4_state->nominal_rate  && 
-            !(c4_state->alg_state == c4_recovery && c4_state->congestion_notified != 0)) {
+        /* Assessment of rate limited status.
+        * The stack marks the packets sent while the application did not
+        * have enough data to fill the CWIN. Samples from these packets
+        * can raise the nominal rate, but a lower value only shows that the
+        * application was slow, so they are not used to lower the filtered
+        * rate or to decide that a push failed. However, if more than a
+        * nominal CWIN was delivered since the packet was sent, the
+        * application did fill the path, so the sample counts as not
+        * limited. Without that fallback, an application flagged as app
+        * limited during startup would never let C4 exit the initial state.
+         */
+        if (!ack_state->is_app_limited) {
             c4_state->push_was_not_limited = 1;
-            c4_state->nominal_rate = rate_measurement;
-            c4_state->delay_threshold = c4_delay_threshold(c4_state);
         }
-        else {
-            /* The ACK rate did not grow, but that's not a proof.
-                * If the number of bytes sent are larger than the corrected bytes,
-                * we know the delivery was slowed by the network, not the app.
-                */
-            uint64_t target_cwin = (previous_rate * c4_state->running_min_rtt) / 1000000;
+        else if (c4_state->running_min_rtt < C4_RTT_MAX) {
+            uint64_t target_cwin = (c4_state->nominal_rate * c4_state->running_min_rtt) / 1000000;
             if (ack_state->nb_bytes_delivered_since_packet_sent > target_cwin) {
                 c4_state->push_was_not_limited = 1;
             }
         }
+        can_grow = !(c4_state->alg_state == c4_recovery && c4_state->congestion_notified != 0) &&
+            c4_state->alg_state != c4_cr_safe_retreat;
+        if (can_grow && rate_measurement > c4_state->era_max_rate &&
+            (!ack_state->is_app_limited || rate_measurement > c4_state->nominal_rate)) {
+            c4_state->era_max_rate = rate_measurement;
+        }
+        if (rate_measurement > c4_state->nominal_rate && can_grow && !c4_state->do_rate_filter) {
+            c4_set_nominal_rate(c4_state, rate_measurement);
+            c4_state->delay_threshold = (uint16_t)c4_delay_threshold(c4_state);
+        }
     }
+}
 
+/* Manage the state transitions after processing nb_acks acknowledgements.
+* Transitions happen at most once per era.
+ */
+static void c4_handle_ack_transitions(picoquic_path_t* path_x, c4_state_t* c4_state, size_t nb_acks, uint64_t current_time)
+{
+    if (c4_state->do_rate_filter && c4_era_check(path_x, c4_state)) {
+        /* Update the nominal rate before the end of era evaluations */
+        c4_rate_filter_update(c4_state);
+    }
     if (c4_state->alg_state == c4_initial) {
-        c4_initial_handle_ack(path_x, c4_state, ack_state, current_time);
+        c4_initial_handle_ack(path_x, c4_state, nb_acks, current_time);
+    }
+    else if (c4_state->alg_state == c4_cr_reconnaissance) {
+        c4_cr_reconnaissance_handle_ack(path_x, c4_state, nb_acks, current_time);
     }
     else {
         if (c4_era_check(path_x, c4_state)) {
             /* Update max rtt and running min rtt */
-            c4_update_min_max_rtt(path_x, c4_state);
+            c4_update_min_max_rtt(path_x, c4_state, current_time);
             /* test need to reenter initial if conditions did change */
             if (!c4_state->initial_after_jitter &&
                 c4_state->nominal_max_rtt > 50000 &&
-                5 * c4_state->running_min_rtt < 2 * c4_state->nominal_max_rtt) {
+                5 * (uint64_t)c4_state->running_min_rtt < 2 * (uint64_t)c4_state->nominal_max_rtt) {
                 c4_state->initial_after_jitter = 1;
+                c4_state->counters.nb_jitter_restarts++;
                 c4_enter_initial(path_x, c4_state, current_time);
             }
             else
@@ -736,19 +2430,37 @@ void c4_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_a
                 case c4_recovery:
                     c4_exit_recovery(path_x, c4_state, current_time);
                     break;
-                case c4_cruising:
+                case c4_cruising: {
+                    int was_not_app_limited = c4_state->era_not_app_limited;
                     if (c4_state->nb_cruise_left_before_push > 0) {
                         c4_state->nb_cruise_left_before_push--;
                     }
                     c4_era_reset(path_x, c4_state);
+                    /* An application that announced a higher rate will soon
+                     * send more, so the push does not wait for it. */
                     if (c4_state->nb_cruise_left_before_push <= 0 &&
-                        path_x->last_time_acked_data_frame_sent > path_x->last_sender_limited_time) {
+                        (was_not_app_limited || c4_state->hint_rate > c4_state->nominal_rate) &&
+                        !c4_hint_covers_demand(c4_state)) {
                         c4_enter_push(path_x, c4_state, current_time);
                     }
                     break;
+                }
                 case c4_pushing:
                     c4_enter_recovery(path_x, c4_state, c4_congestion_none, current_time);
                     break;
+                case c4_cr_unvalidated:
+                    /* The first packet of the jump was acknowledged */
+                    c4_set_state(path_x, c4_state, c4_cr_validating, c4_congestion_none, current_time);
+                    c4_era_reset(path_x, c4_state);
+                    break;
+                case c4_cr_validating:
+                    /* The packets of the jump were acknowledged without congestion.
+                     * Continue the startup from the validated rate. */
+                    c4_enter_initial(path_x, c4_state, current_time);
+                    break;
+                case c4_cr_safe_retreat:
+                    c4_exit_recovery(path_x, c4_state, current_time);
+                    break;
                 default:
                     c4_era_reset(path_x, c4_state);
                     break;
@@ -758,13 +2470,51 @@ void c4_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_a
     }
 }
 
+/* Handle data ack event.
+ */
+void c4_handle_ack(picoquic_path_t* path_x, c4_state_t* c4_state, picoquic_per_ack_state_t* ack_state, uint64_t current_time)
+{
+    c4_handle_rate_sample(path_x, c4_state, ack_state, current_time);
+    c4_handle_ack_transitions(path_x, c4_state, 1, current_time);
+}
+
+/* Backoff on delay, sized from the bytes in flight.
+* The bytes in flight above the product of the delivery rate and the
+* running min RTT are a standing queue. The new nominal rate is the
+* delivery rate minus the rate that drains that queue in one era,
+* which lasts about one RTT.
+ */
+static uint64_t c4_flight_backoff_beta(picoquic_path_t* path_x, c4_state_t* c4_state, uint64_t rtt_latest)
+{
+    uint64_t delivery_rate = (path_x->bandwidth_estimate > 0 && path_x->bandwidth_estimate < c4_state->nominal_rate) ?
+        path_x->bandwidth_estimate : c4_state->nominal_rate;
+    uint64_t queue_free_bytes = (delivery_rate * c4_state->running_min_rtt) / 1000000;
+    uint64_t era_duration = (rtt_latest > 0) ? rtt_latest : path_x->smoothed_rtt;
+    uint64_t beta = 0;
+
+    if (c4_state->nominal_rate > 0 && era_duration > 0) {
+        uint64_t queue_bytes = (path_x->bytes_in_transit > queue_free_bytes) ?
+            path_x->bytes_in_transit - queue_free_bytes : 0;
+        uint64_t drain_rate = (queue_bytes * 1000000) / era_duration;
+        uint64_t target_rate = (delivery_rate > drain_rate) ? delivery_rate - drain_rate : 0;
+
+        if (target_rate < c4_state->nominal_rate) {
+            beta = ((c4_state->nominal_rate - target_rate) * 1024) / c4_state->nominal_rate;
+        }
+    }
+    return beta;
+}
+
 /* Reaction to ECN/CE or sustained losses.
  * This is more or less the same code as added to bbr.
  * This code is called if an ECN/EC event is received, 
  * or a lost event indicating a high loss rate,
  * or a delay event.
  * 
- * TODO: proper treatment of ECN per L4S
+ * The response to ECN is proportional, as in L4S: the rate is reduced
+ * by half the fraction of CE marks, using the larger of the smoothed
+ * fraction and the fraction observed in the current era. If the peer
+ * does not report ECN counts, the response is the same as for losses.
  */
 static void c4_notify_congestion(
     picoquic_path_t* path_x,
@@ -774,6 +2524,10 @@ static void c4_notify_congestion(
     uint64_t current_time)
 {
     uint64_t beta = C4_BETA_LOSS_1024;
+
+    if (c4_state->alg_state >= c4_cr_reconnaissance && c4_cr_handle_congestion(path_x, c4_state, c_mode, current_time)) {
+        return;
+    }
     c4_state->congestion_notified = 1;
 
     if (c4_state->alg_state == c4_recovery &&
@@ -782,6 +2536,12 @@ static void c4_notify_congestion(
         return;
     }
 
+    if (c4_state->do_coupled) {
+        /* Refresh the aggregate rate used for the sensitivity */
+        uint64_t aggregate_rate;
+        (void)c4_coupled_rates(path_x, c4_state, &aggregate_rate);
+    }
+
     if (c_mode == c4_congestion_loss) {
         /* Make amount of slow down function of sensitivity,
         * for better fairness between C4 connections.
@@ -789,9 +2549,28 @@ static void c4_notify_congestion(
         beta = (C4_BETA_LOSS_1024 + MULT1024(c4_sensitivity_1024(c4_state), C4_BETA_LOSS_1024))/2;
     }
     
+    if (c_mode == c4_congestion_ecn && c4_state->do_ecn_proportional) {
+        uint64_t fraction = c4_ecn_era_fraction_1024(path_x, c4_state);
+
+        if (fraction < c4_state->ce_fraction_1024) {
+            fraction = c4_state->ce_fraction_1024;
+        }
+        if (fraction > 0) {
+            beta = fraction / 2;
+            if (beta > C4_BETA_LOSS_1024) {
+                beta = C4_BETA_LOSS_1024;
+            }
+        }
+    }
+
     if (c_mode == c4_congestion_delay) {
-        /* TODO: we should really use bytes in flight! */
-        beta = c4_state->recent_delay_excess*1024/c4_state->delay_threshold;
+        if (c4_state->do_flight_backoff && path_x->bytes_in_transit > 0 &&
+            c4_state->running_min_rtt < C4_RTT_MAX) {
+            beta = c4_flight_backoff_beta(path_x, c4_state, rtt_latest);
+        }
+        else {
+            beta = ((uint64_t)c4_state->recent_delay_excess) * 1024 / c4_state->delay_threshold;
+        }
 
         if (beta > C4_BETA_LOSS_1024) {
             /* capping beta to the standard 1/4th. */
@@ -807,10 +2586,14 @@ static void c4_notify_congestion(
         c4_state->nb_push_no_congestion = 0;
     }
     else {
-        c4_state->nominal_rate -= MULT1024(beta, c4_state->nominal_rate);
+        c4_set_nominal_rate(c4_state, c4_state->nominal_rate - MULT1024(beta, c4_state->nominal_rate));
         if (c_mode == c4_congestion_loss) {
-            c4_state->nominal_max_rtt -= MULT1024(beta, c4_state->nominal_max_rtt);
-            c4_state->delay_threshold = c4_delay_threshold(c4_state);
+            c4_state->nominal_max_rtt -= (uint32_t)MULT1024(beta, (uint64_t)c4_state->nominal_max_rtt);
+            c4_minmax_reduce(&c4_state->max_rtt_filter, beta);
+            c4_state->delay_threshold = (uint16_t)c4_delay_threshold(c4_state);
+        }
+        if (c4_state->do_rate_filter) {
+            c4_rate_filter_reduce(c4_state, beta);
         }
     }
 
@@ -833,22 +2616,30 @@ static void c4_update_rtt(
     uint64_t current_time)
 {
     if (rtt_measurement > c4_state->era_max_rtt) {
-        c4_state->era_max_rtt = rtt_measurement;
+        c4_state->era_max_rtt = C4_RTT_CAP(rtt_measurement);
     }
     if (rtt_measurement < c4_state->era_min_rtt) {
-        c4_state->era_min_rtt = rtt_measurement;
+        c4_state->era_min_rtt = (uint32_t)rtt_measurement;
+    }
+    if (c4_max_rtt_per_mille < 1000 && c4_state->alpha_1024_previous <= 1024) {
+        /* Same samples as used for the max RTT at the end of the era */
+        c4_rtt_histogram_add(&c4_state->rtt_histogram, C4_RTT_CAP(rtt_measurement));
     }
-    if (rtt_measurement < c4_state->running_min_rtt) {
-        c4_state->running_min_rtt = rtt_measurement;
+    if (c4_min_rtt_horizon > 0) {
+        c4_state->running_min_rtt = c4_minmax_running_min(&c4_state->min_rtt_filter, c4_min_rtt_horizon,
+            current_time, C4_RTT_CAP(rtt_measurement));
+    }
+    else if (rtt_measurement < c4_state->running_min_rtt) {
+        c4_state->running_min_rtt = (uint32_t)rtt_measurement;
     }
     if (c4_state->nominal_max_rtt == 0) {
-        c4_state->nominal_max_rtt = rtt_measurement;
+        c4_state->nominal_max_rtt = C4_RTT_CAP(rtt_measurement);
         c4_state->recent_delay_excess = 0;
     }
     else {
-        uint64_t target_rtt = c4_state->nominal_max_rtt + c4_state->delay_threshold;
+        uint64_t target_rtt = (uint64_t)c4_state->nominal_max_rtt + c4_state->delay_threshold;
         if (rtt_measurement > target_rtt) {
-            c4_state->recent_delay_excess = rtt_measurement - target_rtt;
+            c4_state->recent_delay_excess = C4_RTT_CAP(rtt_measurement - target_rtt);
         }
         else {
             c4_state->recent_delay_excess = 0;
@@ -864,8 +2655,9 @@ static void c4_handle_rtt(
     uint64_t current_time)
 {
     if (c4_state->recent_delay_excess > 0 &&
-        c4_state->alpha_1024_previous > 1024) {
-        /* May well be congested */
+        (c4_state->alpha_1024_previous > 1024 ||
+            c4_state->alg_state == c4_cr_unvalidated || c4_state->alg_state == c4_cr_validating)) {
+        /* May well be congested. The careful resume jump is tested like a push. */
         c4_notify_congestion(path_x, c4_state, rtt_measurement, c4_congestion_delay, current_time);
     }
 }
@@ -876,76 +2668,232 @@ static void c4_handle_rtt(
  * to condensate all that in a single API, which could be shared
  * by many different congestion control algorithms.
  */
-void c4_notify(
-    picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+static void c4_notify_event(
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x, c4_state_t* c4_state,
     picoquic_congestion_notification_t notification,
     picoquic_per_ack_state_t * ack_state,
     uint64_t current_time)
 {
-    c4_state_t* c4_state = (c4_state_t*)path_x->congestion_alg_state;
-    path_x->is_cc_data_updated = 1;
+    switch (notification) {
+    case picoquic_congestion_notification_acknowledgement:
+        c4_handle_ack(path_x, c4_state, ack_state, current_time);
+        c4_apply_rate_and_cwin(path_x, c4_state);
+        break;
+    case picoquic_congestion_notification_ecn_ec:
+        if (c4_state->alg_state >= c4_cr_reconnaissance && c4_cr_handle_congestion(path_x, c4_state, c4_congestion_ecn, current_time)) {
+            break;
+        }
+        if (c4_state->alg_state == c4_initial) {
+            c4_initial_handle_loss(path_x, c4_state, notification, current_time);
+        }
+        else {
+            c4_notify_congestion(path_x, c4_state, 0, c4_congestion_ecn, current_time);
+        }
+        break;
+    case picoquic_congestion_notification_repeat:
+        if (c4_state->alg_state == c4_recovery && ack_state->lost_packet_number < c4_state->era_sequence) {
+            /* Do not worry about loss of packets sent before entering recovery */
+            break;
+        }
+        c4_update_loss_rate(c4_state, ack_state->lost_packet_number);
 
-    if (c4_state != NULL) {
-        switch (notification) {
-        case picoquic_congestion_notification_acknowledgement:
-            c4_handle_ack(path_x, c4_state, ack_state, current_time);
-            c4_apply_rate_and_cwin(path_x, c4_state);
+        if (c4_state->alg_state >= c4_cr_reconnaissance && c4_cr_handle_congestion(path_x, c4_state, c4_congestion_loss, current_time)) {
+            /* Any loss after the careful resume jump triggers the safe retreat */
             break;
-        case picoquic_congestion_notification_ecn_ec:
-            /* TODO: ECN is special? Implement the prague logic */
+        }
+        if (c4_state->smoothed_drop_rate > c4_loss_threshold(c4_state)) {
             if (c4_state->alg_state == c4_initial) {
                 c4_initial_handle_loss(path_x, c4_state, notification, current_time);
             }
             else {
-                c4_notify_congestion(path_x, c4_state, 0, c4_congestion_ecn, current_time);
-            }
-            break;
-        case picoquic_congestion_notification_repeat:
-            if (c4_state->alg_state == c4_recovery && ack_state->lost_packet_number < c4_state->era_sequence) {
-                /* Do not worry about loss of packets sent before entering recovery */
-                break;
+                c4_notify_congestion(path_x, c4_state, 0, c4_congestion_loss, current_time);
             }
-            c4_update_loss_rate(c4_state, ack_state->lost_packet_number);
+        }
+        break;
+    case picoquic_congestion_notification_timeout:
+        /* Treat timeout as PTO: no impact on congestion control */
+        break;
+    case picoquic_congestion_notification_spurious_repeat:
+        /* Remove handling of spurious repeat, as it was tied to timeout */
+        break;
+    case picoquic_congestion_notification_rtt_measurement:
+        c4_update_rtt(c4_state, ack_state->rtt_measurement, current_time);
+        if (c4_state->alg_state == c4_initial || c4_state->alg_state == c4_cr_reconnaissance) {
+            c4_initial_handle_rtt(path_x, c4_state, notification, ack_state->rtt_measurement, current_time);
+            c4_apply_rate_and_cwin(path_x, c4_state);
+        }
+        else {
+            c4_handle_rtt(cnx, path_x, c4_state, ack_state->rtt_measurement, current_time);
+        }
+        break;
+    case picoquic_congestion_notification_lost_feedback:
+        break;
+    case picoquic_congestion_notification_cwin_blocked:
+        break;
+    case picoquic_congestion_notification_reset:
+        c4_reset(c4_state, path_x, c4_state->option_string, current_time);
+        break;
+    case picoquic_congestion_notification_seed_cwin:
+        c4_seed_cwin(c4_state, path_x, ack_state->nb_bytes_acknowledged, ack_state->rtt_measurement, current_time);
+        break;
+    default:
+        /* ignore */
+        break;
+    }
+}
 
-            if (c4_state->smoothed_drop_rate > c4_loss_threshold(c4_state)) {
-                if (c4_state->alg_state == c4_initial) {
-                    c4_initial_handle_loss(path_x, c4_state, notification, current_time);
-                }
-                else {
-                    c4_notify_congestion(path_x, c4_state, 0, c4_congestion_loss, current_time);
-                }
-            }
-            break;
-        case picoquic_congestion_notification_timeout:
-            /* Treat timeout as PTO: no impact on congestion control */
-            break;
-        case picoquic_congestion_notification_spurious_repeat:
-            /* Remove handling of spurious repeat, as it was tied to timeout */
-            break;
-        case picoquic_congestion_notification_rtt_measurement:
-            c4_update_rtt(c4_state, ack_state->rtt_measurement, current_time);
-            if (c4_state->alg_state == c4_initial) {
-                c4_initial_handle_rtt(path_x, c4_state, notification, ack_state->rtt_measurement, current_time);
-                c4_apply_rate_and_cwin(path_x, c4_state);
+void c4_notify(
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    picoquic_per_ack_state_t * ack_state,
+    uint64_t current_time)
+{
+    c4_state_t* c4_state = (c4_state_t*)path_x->congestion_alg_state;
+    picoquic_per_ack_state_t seed_state;
+    path_x->is_cc_data_updated = 1;
+
+    if (notification == picoquic_congestion_notification_seed_cwin && ack_state != NULL &&
+        ack_state->rtt_measurement == 0 && cnx != NULL && cnx->seed_rtt_min > 0) {
+        /* The stack keeps the RTT of the seed in the connection context.
+        * Copy it in the notification, so it is also recorded. */
+        seed_state = *ack_state;
+        seed_state.rtt_measurement = cnx->seed_rtt_min;
+        ack_state = &seed_state;
+    }
+
+    if (c4_state != NULL) {
+        if (c4_state->recorder == NULL) {
+            c4_notify_event(cnx, path_x, c4_state, notification, ack_state, current_time);
+        }
+        else {
+            c4_record_event_t ev;
+            c4_record_prepare(&ev, cnx, path_x, c4_record_notify, ack_state, 1, current_time);
+            ev.notification = notification;
+            c4_notify_event(cnx, path_x, c4_state, notification, ack_state, current_time);
+            c4_record_finish(c4_state, &ev, path_x);
+        }
+    }
+}
+
+/* Drain the trace ring. This must be called from the thread
+* running the connection, e.g., from the packet loop callback.
+ */
+size_t c4_trace_drain(picoquic_path_t* path_x, c4_trace_sample_t* samples, size_t nb_max, uint64_t* nb_overwritten)
+{
+    size_t nb_copied = 0;
+    c4_state_t* c4_state = c4_get_state(path_x);
+
+    if (c4_state != NULL && c4_state->trace_ring != NULL) {
+        c4_trace_ring_t* ring = c4_state->trace_ring;
+
+        while (nb_copied < nb_max && ring->nb_read < ring->nb_written) {
+            samples[nb_copied] = ring->samples[ring->nb_read & (C4_TRACE_RING_SIZE - 1)];
+            ring->nb_read++;
+            nb_copied++;
+        }
+        if (nb_overwritten != NULL) {
+            *nb_overwritten = ring->nb_overwritten;
+        }
+        ring->nb_overwritten = 0;
+    }
+    else if (nb_overwritten != NULL) {
+        *nb_overwritten = 0;
+    }
+    return nb_copied;
+}
+
+/* Set the rate hint of the application. If the hint exceeds the nominal
+* rate, probe at the end of the current cruising era instead of waiting
+* for the next scheduled push.
+ */
+void c4_set_rate_hint(picoquic_path_t* path_x, uint64_t expected_rate, uint64_t burst_size)
+{
+    c4_state_t* c4_state = c4_get_state(path_x);
+
+    if (c4_state != NULL) {
+        c4_state->hint_rate = expected_rate;
+        c4_state->hint_burst = (expected_rate > 0) ? burst_size : 0;
+        if (c4_state->alg_state == c4_cruising && c4_state->hint_rate > c4_state->nominal_rate) {
+            c4_state->nb_cruise_left_before_push = 0;
+        }
+        if (c4_state->recorder != NULL) {
+            c4_record_event_t ev;
+            c4_record_prepare(&ev, path_x->cnx, path_x, c4_record_hint, NULL, 0,
+                picoquic_get_quic_time(path_x->cnx->quic));
+            ev.hint_rate = c4_state->hint_rate;
+            ev.hint_burst = c4_state->hint_burst;
+            c4_record_finish(c4_state, &ev, path_x);
+        }
+    }
+}
+
+void c4_clear_rate_hint(picoquic_path_t* path_x)
+{
+    c4_set_rate_hint(path_x, 0, 0);
+}
+
+int c4_set_transition_hook(picoquic_path_t* path_x, c4_transition_hook_fn hook, void* hook_ctx)
+{
+    int ret = -1;
+    c4_state_t* c4_state = c4_get_state(path_x);
+
+    if (c4_state != NULL) {
+        c4_state->transition_hook = hook;
+        c4_state->transition_hook_ctx = hook_ctx;
+        ret = 0;
+    }
+    return ret;
+}
+
+/* Batched notification of acknowledgements.
+* The samples acknowledged by one ACK frame are processed in order, as
+* they would be by the per acknowledgement notifications: each RTT sample
+* is checked for delay congestion, then each rate sample may trigger a
+* state transition. Only the CWIN and pacing rate are applied once for
+* the whole batch, so the result matches the per acknowledgement path.
+ */
+static void c4_notify_ack_batch_event(
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x, c4_state_t* c4_state,
+    picoquic_per_ack_state_t* ack_states, size_t nb_ack_states,
+    uint64_t current_time)
+{
+    for (size_t i = 0; i < nb_ack_states; i++) {
+        uint64_t rtt_measurement = ack_states[i].rtt_measurement;
+
+        if (rtt_measurement > 0) {
+            c4_update_rtt(c4_state, rtt_measurement, current_time);
+            if (c4_state->alg_state == c4_initial || c4_state->alg_state == c4_cr_reconnaissance) {
+                c4_initial_handle_rtt(path_x, c4_state, picoquic_congestion_notification_rtt_measurement, rtt_measurement, current_time);
             }
             else {
-                c4_handle_rtt(cnx, path_x, c4_state, ack_state->rtt_measurement, current_time);
+                c4_handle_rtt(cnx, path_x, c4_state, rtt_measurement, current_time);
             }
-            break;
-        case picoquic_congestion_notification_lost_feedback:
-            break;
-        case picoquic_congestion_notification_cwin_blocked:
-            break;
-        case picoquic_congestion_notification_reset:
-            c4_reset(c4_state, path_x, c4_state->option_string, current_time);
-            break;
-        case picoquic_congestion_notification_seed_cwin:
-            c4_seed_cwin(c4_state, path_x, ack_state->nb_bytes_acknowledged);
-            break;
-        default:
-            /* ignore */
-            break;
         }
+        c4_handle_ack(path_x, c4_state, &ack_states[i], current_time);
+    }
+    c4_apply_rate_and_cwin(path_x, c4_state);
+}
+
+void c4_notify_ack_batch(
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_per_ack_state_t* ack_states, size_t nb_ack_states,
+    uint64_t current_time)
+{
+    c4_state_t* c4_state = c4_get_state(path_x);
+
+    if (c4_state == NULL || nb_ack_states == 0) {
+        return;
+    }
+    path_x->is_cc_data_updated = 1;
+
+    if (c4_state->recorder == NULL) {
+        c4_notify_ack_batch_event(cnx, path_x, c4_state, ack_states, nb_ack_states, current_time);
+    }
+    else {
+        c4_record_event_t ev;
+        c4_record_prepare(&ev, cnx, path_x, c4_record_batch, ack_states, nb_ack_states, current_time);
+        c4_notify_ack_batch_event(cnx, path_x, c4_state, ack_states, nb_ack_states, current_time);
+        c4_record_finish(c4_state, &ev, path_x);
     }
 }
 
@@ -953,11 +2901,86 @@ void c4_notify(
 void c4_delete(picoquic_path_t* path_x)
 {
     if (path_x->congestion_alg_state != NULL) {
-        free(path_x->congestion_alg_state);
+        c4_state_t* c4_state = (c4_state_t*)path_x->congestion_alg_state;
+
+        if (path_x->cnx != NULL) {
+            c4_path_stats_t path_stats;
+
+#ifdef C4_WITH_LOGGING
+            picoquic_log_app_message(path_x->cnx, "C4 pacing updates: %" PRIu64 ", skipped: %" PRIu64,
+                c4_state->nb_pacing_updates, c4_state->nb_pacing_updates_skipped + c4_state->nb_skipped_since_update);
+#endif
+            if (c4_stats_is_closed_enabled() &&
+                c4_get_path_stats(path_x, &path_stats, sizeof(c4_path_stats_t)) == 0) {
+                c4_stats_add_closed_path(&path_stats, picoquic_get_quic_time(path_x->cnx->quic));
+            }
+        }
+        if (c4_state->trace_ring != NULL) {
+            if (path_x->cnx != NULL) {
+                c4_trace_dump(path_x, c4_state->trace_ring);
+            }
+            free(c4_state->trace_ring);
+            c4_state->trace_ring = NULL;
+        }
+        if (c4_estimate_cache != NULL || c4_estimate_store != NULL) {
+            c4_estimate_save(path_x, c4_state);
+        }
+        if (c4_state->recorder != NULL) {
+            c4_record_event_t ev;
+            ev.record_type = c4_record_delete;
+            (void)c4_record_write(c4_state->recorder, &ev);
+            c4_record_close(c4_state->recorder);
+            c4_state->recorder = NULL;
+        }
+        if (c4_state->columns != NULL) {
+            (void)c4_column_close(c4_state->columns);
+            c4_state->columns = NULL;
+        }
+        c4_state_free(c4_state);
         path_x->congestion_alg_state = NULL;
     }
 }
 
+int c4_get_path_stats(picoquic_path_t* path_x, c4_path_stats_t* stats, size_t stats_size)
+{
+    int ret = -1;
+    c4_state_t* c4_state = c4_get_state(path_x);
+
+    if (c4_state != NULL && stats != NULL && stats_size >= sizeof(uint32_t)) {
+        c4_path_stats_t current;
+        c4_counters_t* counters = &c4_state->counters;
+        uint64_t current_time = picoquic_get_quic_time(path_x->cnx->quic);
+
+        memset(&current, 0, sizeof(c4_path_stats_t));
+        current.version = C4_PATH_STATS_VERSION;
+        current.alg_state = c4_state->alg_state;
+        current.nominal_rate = c4_state->nominal_rate;
+        current.nominal_max_rtt = c4_state->nominal_max_rtt;
+        current.running_min_rtt = c4_state->running_min_rtt;
+        for (int i = 0; i < C4_NB_STATES; i++) {
+            current.nb_state_entries[i] = counters->nb_state_entries[i];
+            current.time_in_state[i] = counters->time_in_state[i];
+        }
+        if (current_time > counters->state_start_time) {
+            /* Include the time spent so far in the current state */
+            current.time_in_state[c4_state->alg_state] += current_time - counters->state_start_time;
+        }
+        for (int i = 0; i < C4_NB_CONGESTION_TYPES; i++) {
+            current.nb_recoveries[i] = counters->nb_recoveries[i];
+        }
+        current.nb_push_succeeded = counters->nb_push_succeeded;
+        current.nb_push_failed = counters->nb_push_failed;
+        current.nb_cascades = counters->nb_cascades;
+        current.nb_jitter_restarts = counters->nb_jitter_restarts;
+        current.nb_pacing_updates = c4_state->nb_pacing_updates;
+        current.nb_pacing_updates_skipped = c4_state->nb_pacing_updates_skipped + c4_state->nb_skipped_since_update;
+        /* Callers built with an older version of the structure get its prefix */
+        memcpy(stats, &current, (stats_size < sizeof(c4_path_stats_t)) ? stats_size : sizeof(c4_path_stats_t));
+        ret = 0;
+    }
+    return ret;
+}
+
 /* Observe the state of congestion control */
 void c4_observe(picoquic_path_t* path_x, uint64_t* cc_state, uint64_t* cc_param)
 {
@@ -6,6 +6,8 @@ Declaration of the C4 algorithm
 #define C4_H
 
 #include "picoquic.h"
+#include "c4_pool.h"
+#include "c4_cache.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,6 +15,250 @@ extern "C" {
 
     extern picoquic_congestion_algorithm_t* c4_algorithm;
 
+    /* Binary trace of per-ACK rate samples.
+    * Tracing is enabled at run time, per connection, by adding the letter 'T'
+    * to the C4 option string. Samples are written to a fixed size ring
+    * buffer attached to the path. The application can drain the ring
+    * at any time; samples still in the ring when the path is deleted
+    * are dumped to the connection log as "C4_trace" messages.
+    * If the ring is not drained, the oldest samples are overwritten.
+    */
+    typedef struct st_c4_trace_sample_t {
+        uint64_t current_time;
+        uint64_t rate_measurement;
+        uint64_t nominal_rate;
+        uint64_t bytes_delivered;
+        uint64_t rtt;
+        uint64_t send_delay;
+        uint64_t nominal_max_rtt;
+        uint8_t alg_state;
+        uint8_t congestion_notified;
+    } c4_trace_sample_t;
+
+    /* Copy up to nb_max samples from the trace ring of the path, oldest first.
+    * Returns the number of samples copied. If nb_overwritten is not NULL, it
+    * receives the number of samples lost to overwrites since the last call.
+     */
+    size_t c4_trace_drain(picoquic_path_t* path_x, c4_trace_sample_t* samples, size_t nb_max, uint64_t* nb_overwritten);
+
+    /* Batched notification of the acknowledgements carried in a single ACK frame.
+    * This is equivalent to one RTT measurement notification followed by one
+    * acknowledgement notification per sample, except that the CWIN and pacing
+    * rate are updated once per batch instead of once per sample.
+    * Applications that process ACK frames themselves can call this instead
+    * of the per acknowledgement calls to alg_notify.
+    */
+    void c4_notify_ack_batch(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+        picoquic_per_ack_state_t* ack_states, size_t nb_ack_states, uint64_t current_time);
+
+    /* Counters of the events of a C4 path, read with c4_get_path_stats.
+    * The counters are maintained on state transitions and congestion
+    * events only, so they are always on. The states are numbered as in
+    * the value returned by alg_observe: 0 initial, 1 recovery, 2 cruising,
+    * 3 pushing, then the careful resume phases, 4 reconnaissance,
+    * 5 unvalidated, 6 validating and 7 safe retreat. Recoveries are counted
+    * by cause: 0 end of a push without congestion, 1 delay, 2 ECN, 3 loss.
+    * Times are in microseconds. New fields will only be added at the end
+    * of the structure, with a new version number.
+    */
+#define C4_PATH_STATS_VERSION 1
+#define C4_NB_STATES 8
+#define C4_NB_CONGESTION_TYPES 4
+
+    typedef struct st_c4_path_stats_t {
+        uint32_t version;
+        uint32_t alg_state;
+        uint64_t nominal_rate;
+        uint64_t nominal_max_rtt;
+        uint64_t running_min_rtt;
+        uint64_t nb_state_entries[C4_NB_STATES];
+        uint64_t time_in_state[C4_NB_STATES];
+        uint64_t nb_recoveries[C4_NB_CONGESTION_TYPES];
+        uint64_t nb_push_succeeded;
+        uint64_t nb_push_failed;
+        uint64_t nb_cascades; /* Returns to the initial state after successful pushes */
+        uint64_t nb_jitter_restarts; /* Returns to the initial state after a jitter increase */
+        uint64_t nb_pacing_updates;
+        uint64_t nb_pacing_updates_skipped;
+    } c4_path_stats_t;
+
+    /* Copy the counters of the path in stats, which the caller allocated
+    * with stats_size bytes, normally sizeof(c4_path_stats_t). If the size
+    * is smaller, only the fields that fit are copied; the version field
+    * tells which ones are present. Returns -1 if the path does not use C4.
+    */
+    int c4_get_path_stats(picoquic_path_t* path_x, c4_path_stats_t* stats, size_t stats_size);
+
+    /* Rate hint of the application, per path.
+    * Applications that know their sending rate, such as media encoders,
+    * can set the expected rate in bytes per second and the size of the
+    * largest burst sent on top of that rate, e.g., a key frame. While the
+    * nominal rate and the cruising CWIN cover the hint, C4 does not push,
+    * and pushes are limited to what is needed to reach the expected rate.
+    * Setting a rate above the nominal rate, e.g., just before switching
+    * to a higher quality, starts a push at the end of the current cruising
+    * era. The hint is kept until cleared, or set again with a rate of 0.
+    * Hints are recorded, and replayed by c4_replay.
+    */
+    void c4_set_rate_hint(picoquic_path_t* path_x, uint64_t expected_rate, uint64_t burst_size);
+    void c4_clear_rate_hint(picoquic_path_t* path_x);
+
+    /* Hooks called on the transitions of the C4 state machine, e.g., to
+    * adapt the bitrate of a media encoder, or for telemetry. The states
+    * and congestion types are numbered as in c4_path_stats_t. The old
+    * rate is the pacing rate in use before the transition, and the new
+    * rate is the nominal rate times the gain of the new state; the pacing
+    * rate is updated from it after the notification is processed. The
+    * congestion type is the signal that caused the transition, 0 if none.
+    * Hooks are called from the packet loop thread, while C4 processes a
+    * notification. They shall not delete the path or the connection, and
+    * should defer calls to c4_set_rate_hint until the notification is
+    * processed, so that recordings replay in the same order.
+    * The default hook applies to the paths created after it is set, and
+    * should be set before the network threads start. The hook of a path
+    * can be changed at any time; setting it to NULL removes it. When no
+    * hook is set, the cost is one test per state transition.
+    */
+    typedef struct st_c4_transition_t {
+        uint64_t current_time;
+        uint32_t old_state;
+        uint32_t new_state;
+        uint64_t old_rate;
+        uint64_t new_rate;
+        uint64_t nominal_rate;
+        uint64_t nominal_max_rtt;
+        uint32_t congestion_type;
+    } c4_transition_t;
+
+    typedef void (*c4_transition_hook_fn)(picoquic_path_t* path_x, c4_transition_t const* transition, void* hook_ctx);
+
+    void c4_set_default_transition_hook(c4_transition_hook_fn hook, void* hook_ctx);
+    /* Returns -1 if the path does not use C4 */
+    int c4_set_transition_hook(picoquic_path_t* path_x, c4_transition_hook_fn hook, void* hook_ctx);
+
+    /* Pooled allocation of the C4 path states of a QUIC context.
+    * Servers with many short lived connections can set a pool per QUIC
+    * context, so that path states are allocated from cache aligned
+    * slabs instead of calling malloc and free for each path. The pool
+    * should be set before the first connection is created, and must be
+    * released before the QUIC context is freed. Paths that still use the
+    * pool keep it alive until they are deleted, including when freeing
+    * the QUIC context deletes them. The first pool must be set before
+    * the network threads start.
+    */
+    int c4_set_state_pool(picoquic_quic_t* quic, size_t nb_slots_per_chunk);
+    void c4_release_state_pool(picoquic_quic_t* quic);
+    int c4_get_state_pool_stats(picoquic_quic_t* quic, c4_pool_stats_t* stats);
+
+    /* Bulk evaluation of many C4 paths, in structure of arrays form.
+    * The bulk table holds one entry per path in arrays aligned on a cache
+    * line. c4_bulk_load fills the inputs from the paths. c4_bulk_evaluate
+    * then computes the sensitivity, delay threshold, target CWIN and pacing
+    * rate of all the paths in loops without branches or pointer chasing,
+    * which compilers can vectorize. c4_bulk_apply sets the results on the
+    * paths, as the per path code would.
+    */
+    typedef struct st_c4_bulk_t c4_bulk_t;
+
+    c4_bulk_t* c4_bulk_create(size_t nb_paths_max);
+    void c4_bulk_delete(c4_bulk_t* bulk);
+    /* Load the state of up to nb_paths_max paths. Paths that do not use C4
+    * are loaded with zero values. Returns the number of paths loaded.
+     */
+    size_t c4_bulk_load(c4_bulk_t* bulk, picoquic_path_t** paths, size_t nb_paths);
+    void c4_bulk_evaluate(c4_bulk_t* bulk);
+    /* Apply the results to the same paths as the last load. A path is
+    * skipped if it does not use C4, if its inputs changed since the load,
+    * or if it is in the initial state or in the first phases of careful
+    * resume, because the CWIN then also depends on the path estimates.
+    * Returns the number of paths updated.
+     */
+    size_t c4_bulk_apply(c4_bulk_t* bulk, picoquic_path_t** paths, size_t nb_paths);
+
+    /* Record the notifications of all the C4 paths in the specified
+    * directory, one file per path, for offline replay with c4_replay.
+    * Recording can also be enabled per connection with the option 'R',
+    * in which case the files are written in the current directory.
+    * Setting the directory to NULL stops recording of new paths.
+    * Returns -1 if the directory name is too long.
+    */
+    int c4_set_record_directory(char const* directory);
+
+    /* Write the rate samples and state transitions of all the C4 paths to
+    * columnar trace files in the specified directory, one file per path,
+    * for offline analysis with c4_columns. The trace can also be enabled
+    * per connection with the option 'B', in which case the files are
+    * written in the current directory. Setting the directory to NULL stops
+    * tracing of new paths. Returns -1 if the directory name is too long.
+    */
+    int c4_set_column_directory(char const* directory);
+
+    /* Horizons of the windowed min and max RTT filters, in microseconds,
+    * shared by all the paths. They can only be set at startup: the call
+    * returns -1 and changes nothing once a C4 path has been initialized.
+    * Both filters are off by default. If the max RTT horizon is set, e.g.
+    * to 5 seconds, the nominal max RTT is the max of the per era max RTT,
+    * capped by the jitter limit, during that horizon; a single late sample
+    * then holds the max RTT, and the CWIN, for the whole horizon. If the
+    * min RTT horizon is set, the min RTT is the min of the samples
+    * received during that horizon. C4 never drains the queue to probe
+    * the min RTT, so a queue that stands for longer than the horizon
+    * becomes the new min; only set it for paths whose queue is regularly
+    * drained. With a horizon of 0, the estimate only decays in the eras
+    * that follow a congestion recovery.
+    */
+    int c4_set_rtt_horizons(uint64_t min_rtt_horizon, uint64_t max_rtt_horizon);
+
+    /* Percentile of the RTT samples used to set the nominal max RTT, in
+    * per mille, shared by all the paths. The default is 1000, which uses
+    * the max RTT of each era. A lower value, e.g. 980 for p98, prevents
+    * rare outliers from inflating the CWIN. The percentile is estimated
+    * with a log scale histogram of the recent samples per path.
+    */
+    void c4_set_max_rtt_percentile(uint32_t per_mille);
+
+    /* Cache of path estimates, shared by all the connections of the process.
+    * When set, the estimates of the paths that are deleted are stored per
+    * prefix of the peer address, and new paths to the same prefix start
+    * with a seed CWIN derived from them. Since the prefix may be shared by
+    * other hosts, the seed is only used if careful resume is enabled with
+    * option 'U', and is validated before the jump. Entries older than ttl
+    * microseconds are ignored. The cache should be set before the network
+    * threads start, and released after they stop. Returns -1 if a cache is
+    * already set or cannot be allocated.
+    */
+    int c4_set_estimate_cache(size_t nb_entries_max, uint64_t ttl);
+    void c4_release_estimate_cache(void);
+    int c4_get_estimate_cache_stats(c4_cache_stats_t* stats);
+
+    /* Store of path estimates in a memory mapped file, which survives restarts
+    * and can be shared by the processes of a host. The file is created with
+    * room for nb_records_max records if it does not exist. Estimates are saved
+    * when paths are deleted, merged with the previous ones for the same peer
+    * prefix, and used to seed new paths if the estimate cache has none.
+    * The seed is scaled by the confidence of the record, the number of
+    * paths merged in it, from 9/16 of the BDP for a single path, like the
+    * entries of the cache, to the whole BDP for C4_STORE_CONFIDENCE_MAX.
+    * Records older than ttl microseconds are ignored. Returns -1 if a store
+    * is already set, or if the file cannot be opened as a store.
+    */
+    int c4_set_estimate_store(char const* file_name, size_t nb_records_max, uint64_t ttl);
+    void c4_release_estimate_store(void);
+
+    /* Smoothed loss rate after a loss that follows gap packets without
+    * loss, computed as in C4, including the integer arithmetic if
+    * C4_INTEGER_ONLY is defined. Exposed for the checks of c4_check.
+    */
+    double c4_loss_rate_check(double drop_rate, uint64_t gap);
+
+    /* Set the state, nominal rate, nominal max RTT and alpha of a C4 path,
+    * then set its CWIN and pacing rate with the per path code, as after a
+    * notification. Returns -1 if the path does not use C4. Exposed for the
+    * checks of c4_check, which compare the results with c4_bulk_evaluate.
+    */
+    int c4_apply_check(picoquic_path_t* path_x, int alg_state, uint64_t nominal_rate,
+        uint32_t nominal_max_rtt, uint32_t alpha_1024);
+
 #ifdef __cplusplus
 }
 #endif
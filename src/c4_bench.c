@@ -0,0 +1,548 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Micro benchmark of the cost of congestion control notifications.
+* Feeds synthetic streams of events directly to the alg_notify function
+* of C4 and of the picoquic algorithms, and reports the cost per event.
+* On Linux, the number of instructions and cache misses is measured
+* with perf_event_open, if the system allows it.
+* With the option -p, measures instead the cost of loading, evaluating
+* and applying the state of many C4 paths with the bulk evaluation functions.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+
+#include "picoquic_register_cc_algo.h"
+#include "c4.h"
+
+#ifdef _WINDOWS
+#include "../pico_sim_vs/pico_sim_vs/getopt.h"
+#else
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define C4_BENCH_WITH_PERF
+#endif
+
+#define C4_BENCH_BLOCK_SIZE 4096
+#define C4_BENCH_DEFAULT_EVENTS 1000000
+#define C4_BENCH_PACKET_SIZE 1440
+#define C4_BENCH_BATCH_SIZE 8
+#define C4_BENCH_BULK_ROUNDS 10
+
+typedef enum {
+    bench_stream_steady = 0,
+    bench_stream_loss_burst,
+    bench_stream_ecn,
+    bench_stream_jitter,
+    bench_stream_cycling,
+    bench_stream_max
+} bench_stream_enum;
+
+static char const* bench_stream_names[bench_stream_max] = {
+    "steady", "loss_burst", "ecn", "jitter", "cycling"
+};
+
+typedef struct st_bench_event_t {
+    picoquic_congestion_notification_t notification;
+    picoquic_per_ack_state_t ack_state;
+    uint64_t current_time;
+    uint64_t send_sequence;
+    uint64_t highest_acknowledged;
+} bench_event_t;
+
+typedef struct st_bench_stream_t {
+    bench_stream_enum stream;
+    uint64_t current_time;
+    uint64_t sequence;
+    uint64_t rate; /* bytes per second */
+    uint64_t base_rtt;
+    uint64_t random;
+    uint64_t nb_packets;
+} bench_stream_t;
+
+typedef struct st_bench_result_t {
+    uint64_t nb_events;
+    uint64_t duration_us;
+    uint64_t instructions;
+    uint64_t cache_misses;
+    int has_perf;
+} bench_result_t;
+
+void usage()
+{
+    fprintf(stderr, "C4_bench, cost of congestion control notifications\n\n");
+    fprintf(stderr, "Usage: c4_bench [options]\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -n number  Number of events per stream, default %d.\n", C4_BENCH_DEFAULT_EVENTS);
+    fprintf(stderr, "  -a algo    Only test the specified algorithm, e.g., c4, c4_batch,\n");
+    fprintf(stderr, "             cubic, bbr or newreno.\n");
+    fprintf(stderr, "  -s stream  Only test the specified stream: steady, loss_burst,\n");
+    fprintf(stderr, "             ecn, jitter or cycling.\n");
+    fprintf(stderr, "  -p number  Measure the bulk evaluation of 10k, 100k and 1M paths,\n");
+    fprintf(stderr, "             up to the specified number of paths.\n");
+    fprintf(stderr, "  -h         Print this message.\n");
+}
+
+/* Deterministic pseudo random numbers, so all algorithms see the same events */
+static uint64_t bench_random(bench_stream_t* s)
+{
+    s->random ^= s->random << 13;
+    s->random ^= s->random >> 7;
+    s->random ^= s->random << 17;
+    return s->random;
+}
+
+static void bench_stream_init(bench_stream_t* s, bench_stream_enum stream)
+{
+    memset(s, 0, sizeof(bench_stream_t));
+    s->stream = stream;
+    s->current_time = 1000000;
+    s->sequence = 1;
+    s->rate = 10000000;
+    s->base_rtt = 40000;
+    s->random = 0xdeadbeefcafe1234ull;
+}
+
+static void bench_add_event(bench_event_t* events, size_t* nb_events, bench_stream_t* s,
+    picoquic_congestion_notification_t notification, uint64_t rtt, uint64_t lost_packet_number)
+{
+    bench_event_t* ev = &events[*nb_events];
+    uint64_t nb_in_flight = (s->rate * rtt) / 1000000;
+    uint64_t nb_packets_in_flight = 1 + nb_in_flight / C4_BENCH_PACKET_SIZE;
+
+    memset(ev, 0, sizeof(bench_event_t));
+    ev->notification = notification;
+    ev->current_time = s->current_time;
+    ev->send_sequence = s->sequence;
+    ev->highest_acknowledged = (s->sequence > nb_packets_in_flight) ? s->sequence - nb_packets_in_flight : 0;
+    ev->ack_state.rtt_measurement = rtt;
+    ev->ack_state.send_delay = rtt / 2;
+    ev->ack_state.nb_bytes_acknowledged = C4_BENCH_PACKET_SIZE;
+    ev->ack_state.nb_bytes_delivered_since_packet_sent = nb_in_flight;
+    ev->ack_state.inflight_prior = nb_in_flight;
+    ev->ack_state.lost_packet_number = lost_packet_number;
+    *nb_events += 1;
+}
+
+/* Produce the events for the next packet: an RTT measurement and an
+* acknowledgement, plus the losses, ECN marks or rate changes of the
+* selected stream. Returns the number of events added.
+ */
+static size_t bench_next_packet(bench_stream_t* s, bench_event_t* events)
+{
+    size_t nb_events = 0;
+    uint64_t rtt = s->base_rtt;
+
+    s->nb_packets++;
+    s->sequence++;
+    s->current_time += (C4_BENCH_PACKET_SIZE * 1000000) / s->rate;
+
+    switch (s->stream) {
+    case bench_stream_jitter:
+        /* Wi-Fi like jitter, mostly small, sometimes up to 50 ms. */
+        rtt += (bench_random(s) % 16 == 0) ? bench_random(s) % 50000 : bench_random(s) % 2000;
+        break;
+    case bench_stream_cycling:
+        /* Alternate between high and low rate, to cycle through the states */
+        if (s->nb_packets % 5000 == 0) {
+            s->rate = (s->rate == 10000000) ? 2500000 : 10000000;
+        }
+        rtt += (s->rate == 10000000) ? 0 : 20000;
+        break;
+    default:
+        break;
+    }
+    bench_add_event(events, &nb_events, s, picoquic_congestion_notification_rtt_measurement, rtt, 0);
+    bench_add_event(events, &nb_events, s, picoquic_congestion_notification_acknowledgement, rtt, 0);
+
+    if (s->stream == bench_stream_loss_burst && s->nb_packets % 1000 == 0) {
+        for (uint64_t i = 0; i < 20; i++) {
+            bench_add_event(events, &nb_events, s, picoquic_congestion_notification_repeat, rtt, s->sequence - 40 + i);
+        }
+    }
+    else if (s->stream == bench_stream_ecn && s->nb_packets % 100 == 0) {
+        bench_add_event(events, &nb_events, s, picoquic_congestion_notification_ecn_ec, rtt, 0);
+    }
+    else if (s->stream == bench_stream_cycling && s->nb_packets % 2000 == 0) {
+        bench_add_event(events, &nb_events, s, picoquic_congestion_notification_repeat, rtt, s->sequence - 40);
+    }
+    return nb_events;
+}
+
+#ifdef C4_BENCH_WITH_PERF
+static int bench_perf_open(uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t bench_perf_read(int fd)
+{
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+        value = 0;
+    }
+    return value;
+}
+#endif
+
+/* Apply one block of events to the connection. */
+static void bench_apply_block(picoquic_congestion_algorithm_t const* alg, int is_batch,
+    picoquic_cnx_t* cnx, picoquic_path_t* path_x, bench_event_t* events, size_t nb_events)
+{
+    picoquic_per_ack_state_t batch[C4_BENCH_BATCH_SIZE];
+    size_t nb_batch = 0;
+
+    for (size_t i = 0; i < nb_events; i++) {
+        bench_event_t* ev = &events[i];
+
+        cnx->pkt_ctx[picoquic_packet_context_application].send_sequence = ev->send_sequence;
+        cnx->pkt_ctx[picoquic_packet_context_application].highest_acknowledged = ev->highest_acknowledged;
+        path_x->rtt_sample = ev->ack_state.rtt_measurement;
+
+        if (is_batch && ev->notification == picoquic_congestion_notification_acknowledgement) {
+            batch[nb_batch++] = ev->ack_state;
+            if (nb_batch >= C4_BENCH_BATCH_SIZE) {
+                c4_notify_ack_batch(cnx, path_x, batch, nb_batch, ev->current_time);
+                nb_batch = 0;
+            }
+        }
+        else if (!is_batch || ev->notification != picoquic_congestion_notification_rtt_measurement) {
+            alg->alg_notify(cnx, path_x, ev->notification, &ev->ack_state, ev->current_time);
+        }
+    }
+    if (nb_batch > 0) {
+        c4_notify_ack_batch(cnx, path_x, batch, nb_batch, events[nb_events - 1].current_time);
+    }
+}
+
+static int bench_run(picoquic_congestion_algorithm_t const* alg, int is_batch,
+    bench_stream_enum stream, uint64_t nb_events_target, bench_event_t* events, bench_result_t* result)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    struct sockaddr_in addr;
+    bench_stream_t s;
+    int fd_instructions = -1;
+    int fd_cache_misses = -1;
+
+    memset(result, 0, sizeof(bench_result_t));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4443);
+    bench_stream_init(&s, stream);
+
+    quic = picoquic_create(8, NULL, NULL, NULL, "hq-interop", NULL, NULL, NULL, NULL, NULL,
+        simulated_time, &simulated_time, NULL, NULL, 0);
+    if (quic == NULL ||
+        (cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, simulated_time, 0, "test.example.com", "hq-interop", 1)) == NULL) {
+        ret = -1;
+    }
+    else {
+        picoquic_path_t* path_x = cnx->path[0];
+
+        picoquic_set_congestion_algorithm(cnx, alg);
+        cnx->cnx_state = picoquic_state_ready;
+        path_x->send_mtu = C4_BENCH_PACKET_SIZE;
+        path_x->smoothed_rtt = s.base_rtt;
+        path_x->rtt_min = s.base_rtt;
+#ifdef C4_BENCH_WITH_PERF
+        fd_instructions = bench_perf_open(PERF_COUNT_HW_INSTRUCTIONS);
+        fd_cache_misses = bench_perf_open(PERF_COUNT_HW_CACHE_MISSES);
+        result->has_perf = (fd_instructions >= 0 && fd_cache_misses >= 0);
+#endif
+        while (result->nb_events < nb_events_target) {
+            size_t nb_events = 0;
+            uint64_t start_time;
+
+            /* Events are generated outside of the measured interval */
+            while (nb_events + 32 < C4_BENCH_BLOCK_SIZE &&
+                result->nb_events + nb_events < nb_events_target) {
+                nb_events += bench_next_packet(&s, events + nb_events);
+            }
+#ifdef C4_BENCH_WITH_PERF
+            if (result->has_perf) {
+                ioctl(fd_instructions, PERF_EVENT_IOC_ENABLE, 0);
+                ioctl(fd_cache_misses, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+            start_time = picoquic_current_time();
+            bench_apply_block(alg, is_batch, cnx, path_x, events, nb_events);
+            result->duration_us += picoquic_current_time() - start_time;
+#ifdef C4_BENCH_WITH_PERF
+            if (result->has_perf) {
+                ioctl(fd_instructions, PERF_EVENT_IOC_DISABLE, 0);
+                ioctl(fd_cache_misses, PERF_EVENT_IOC_DISABLE, 0);
+            }
+#endif
+            result->nb_events += nb_events;
+        }
+#ifdef C4_BENCH_WITH_PERF
+        if (result->has_perf) {
+            result->instructions = bench_perf_read(fd_instructions);
+            result->cache_misses = bench_perf_read(fd_cache_misses);
+        }
+        if (fd_instructions >= 0) {
+            close(fd_instructions);
+        }
+        if (fd_cache_misses >= 0) {
+            close(fd_cache_misses);
+        }
+#endif
+    }
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    return ret;
+}
+
+/* Bulk evaluation of many paths. The paths and their C4 states are allocated
+* one by one, as a server would. Loading the bulk arrays chases the state
+* pointer of each path, as per path processing does; evaluating only
+* reads and writes the arrays. The paths stay in the initial state, so
+* applying only measures the cost of checking the paths, not of updating
+* the pacer.
+ */
+static int bench_bulk(size_t nb_paths)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_path_t** paths = NULL;
+    c4_bulk_t* bulk = NULL;
+    struct sockaddr_in addr;
+    size_t nb_created = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4443);
+
+    if ((quic = picoquic_create(8, NULL, NULL, NULL, "hq-interop", NULL, NULL, NULL, NULL, NULL,
+        simulated_time, &simulated_time, NULL, NULL, 0)) == NULL ||
+        (cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, simulated_time, 0, "test.example.com", "hq-interop", 1)) == NULL ||
+        (paths = (picoquic_path_t**)calloc(nb_paths, sizeof(picoquic_path_t*))) == NULL ||
+        (bulk = c4_bulk_create(nb_paths)) == NULL) {
+        ret = -1;
+    }
+    else {
+        uint64_t load_time = 0;
+        uint64_t evaluate_time = 0;
+        uint64_t apply_time = 0;
+        uint64_t checksum = 0;
+
+        picoquic_set_congestion_algorithm(cnx, c4_algorithm);
+        for (; nb_created < nb_paths; nb_created++) {
+            picoquic_path_t* path_x = (picoquic_path_t*)calloc(1, sizeof(picoquic_path_t));
+            if (path_x == NULL) {
+                ret = -1;
+                break;
+            }
+            path_x->cnx = cnx;
+            path_x->send_mtu = C4_BENCH_PACKET_SIZE;
+            c4_algorithm->alg_init(cnx, path_x, NULL, simulated_time);
+            paths[nb_created] = path_x;
+        }
+        for (int round = 0; ret == 0 && round < C4_BENCH_BULK_ROUNDS; round++) {
+            uint64_t start_time = picoquic_current_time();
+            (void)c4_bulk_load(bulk, paths, nb_paths);
+            load_time += picoquic_current_time() - start_time;
+            start_time = picoquic_current_time();
+            c4_bulk_evaluate(bulk);
+            evaluate_time += picoquic_current_time() - start_time;
+            start_time = picoquic_current_time();
+            checksum += c4_bulk_apply(bulk, paths, nb_paths);
+            apply_time += picoquic_current_time() - start_time;
+            checksum += paths[round % nb_paths]->cwin;
+        }
+        if (ret == 0) {
+            double nb_evaluations = (double)nb_paths * C4_BENCH_BULK_ROUNDS;
+            printf("%10zu %12.2f %12.2f %12.2f %12" PRIu64 "\n", nb_paths,
+                ((double)load_time) * 1000.0 / nb_evaluations,
+                ((double)evaluate_time) * 1000.0 / nb_evaluations,
+                ((double)apply_time) * 1000.0 / nb_evaluations, checksum);
+        }
+    }
+    for (size_t i = 0; i < nb_created; i++) {
+        c4_algorithm->alg_delete(paths[i]);
+        free(paths[i]);
+    }
+    if (bulk != NULL) {
+        c4_bulk_delete(bulk);
+    }
+    if (paths != NULL) {
+        free(paths);
+    }
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    return ret;
+}
+
+static void bench_report(char const* alg_name, bench_stream_enum stream, bench_result_t* result)
+{
+    double nb_events = (result->nb_events > 0) ? (double)result->nb_events : 1.0;
+
+    printf("%-10s %-12s %10" PRIu64 " %10.1f", bench_stream_names[stream], alg_name,
+        result->nb_events, ((double)result->duration_us) * 1000.0 / nb_events);
+    if (result->has_perf) {
+        printf(" %12.1f %12.4f\n", ((double)result->instructions) / nb_events,
+            ((double)result->cache_misses) / nb_events);
+    }
+    else {
+        printf(" %12s %12s\n", "n/a", "n/a");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    uint64_t nb_events = C4_BENCH_DEFAULT_EVENTS;
+    char const* alg_filter = NULL;
+    char const* stream_filter = NULL;
+    char const* alg_names[] = { "c4", "c4_batch", "cubic", "bbr", "newreno" };
+    size_t nb_algs = sizeof(alg_names) / sizeof(char const*);
+    bench_event_t* events = NULL;
+    size_t bulk_max_paths = 0;
+    int opt;
+
+    /* Load the available set of congestion control algorithms */
+    picoquic_register_all_congestion_control_algorithms();
+    if (picoquic_register_cc_algorithm(c4_algorithm) != 0) {
+        fprintf(stderr, "Could not register the C4 algorithm.\n");
+        return -1;
+    }
+
+    while ((opt = getopt(argc, argv, "n:a:s:p:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            if ((nb_events = (uint64_t)atoll(optarg)) == 0) {
+                fprintf(stderr, "Invalid number of events: %s\n", optarg);
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'a':
+            alg_filter = optarg;
+            break;
+        case 's':
+            stream_filter = optarg;
+            break;
+        case 'p':
+            if ((bulk_max_paths = (size_t)atoll(optarg)) == 0) {
+                fprintf(stderr, "Invalid number of paths: %s\n", optarg);
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+    if (bulk_max_paths > 0) {
+        size_t nb_paths_list[] = { 10000, 100000, 1000000 };
+
+        printf("%10s %12s %12s %12s %12s\n", "paths", "load ns/path", "eval ns/path", "apply ns/path", "checksum");
+        for (size_t i = 0; ret == 0 && i < sizeof(nb_paths_list) / sizeof(size_t); i++) {
+            if (nb_paths_list[i] <= bulk_max_paths &&
+                (ret = bench_bulk(nb_paths_list[i])) != 0) {
+                fprintf(stderr, "Cannot run the bulk evaluation of %zu paths\n", nb_paths_list[i]);
+            }
+        }
+        return ret;
+    }
+
+    if ((events = (bench_event_t*)malloc(sizeof(bench_event_t) * C4_BENCH_BLOCK_SIZE)) == NULL) {
+        fprintf(stderr, "Cannot allocate the event buffer.\n");
+        return -1;
+    }
+
+    printf("%-10s %-12s %10s %10s %12s %12s\n", "stream", "algorithm", "events", "ns/event", "instr/event", "miss/event");
+    for (int stream = 0; ret == 0 && stream < bench_stream_max; stream++) {
+        if (stream_filter != NULL && strcmp(stream_filter, bench_stream_names[stream]) != 0) {
+            continue;
+        }
+        for (size_t i = 0; ret == 0 && i < nb_algs; i++) {
+            int is_batch = (strcmp(alg_names[i], "c4_batch") == 0);
+            picoquic_congestion_algorithm_t const* alg =
+                picoquic_get_congestion_algorithm((is_batch) ? "c4" : alg_names[i]);
+            bench_result_t result;
+
+            if (alg_filter != NULL && strcmp(alg_filter, alg_names[i]) != 0) {
+                continue;
+            }
+            if (alg == NULL) {
+                fprintf(stderr, "Algorithm %s is not available.\n", alg_names[i]);
+                continue;
+            }
+            if ((ret = bench_run(alg, is_batch, (bench_stream_enum)stream, nb_events, events, &result)) != 0) {
+                fprintf(stderr, "Cannot run %s on stream %s\n", alg_names[i], bench_stream_names[stream]);
+            }
+            else {
+                bench_report(alg_names[i], (bench_stream_enum)stream, &result);
+            }
+        }
+    }
+    free(events);
+
+    return ret;
+}
@@ -0,0 +1,220 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "c4_cache.h"
+#ifndef _WINDOWS
+#include <netinet/in.h>
+#endif
+
+/* The entries are kept in a single array of sets, the number of sets
+* being a power of 2. The set of a prefix is found by hashing the prefix
+* with a random salt, so that peers cannot choose addresses that all
+* land in the same set.
+ */
+typedef struct st_c4_cache_entry_t {
+    uint64_t stored_time;
+    c4_estimate_t estimate;
+    uint8_t is_used;
+    uint8_t family;
+    uint8_t prefix[C4_CACHE_PREFIX_BYTES_IPV6];
+} c4_cache_entry_t;
+
+struct st_c4_cache_t {
+    picoquic_mutex_t mutex;
+    size_t nb_sets;
+    uint64_t ttl;
+    uint64_t salt;
+    c4_cache_stats_t stats;
+    c4_cache_entry_t* entries;
+};
+
+c4_cache_t* c4_cache_create(size_t nb_entries_max, uint64_t ttl)
+{
+    c4_cache_t* cache = NULL;
+    size_t nb_sets = 1;
+
+    if (nb_entries_max == 0 || nb_entries_max > SIZE_MAX / (2 * sizeof(c4_cache_entry_t))) {
+        return NULL;
+    }
+    while (nb_sets * C4_CACHE_NB_WAYS < nb_entries_max) {
+        nb_sets *= 2;
+    }
+    if ((cache = (c4_cache_t*)malloc(sizeof(c4_cache_t))) != NULL) {
+        memset(cache, 0, sizeof(c4_cache_t));
+        cache->entries = (c4_cache_entry_t*)calloc(nb_sets * C4_CACHE_NB_WAYS, sizeof(c4_cache_entry_t));
+        if (cache->entries == NULL || picoquic_create_mutex(&cache->mutex) != 0) {
+            free(cache->entries);
+            free(cache);
+            cache = NULL;
+        }
+        else {
+            cache->nb_sets = nb_sets;
+            cache->ttl = ttl;
+            cache->salt = picoquic_public_random_64();
+            cache->stats.nb_entries_max = nb_sets * C4_CACHE_NB_WAYS;
+        }
+    }
+    return cache;
+}
+
+void c4_cache_delete(c4_cache_t* cache)
+{
+    if (cache != NULL) {
+        (void)picoquic_delete_mutex(&cache->mutex);
+        free(cache->entries);
+        free(cache);
+    }
+}
+
+uint8_t c4_cache_get_prefix(const struct sockaddr* addr, uint8_t* prefix)
+{
+    uint8_t family = 0;
+
+    memset(prefix, 0, C4_CACHE_PREFIX_BYTES_IPV6);
+    if (addr == NULL) {
+        return 0;
+    }
+    if (addr->sa_family == AF_INET) {
+        memcpy(prefix, &((struct sockaddr_in*)addr)->sin_addr, C4_CACHE_PREFIX_BYTES_IPV4);
+        family = 4;
+    }
+    else if (addr->sa_family == AF_INET6) {
+        uint8_t const* a6 = (uint8_t const*)&((struct sockaddr_in6*)addr)->sin6_addr;
+        static const uint8_t v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+        if (memcmp(a6, v4_mapped, sizeof(v4_mapped)) == 0) {
+            memcpy(prefix, a6 + 12, C4_CACHE_PREFIX_BYTES_IPV4);
+            family = 4;
+        }
+        else {
+            memcpy(prefix, a6, C4_CACHE_PREFIX_BYTES_IPV6);
+            family = 6;
+        }
+    }
+    return family;
+}
+
+static c4_cache_entry_t* c4_cache_get_set(c4_cache_t* cache, uint8_t family, uint8_t const* prefix)
+{
+    /* FNV-1a, starting from the salted offset basis */
+    uint64_t h = 0xcbf29ce484222325ull ^ cache->salt;
+
+    h = (h ^ family) * 0x100000001b3ull;
+    for (int i = 0; i < C4_CACHE_PREFIX_BYTES_IPV6; i++) {
+        h = (h ^ prefix[i]) * 0x100000001b3ull;
+    }
+    h ^= h >> 32;
+    return &cache->entries[(h & (cache->nb_sets - 1)) * C4_CACHE_NB_WAYS];
+}
+
+static int c4_cache_is_match(c4_cache_entry_t const* entry, uint8_t family, uint8_t const* prefix)
+{
+    return (entry->is_used && entry->family == family &&
+        memcmp(entry->prefix, prefix, C4_CACHE_PREFIX_BYTES_IPV6) == 0);
+}
+
+void c4_cache_store(c4_cache_t* cache, const struct sockaddr* addr, c4_estimate_t const* estimate, uint64_t current_time)
+{
+    uint8_t prefix[C4_CACHE_PREFIX_BYTES_IPV6];
+    uint8_t family = c4_cache_get_prefix(addr, prefix);
+
+    if (cache != NULL && family != 0) {
+        c4_cache_entry_t* set;
+        c4_cache_entry_t* target = NULL;
+
+        (void)picoquic_lock_mutex(&cache->mutex);
+        set = c4_cache_get_set(cache, family, prefix);
+        /* Use the entry of the same prefix if there is one, else an
+         * unused entry, else the oldest one. */
+        for (int i = 0; i < C4_CACHE_NB_WAYS; i++) {
+            if (c4_cache_is_match(&set[i], family, prefix)) {
+                target = &set[i];
+                break;
+            }
+            if (target == NULL || (target->is_used &&
+                (!set[i].is_used || set[i].stored_time < target->stored_time))) {
+                target = &set[i];
+            }
+        }
+        if (!target->is_used) {
+            cache->stats.nb_entries++;
+        }
+        else if (!c4_cache_is_match(target, family, prefix) &&
+            current_time <= target->stored_time + cache->ttl) {
+            cache->stats.nb_evicted++;
+        }
+        target->is_used = 1;
+        target->family = family;
+        memcpy(target->prefix, prefix, C4_CACHE_PREFIX_BYTES_IPV6);
+        target->stored_time = current_time;
+        target->estimate = *estimate;
+        cache->stats.nb_stored++;
+        (void)picoquic_unlock_mutex(&cache->mutex);
+    }
+}
+
+int c4_cache_lookup(c4_cache_t* cache, const struct sockaddr* addr, c4_estimate_t* estimate, uint64_t current_time)
+{
+    int ret = -1;
+    uint8_t prefix[C4_CACHE_PREFIX_BYTES_IPV6];
+    uint8_t family = c4_cache_get_prefix(addr, prefix);
+
+    if (cache != NULL && family != 0) {
+        c4_cache_entry_t* set;
+
+        (void)picoquic_lock_mutex(&cache->mutex);
+        set = c4_cache_get_set(cache, family, prefix);
+        for (int i = 0; i < C4_CACHE_NB_WAYS; i++) {
+            if (c4_cache_is_match(&set[i], family, prefix)) {
+                if (current_time <= set[i].stored_time + cache->ttl) {
+                    *estimate = set[i].estimate;
+                    ret = 0;
+                }
+                else {
+                    /* Expired entries are released, so the slot can be reused. */
+                    set[i].is_used = 0;
+                    cache->stats.nb_entries--;
+                    cache->stats.nb_expired++;
+                }
+                break;
+            }
+        }
+        if (ret == 0) {
+            cache->stats.nb_hits++;
+        }
+        else {
+            cache->stats.nb_misses++;
+        }
+        (void)picoquic_unlock_mutex(&cache->mutex);
+    }
+    return ret;
+}
+
+void c4_cache_get_stats(c4_cache_t* cache, c4_cache_stats_t* stats)
+{
+    (void)picoquic_lock_mutex(&cache->mutex);
+    *stats = cache->stats;
+    (void)picoquic_unlock_mutex(&cache->mutex);
+}
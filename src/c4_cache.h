@@ -0,0 +1,61 @@
+/*
+Cache of the path estimates of C4, per peer address prefix
+*/
+
+#ifndef C4_CACHE_H
+#define C4_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "picoquic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C4_CACHE_NB_WAYS 4
+#define C4_CACHE_PREFIX_BYTES_IPV4 3 /* /24 */
+#define C4_CACHE_PREFIX_BYTES_IPV6 6 /* /48 */
+
+    typedef struct st_c4_cache_t c4_cache_t;
+
+    typedef struct st_c4_estimate_t {
+        uint64_t nominal_rate;
+        uint32_t nominal_max_rtt;
+        uint32_t running_min_rtt;
+    } c4_estimate_t;
+
+    typedef struct st_c4_cache_stats_t {
+        uint64_t nb_entries; /* Entries currently stored, including expired ones */
+        uint64_t nb_entries_max;
+        uint64_t nb_stored;
+        uint64_t nb_hits;
+        uint64_t nb_misses;
+        uint64_t nb_expired; /* Lookups that found an entry older than the TTL */
+        uint64_t nb_evicted; /* Valid entries replaced by another prefix */
+    } c4_cache_stats_t;
+
+    /* Extract the prefix of the address in C4_CACHE_PREFIX_BYTES_IPV6 bytes,
+    * padded with zeroes. IPv4 addresses mapped in IPv6 use the same prefix
+    * as the IPv4 address. Returns 4 or 6, or 0 if the family is not supported.
+     */
+    uint8_t c4_cache_get_prefix(const struct sockaddr* addr, uint8_t* prefix);
+
+    /* The cache is keyed by the prefix of the peer address, /24 for IPv4
+    * and /48 for IPv6. It is organized in sets of C4_CACHE_NB_WAYS entries,
+    * allocated once, so the memory is bounded by the number of entries.
+    * When a set is full, the oldest entry is replaced. Entries older than
+    * the TTL are not returned. All calls lock a mutex, so the cache can be
+    * shared by several network threads.
+     */
+    c4_cache_t* c4_cache_create(size_t nb_entries_max, uint64_t ttl);
+    void c4_cache_delete(c4_cache_t* cache);
+    void c4_cache_store(c4_cache_t* cache, const struct sockaddr* addr, c4_estimate_t const* estimate, uint64_t current_time);
+    /* Returns 0 and fills the estimate if a valid entry is found, -1 otherwise. */
+    int c4_cache_lookup(c4_cache_t* cache, const struct sockaddr* addr, c4_estimate_t* estimate, uint64_t current_time);
+    void c4_cache_get_stats(c4_cache_t* cache, c4_cache_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,919 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Numerical checks of C4.
+* Each check compares an optimized computation of C4 with a direct
+* reference implementation, and fails if the results differ by more
+* than the rounding error of the arithmetic in use. With C4_INTEGER_ONLY,
+* the loss rates are fixed point numbers scaled by 2^24, and the
+* tolerance is set accordingly.
+* The coupled multipath mode is checked on a fluid model of two paths,
+* because the scenarios of picoquic_ns only have one path per connection.
+* The batched notification of acknowledgements is checked against the
+* per acknowledgement notifications on the same stream of samples.
+* The estimate cache is checked for hits per prefix, expiry, eviction in
+* a full set, and IPv4 addresses mapped in IPv6. The estimate store is
+* checked on a temporary file, which is reopened and corrupted.
+* The bulk evaluation is compared with the per path computation of the
+* CWIN and pacing rate on random states.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "cc_common.h"
+#include "picoquic_register_cc_algo.h"
+#include "c4.h"
+#include "c4_store.h"
+
+#ifdef _WINDOWS
+#include "../pico_sim_vs/pico_sim_vs/getopt.h"
+#else
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#define C4_CHECK_DEFAULT_TRIALS 100000
+#ifdef C4_INTEGER_ONLY
+#define C4_CHECK_LOSS_TOLERANCE 1.0e-6
+#else
+#define C4_CHECK_LOSS_TOLERANCE 1.0e-12
+#endif
+#define C4_CHECK_MP_CAPACITY 2500000.0 /* bytes per second, per bottleneck */
+#define C4_CHECK_MP_LATENCY 40000 /* microseconds */
+#define C4_CHECK_MP_QUEUE_MAX 0.08 /* seconds */
+#define C4_CHECK_MP_STEPS 120000 /* of 1 ms */
+#define C4_CHECK_MP_WARMUP 40000
+#define C4_CHECK_MP_FAIRNESS 0.1 /* max difference between A and B on a shared bottleneck, fraction of capacity */
+#define C4_CHECK_BATCH_SIZE 4 /* acknowledgements per ACK frame */
+#define C4_CHECK_BATCH_STEPS 30000 /* of 1 ms */
+#define C4_CHECK_CACHE_TTL 10000000 /* microseconds */
+#define C4_CHECK_STORE_FILE "c4_check_store.tmp"
+#define C4_CHECK_STORE_HEADER_SIZE 64 /* records follow the 64 bytes header of the store file */
+#define C4_CHECK_BULK_PATHS 64
+
+void usage()
+{
+    fprintf(stderr, "C4_check, checks of the C4 computations, the coupled multipath mode and the\nbatched notifications\n\n");
+    fprintf(stderr, "Usage: c4_check [options]\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -n number  Number of random trials per check, default %d.\n", C4_CHECK_DEFAULT_TRIALS);
+    fprintf(stderr, "  -h         Print this message.\n");
+}
+
+/* Reference: decay once per packet without loss, as picoquic does. */
+static double check_loss_rate_reference(double drop_rate, uint64_t gap)
+{
+    if (gap > PICOQUIC_SMOOTHED_LOSS_SCOPE) {
+        gap = PICOQUIC_SMOOTHED_LOSS_SCOPE;
+    }
+    for (uint64_t i = 0; i < gap; i++) {
+        drop_rate *= (1.0 - PICOQUIC_SMOOTHED_LOSS_FACTOR);
+    }
+    drop_rate += (1.0 - drop_rate) * PICOQUIC_SMOOTHED_LOSS_FACTOR;
+    return drop_rate;
+}
+
+/* Compare the smoothed loss rate over all the gap sizes up to twice the
+* scope, for loss rates 0 and 1 and for random loss rates.
+ */
+static int check_loss_rate(uint64_t nb_trials)
+{
+    double max_error = 0;
+    uint64_t max_gap = 2 * PICOQUIC_SMOOTHED_LOSS_SCOPE;
+    uint64_t nb_compared = 0;
+
+    for (uint64_t trial = 0; trial < nb_trials + 2; trial++) {
+        double drop_rate = (trial == 0) ? 0.0 : ((trial == 1) ? 1.0 :
+            ((double)(picoquic_public_random_64() >> 11)) / ((double)(UINT64_C(1) << 53)));
+
+        for (uint64_t gap = 1; gap <= max_gap; gap++) {
+            double error = c4_loss_rate_check(drop_rate, gap) - check_loss_rate_reference(drop_rate, gap);
+            if (error < 0) {
+                error = -error;
+            }
+            if (error > max_error) {
+                max_error = error;
+            }
+            nb_compared++;
+        }
+    }
+    printf("Loss rate: %" PRIu64 " comparisons, gaps 1 to %" PRIu64 ", max error %.3g, tolerance %.3g.\n",
+        nb_compared, max_gap, max_error, C4_CHECK_LOSS_TOLERANCE);
+    return (max_error <= C4_CHECK_LOSS_TOLERANCE) ? 0 : -1;
+}
+
+/* Fluid model of two connections. Connection A has two paths, and
+* connection B one path. Path 0 of A and the path of B share bottleneck 0.
+* Path 1 of A uses bottleneck 0 if the bottlenecks are shared, and
+* bottleneck 1 if they are disjoint. Each step of 1 ms, each path sends
+* at the lower of its pacing rate and CWIN per RTT, the bottleneck
+* queues grow by the excess of the load over the capacity, and the
+* paths are notified of one ACK, with losses when a queue overflows.
+* The result is the average delivery rate of each path after warm up.
+ */
+typedef struct st_check_mp_result_t {
+    double rate[3];
+} check_mp_result_t;
+
+static uint32_t check_mp_random(uint32_t* seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+static int check_mp_run(int is_disjoint, char const* options, check_mp_result_t* result)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx[2] = { NULL, NULL };
+    picoquic_path_t** saved_path[2] = { NULL, NULL };
+    int saved_nb_paths[2] = { 0, 0 };
+    picoquic_path_t model_path[3];
+    picoquic_path_t* cnx_path[3] = { &model_path[0], &model_path[1], &model_path[2] };
+    int bottleneck[3] = { 0, is_disjoint, 0 };
+    double queue[2] = { 0, 0 };
+    uint32_t seed = 1;
+    struct sockaddr_in addr;
+
+    memset(result, 0, sizeof(check_mp_result_t));
+    memset(model_path, 0, sizeof(model_path));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4443);
+
+    if ((quic = picoquic_create(8, NULL, NULL, NULL, "hq-interop", NULL, NULL, NULL, NULL, NULL,
+        simulated_time, &simulated_time, NULL, NULL, 0)) == NULL) {
+        return -1;
+    }
+    for (int c = 0; ret == 0 && c < 2; c++) {
+        if ((cnx[c] = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, simulated_time, 0, "test.example.com", "hq-interop", 1)) == NULL) {
+            ret = -1;
+        }
+        else {
+            /* The model paths replace the paths of the connections until the end of the run */
+            picoquic_set_congestion_algorithm(cnx[c], c4_algorithm);
+            saved_path[c] = cnx[c]->path;
+            saved_nb_paths[c] = cnx[c]->nb_paths;
+            cnx[c]->path = (c == 0) ? &cnx_path[0] : &cnx_path[2];
+            cnx[c]->nb_paths = (c == 0) ? 2 : 1;
+            cnx[c]->is_multipath_enabled = 1;
+            cnx[c]->cnx_state = picoquic_state_ready;
+        }
+    }
+    if (ret == 0) {
+        int nb_steps = 0;
+
+        for (int i = 0; i < 3; i++) {
+            model_path[i].cnx = cnx[(i < 2) ? 0 : 1];
+            model_path[i].send_mtu = 1440;
+            model_path[i].smoothed_rtt = C4_CHECK_MP_LATENCY;
+            c4_algorithm->alg_init(model_path[i].cnx, &model_path[i], options, 0);
+        }
+        for (int k = 0; k < C4_CHECK_MP_STEPS; k++) {
+            uint64_t current_time = (uint64_t)k * 1000;
+            double send[3];
+            double load[2] = { 0, 0 };
+            int overflow[2] = { 0, 0 };
+
+            for (int i = 0; i < 3; i++) {
+                double rtt = ((double)C4_CHECK_MP_LATENCY) / 1000000.0 + queue[bottleneck[i]] / C4_CHECK_MP_CAPACITY;
+                double cwin_rate = ((double)model_path[i].cwin) / rtt;
+                send[i] = ((double)model_path[i].pacing_rate < cwin_rate) ? (double)model_path[i].pacing_rate : cwin_rate;
+                if (send[i] < 1000.0) {
+                    send[i] = 1000.0;
+                }
+                load[bottleneck[i]] += send[i];
+            }
+            for (int b = 0; b < 2; b++) {
+                queue[b] += (load[b] - C4_CHECK_MP_CAPACITY) * 0.001;
+                if (queue[b] < 0) {
+                    queue[b] = 0;
+                }
+                else if (queue[b] > C4_CHECK_MP_CAPACITY * C4_CHECK_MP_QUEUE_MAX) {
+                    queue[b] = C4_CHECK_MP_CAPACITY * C4_CHECK_MP_QUEUE_MAX;
+                    overflow[b] = 1;
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                picoquic_path_t* path_x = &model_path[i];
+                int b = bottleneck[i];
+                double delivered = (load[b] > C4_CHECK_MP_CAPACITY) ? send[i] * C4_CHECK_MP_CAPACITY / load[b] : send[i];
+                uint64_t rtt = C4_CHECK_MP_LATENCY + (uint64_t)(queue[b] * 1000000.0 / C4_CHECK_MP_CAPACITY) +
+                    check_mp_random(&seed) % 2000;
+                picoquic_per_ack_state_t ack_state;
+
+                memset(&ack_state, 0, sizeof(ack_state));
+                path_x->pkt_ctx.send_sequence += 3;
+                path_x->pkt_ctx.highest_acknowledged = (path_x->pkt_ctx.send_sequence > 40) ?
+                    path_x->pkt_ctx.send_sequence - 40 : 0;
+                path_x->rtt_sample = rtt;
+                path_x->peak_bandwidth_estimate = (uint64_t)delivered;
+                path_x->bandwidth_estimate = (uint64_t)delivered;
+                path_x->bytes_in_transit = path_x->cwin;
+                path_x->last_time_acked_data_frame_sent = current_time;
+                ack_state.rtt_measurement = rtt;
+                ack_state.send_delay = rtt / 2;
+                ack_state.nb_bytes_delivered_since_packet_sent = (uint64_t)(delivered * (double)rtt / 1000000.0);
+                ack_state.nb_bytes_acknowledged = 1440;
+                ack_state.inflight_prior = path_x->cwin;
+                c4_algorithm->alg_notify(path_x->cnx, path_x, picoquic_congestion_notification_rtt_measurement,
+                    &ack_state, current_time);
+                c4_algorithm->alg_notify(path_x->cnx, path_x, picoquic_congestion_notification_acknowledgement,
+                    &ack_state, current_time);
+                if (overflow[b] && check_mp_random(&seed) % 3 == 0) {
+                    ack_state.lost_packet_number = path_x->pkt_ctx.send_sequence - 20;
+                    c4_algorithm->alg_notify(path_x->cnx, path_x, picoquic_congestion_notification_repeat,
+                        &ack_state, current_time);
+                }
+                if (k >= C4_CHECK_MP_WARMUP) {
+                    result->rate[i] += delivered;
+                }
+            }
+            if (k >= C4_CHECK_MP_WARMUP) {
+                nb_steps++;
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            result->rate[i] /= (double)nb_steps;
+            c4_algorithm->alg_delete(&model_path[i]);
+        }
+    }
+    for (int c = 0; c < 2; c++) {
+        if (cnx[c] != NULL) {
+            if (saved_path[c] != NULL) {
+                cnx[c]->path = saved_path[c];
+                cnx[c]->nb_paths = saved_nb_paths[c];
+            }
+            picoquic_delete_cnx(cnx[c]);
+        }
+    }
+    picoquic_free(quic);
+    return ret;
+}
+
+/* Compare the coupled mode 'C' with independent paths 'c'.
+* On a shared bottleneck, the two coupled paths of connection A must
+* together get about as much as the single path of connection B, within
+* C4_CHECK_MP_FAIRNESS of the capacity. On disjoint bottlenecks, the path
+* alone on its bottleneck must still use it fully, and the shared
+* bottleneck must stay fully used.
+ */
+static int check_coupled(void)
+{
+    int ret = 0;
+    check_mp_result_t independent[2];
+    check_mp_result_t coupled[2];
+    char const* bottleneck_names[2] = { "shared", "disjoint" };
+
+    for (int is_disjoint = 0; ret == 0 && is_disjoint < 2; is_disjoint++) {
+        if (check_mp_run(is_disjoint, "c", &independent[is_disjoint]) != 0 ||
+            check_mp_run(is_disjoint, "C", &coupled[is_disjoint]) != 0) {
+            fprintf(stderr, "Cannot run the two path model.\n");
+            ret = -1;
+        }
+        else {
+            for (int mode = 0; mode < 2; mode++) {
+                check_mp_result_t* r = (mode == 0) ? &independent[is_disjoint] : &coupled[is_disjoint];
+                printf("Multipath, %s bottleneck, %s: A = %.0f + %.0f, B = %.0f bytes/s.\n",
+                    bottleneck_names[is_disjoint], (mode == 0) ? "independent" : "coupled",
+                    r->rate[0], r->rate[1], r->rate[2]);
+            }
+        }
+    }
+    if (ret == 0) {
+        check_mp_result_t* s_C = &coupled[0];
+        check_mp_result_t* d_C = &coupled[1];
+        double unfairness = s_C->rate[0] + s_C->rate[1] - s_C->rate[2];
+
+        if (unfairness > C4_CHECK_MP_FAIRNESS * C4_CHECK_MP_CAPACITY ||
+            unfairness < -C4_CHECK_MP_FAIRNESS * C4_CHECK_MP_CAPACITY) {
+            fprintf(stderr, "Coupled paths do not share the bottleneck as a single flow.\n");
+            ret = -1;
+        }
+        if (d_C->rate[1] < 0.9 * C4_CHECK_MP_CAPACITY ||
+            d_C->rate[0] + d_C->rate[2] < 0.9 * C4_CHECK_MP_CAPACITY) {
+            fprintf(stderr, "Coupling leaves a disjoint bottleneck under used.\n");
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/* Compare the batched and per acknowledgement notifications.
+* Two connections see the same stream of acknowledgements on a single
+* bottleneck. The first is notified per acknowledgement through alg_notify,
+* the second by one call to c4_notify_ack_batch per ACK frame. Some frames
+* carry a delay spike in an early sample. After each frame, the two paths
+* must have the same CWIN, pacing rate and state.
+ */
+static int check_batch(void)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx[2] = { NULL, NULL };
+    picoquic_path_t** saved_path[2] = { NULL, NULL };
+    int saved_nb_paths[2] = { 0, 0 };
+    picoquic_path_t model_path[2];
+    picoquic_path_t* cnx_path[2] = { &model_path[0], &model_path[1] };
+    double queue = 0;
+    uint32_t seed = 1;
+    struct sockaddr_in addr;
+
+    memset(model_path, 0, sizeof(model_path));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4443);
+
+    if ((quic = picoquic_create(8, NULL, NULL, NULL, "hq-interop", NULL, NULL, NULL, NULL, NULL,
+        simulated_time, &simulated_time, NULL, NULL, 0)) == NULL) {
+        return -1;
+    }
+    for (int c = 0; ret == 0 && c < 2; c++) {
+        if ((cnx[c] = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, simulated_time, 0, "test.example.com", "hq-interop", 1)) == NULL) {
+            ret = -1;
+        }
+        else {
+            picoquic_set_congestion_algorithm(cnx[c], c4_algorithm);
+            saved_path[c] = cnx[c]->path;
+            saved_nb_paths[c] = cnx[c]->nb_paths;
+            cnx[c]->path = &cnx_path[c];
+            cnx[c]->nb_paths = 1;
+            /* The eras are counted on the packet numbers of the model path */
+            cnx[c]->is_multipath_enabled = 1;
+            cnx[c]->cnx_state = picoquic_state_ready;
+        }
+    }
+    if (ret == 0) {
+        for (int c = 0; c < 2; c++) {
+            model_path[c].cnx = cnx[c];
+            model_path[c].send_mtu = 1440;
+            model_path[c].smoothed_rtt = C4_CHECK_MP_LATENCY;
+            c4_algorithm->alg_init(cnx[c], &model_path[c], NULL, 0);
+        }
+        for (int k = 0; ret == 0 && k < C4_CHECK_BATCH_STEPS; k++) {
+            uint64_t current_time = (uint64_t)k * 1000;
+            double rtt_s = ((double)C4_CHECK_MP_LATENCY) / 1000000.0 + queue / C4_CHECK_MP_CAPACITY;
+            double cwin_rate = ((double)model_path[0].cwin) / rtt_s;
+            double send = ((double)model_path[0].pacing_rate < cwin_rate) ? (double)model_path[0].pacing_rate : cwin_rate;
+            double delivered;
+            int overflow = 0;
+            int has_spike = (check_mp_random(&seed) % 16 == 0);
+            picoquic_per_ack_state_t ack_states[C4_CHECK_BATCH_SIZE];
+
+            if (send < 1000.0) {
+                send = 1000.0;
+            }
+            queue += (send - C4_CHECK_MP_CAPACITY) * 0.001;
+            if (queue < 0) {
+                queue = 0;
+            }
+            else if (queue > C4_CHECK_MP_CAPACITY * C4_CHECK_MP_QUEUE_MAX) {
+                queue = C4_CHECK_MP_CAPACITY * C4_CHECK_MP_QUEUE_MAX;
+                overflow = 1;
+            }
+            delivered = (send > C4_CHECK_MP_CAPACITY) ? C4_CHECK_MP_CAPACITY : send;
+            memset(ack_states, 0, sizeof(ack_states));
+            for (int j = 0; j < C4_CHECK_BATCH_SIZE; j++) {
+                uint64_t rtt = C4_CHECK_MP_LATENCY + (uint64_t)(queue * 1000000.0 / C4_CHECK_MP_CAPACITY) +
+                    check_mp_random(&seed) % 2000;
+                if (has_spike && j == 0) {
+                    rtt += 3 * C4_CHECK_MP_LATENCY / 4;
+                }
+                ack_states[j].rtt_measurement = rtt;
+                ack_states[j].send_delay = rtt / 2;
+                ack_states[j].nb_bytes_delivered_since_packet_sent = (uint64_t)(delivered * (double)rtt / 1000000.0);
+                ack_states[j].nb_bytes_acknowledged = 1440;
+            }
+            for (int c = 0; c < 2; c++) {
+                picoquic_path_t* path_x = &model_path[c];
+
+                path_x->pkt_ctx.send_sequence += 3 * C4_CHECK_BATCH_SIZE;
+                path_x->pkt_ctx.highest_acknowledged = (path_x->pkt_ctx.send_sequence > 40) ?
+                    path_x->pkt_ctx.send_sequence - 40 : 0;
+                path_x->rtt_sample = ack_states[C4_CHECK_BATCH_SIZE - 1].rtt_measurement;
+                path_x->peak_bandwidth_estimate = (uint64_t)delivered;
+                path_x->bandwidth_estimate = (uint64_t)delivered;
+                path_x->bytes_in_transit = model_path[0].cwin;
+                path_x->last_time_acked_data_frame_sent = current_time;
+                for (int j = 0; j < C4_CHECK_BATCH_SIZE; j++) {
+                    ack_states[j].inflight_prior = model_path[0].cwin;
+                }
+            }
+            for (int j = 0; j < C4_CHECK_BATCH_SIZE; j++) {
+                c4_algorithm->alg_notify(cnx[0], &model_path[0], picoquic_congestion_notification_rtt_measurement,
+                    &ack_states[j], current_time);
+                c4_algorithm->alg_notify(cnx[0], &model_path[0], picoquic_congestion_notification_acknowledgement,
+                    &ack_states[j], current_time);
+            }
+            c4_notify_ack_batch(cnx[1], &model_path[1], ack_states, C4_CHECK_BATCH_SIZE, current_time);
+            if (overflow && check_mp_random(&seed) % 3 == 0) {
+                for (int c = 0; c < 2; c++) {
+                    ack_states[0].lost_packet_number = model_path[c].pkt_ctx.send_sequence - 20;
+                    c4_algorithm->alg_notify(cnx[c], &model_path[c], picoquic_congestion_notification_repeat,
+                        &ack_states[0], current_time);
+                }
+            }
+            if (model_path[0].cwin != model_path[1].cwin ||
+                model_path[0].pacing_rate != model_path[1].pacing_rate) {
+                ret = -1;
+            }
+            else {
+                uint64_t cc_state[2];
+                uint64_t cc_param[2];
+
+                for (int c = 0; c < 2; c++) {
+                    c4_algorithm->alg_observe(&model_path[c], &cc_state[c], &cc_param[c]);
+                }
+                if (cc_state[0] != cc_state[1] || cc_param[0] != cc_param[1]) {
+                    ret = -1;
+                }
+            }
+            if (ret != 0) {
+                fprintf(stderr, "Batched and per ACK notifications differ after %d ms: cwin %" PRIu64 " vs %" PRIu64
+                    ", pacing %" PRIu64 " vs %" PRIu64 ".\n", k, model_path[0].cwin, model_path[1].cwin,
+                    model_path[0].pacing_rate, model_path[1].pacing_rate);
+            }
+        }
+        if (ret == 0) {
+            printf("Batched notifications: %d ACK frames of %d samples, same CWIN, pacing and state.\n",
+                C4_CHECK_BATCH_STEPS, C4_CHECK_BATCH_SIZE);
+        }
+        for (int c = 0; c < 2; c++) {
+            c4_algorithm->alg_delete(&model_path[c]);
+        }
+    }
+    for (int c = 0; c < 2; c++) {
+        if (cnx[c] != NULL) {
+            if (saved_path[c] != NULL) {
+                cnx[c]->path = saved_path[c];
+                cnx[c]->nb_paths = saved_nb_paths[c];
+            }
+            picoquic_delete_cnx(cnx[c]);
+        }
+    }
+    picoquic_free(quic);
+    return ret;
+}
+
+static void check_cache_addr4(struct sockaddr_in* addr, uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
+{
+    uint8_t* a = (uint8_t*)&addr->sin_addr;
+
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    a[0] = b0;
+    a[1] = b1;
+    a[2] = b2;
+    a[3] = b3;
+}
+
+/* Set an IPv6 address from its first 6 bytes and last byte, or map
+* the IPv4 address a4 if it is not NULL. */
+static void check_cache_addr6(struct sockaddr_in6* addr, uint8_t const* prefix, uint8_t last, uint8_t const* a4)
+{
+    uint8_t* a = (uint8_t*)&addr->sin6_addr;
+
+    memset(addr, 0, sizeof(struct sockaddr_in6));
+    addr->sin6_family = AF_INET6;
+    if (a4 != NULL) {
+        a[10] = 0xff;
+        a[11] = 0xff;
+        memcpy(a + 12, a4, 4);
+    }
+    else {
+        memcpy(a, prefix, 6);
+        a[15] = last;
+    }
+}
+
+static int check_cache_hit(c4_cache_t* cache, struct sockaddr* addr, uint64_t expected_rate, uint64_t current_time)
+{
+    c4_estimate_t estimate;
+
+    return (c4_cache_lookup(cache, addr, &estimate, current_time) == 0 &&
+        estimate.nominal_rate == expected_rate);
+}
+
+/* Check the estimate cache. A cache of C4_CACHE_NB_WAYS entries has a
+* single set. Entry k is stored for the prefix 10.0.k/24 at time k with
+* the rate k + 1, then one more prefix evicts the oldest entry.
+ */
+static int check_cache(void)
+{
+    int ret = 0;
+    c4_cache_t* cache = c4_cache_create(C4_CACHE_NB_WAYS, C4_CHECK_CACHE_TTL);
+    c4_cache_t* cache6 = c4_cache_create(64, C4_CHECK_CACHE_TTL);
+    c4_cache_stats_t stats;
+    c4_estimate_t estimate;
+    struct sockaddr_in a4;
+    struct sockaddr_in6 a6;
+    uint8_t const v4_bytes[4] = { 10, 0, 1, 200 };
+    uint8_t const p6[6] = { 0x20, 0x01, 0x0d, 0xb8, 0, 1 };
+    uint8_t const p6_other[6] = { 0x20, 0x01, 0x0d, 0xb8, 0, 2 };
+
+    if (cache == NULL || cache6 == NULL) {
+        fprintf(stderr, "Cannot create the estimate cache.\n");
+        ret = -1;
+    }
+    else {
+        memset(&estimate, 0, sizeof(estimate));
+        estimate.nominal_max_rtt = 40000;
+        estimate.running_min_rtt = 30000;
+        for (uint8_t k = 0; k < C4_CACHE_NB_WAYS; k++) {
+            check_cache_addr4(&a4, 10, 0, k, 1);
+            estimate.nominal_rate = k + 1;
+            c4_cache_store(cache, (struct sockaddr*)&a4, &estimate, k);
+        }
+        /* Hit for another host of the same /24, miss for another /24 */
+        check_cache_addr4(&a4, 10, 0, 0, 77);
+        if (!check_cache_hit(cache, (struct sockaddr*)&a4, 1, C4_CACHE_NB_WAYS)) {
+            fprintf(stderr, "Cache miss for a stored IPv4 prefix.\n");
+            ret = -1;
+        }
+        check_cache_addr4(&a4, 10, 0, 99, 1);
+        if (c4_cache_lookup(cache, (struct sockaddr*)&a4, &estimate, C4_CACHE_NB_WAYS) == 0) {
+            fprintf(stderr, "Cache hit for a prefix that was not stored.\n");
+            ret = -1;
+        }
+        /* IPv4 mapped in IPv6 uses the IPv4 prefix */
+        check_cache_addr6(&a6, NULL, 0, v4_bytes);
+        if (!check_cache_hit(cache, (struct sockaddr*)&a6, 2, C4_CACHE_NB_WAYS)) {
+            fprintf(stderr, "Cache miss for a mapped IPv4 address.\n");
+            ret = -1;
+        }
+        /* The set is full, the oldest entry is evicted */
+        check_cache_addr4(&a4, 10, 0, C4_CACHE_NB_WAYS, 1);
+        estimate.nominal_rate = C4_CACHE_NB_WAYS + 1;
+        c4_cache_store(cache, (struct sockaddr*)&a4, &estimate, C4_CACHE_NB_WAYS);
+        check_cache_addr4(&a4, 10, 0, 0, 1);
+        if (c4_cache_lookup(cache, (struct sockaddr*)&a4, &estimate, C4_CACHE_NB_WAYS) == 0) {
+            fprintf(stderr, "The oldest entry of a full set was not evicted.\n");
+            ret = -1;
+        }
+        check_cache_addr4(&a4, 10, 0, C4_CACHE_NB_WAYS, 1);
+        if (!check_cache_hit(cache, (struct sockaddr*)&a4, C4_CACHE_NB_WAYS + 1, C4_CACHE_NB_WAYS)) {
+            fprintf(stderr, "Cache miss for the entry stored in a full set.\n");
+            ret = -1;
+        }
+        /* Entry 2 is valid until 2 + ttl, entry 1 has expired by then */
+        check_cache_addr4(&a4, 10, 0, 2, 1);
+        if (!check_cache_hit(cache, (struct sockaddr*)&a4, 3, 2 + C4_CHECK_CACHE_TTL)) {
+            fprintf(stderr, "Cache miss for an entry at the end of its TTL.\n");
+            ret = -1;
+        }
+        check_cache_addr4(&a4, 10, 0, 1, 1);
+        if (c4_cache_lookup(cache, (struct sockaddr*)&a4, &estimate, 2 + C4_CHECK_CACHE_TTL) == 0) {
+            fprintf(stderr, "Cache hit for an expired entry.\n");
+            ret = -1;
+        }
+        c4_cache_get_stats(cache, &stats);
+        if (stats.nb_evicted != 1 || stats.nb_expired != 1 || stats.nb_entries != C4_CACHE_NB_WAYS - 1) {
+            fprintf(stderr, "Cache stats: %" PRIu64 " evicted, %" PRIu64 " expired, %" PRIu64 " entries.\n",
+                stats.nb_evicted, stats.nb_expired, stats.nb_entries);
+            ret = -1;
+        }
+        /* IPv6 uses /48 prefixes, distinct from the IPv4 ones */
+        check_cache_addr6(&a6, p6, 1, NULL);
+        estimate.nominal_rate = 6;
+        c4_cache_store(cache6, (struct sockaddr*)&a6, &estimate, 0);
+        check_cache_addr6(&a6, p6, 0x77, NULL);
+        if (!check_cache_hit(cache6, (struct sockaddr*)&a6, 6, 1)) {
+            fprintf(stderr, "Cache miss for a stored IPv6 prefix.\n");
+            ret = -1;
+        }
+        check_cache_addr6(&a6, p6_other, 1, NULL);
+        if (c4_cache_lookup(cache6, (struct sockaddr*)&a6, &estimate, 1) == 0) {
+            fprintf(stderr, "Cache hit for another IPv6 prefix.\n");
+            ret = -1;
+        }
+        if (ret == 0) {
+            printf("Estimate cache: hits, expiry, eviction and mapped addresses as expected.\n");
+        }
+    }
+    c4_cache_delete(cache);
+    c4_cache_delete(cache6);
+    return ret;
+}
+
+static int check_store_lookup(c4_store_t* store, struct sockaddr* addr, uint64_t expected_rate,
+    uint16_t expected_confidence, uint64_t current_time)
+{
+    c4_store_record_t record;
+
+    return (c4_store_lookup(store, addr, &record, current_time, C4_CHECK_CACHE_TTL) == 0 &&
+        record.estimate.nominal_rate == expected_rate && record.confidence == expected_confidence);
+}
+
+/* Flip all the bits of the records of the store file, so that no
+* checksum matches, and keep the header valid. */
+static int check_store_corrupt(char const* file_name)
+{
+    int ret = -1;
+    FILE* F = picoquic_file_open(file_name, "r+b");
+
+    if (F != NULL) {
+        uint8_t* buffer = NULL;
+        long size;
+
+        if (fseek(F, 0, SEEK_END) == 0 && (size = ftell(F)) > C4_CHECK_STORE_HEADER_SIZE &&
+            (buffer = (uint8_t*)malloc((size_t)size)) != NULL &&
+            fseek(F, 0, SEEK_SET) == 0 && fread(buffer, 1, (size_t)size, F) == (size_t)size) {
+            for (long i = C4_CHECK_STORE_HEADER_SIZE; i < size; i++) {
+                buffer[i] ^= 0xff;
+            }
+            if (fseek(F, 0, SEEK_SET) == 0 && fwrite(buffer, 1, (size_t)size, F) == (size_t)size) {
+                ret = 0;
+            }
+        }
+        free(buffer);
+        F = picoquic_file_close(F);
+    }
+    return ret;
+}
+
+/* Check the estimate store. Two estimates of the same prefix are merged,
+* the record is kept when the store is reopened, an expired record is
+* replaced instead of merged, and records with a bad checksum are ignored.
+ */
+static int check_store(void)
+{
+    int ret = 0;
+    c4_store_t* store = NULL;
+    c4_store_record_t record;
+    c4_estimate_t estimate;
+    struct sockaddr_in a4;
+    uint64_t late_time = 2 * C4_CHECK_CACHE_TTL;
+
+    (void)remove(C4_CHECK_STORE_FILE);
+    memset(&estimate, 0, sizeof(estimate));
+    estimate.nominal_max_rtt = 40000;
+    estimate.running_min_rtt = 30000;
+    check_cache_addr4(&a4, 10, 2, 0, 1);
+
+    if ((store = c4_store_open(C4_CHECK_STORE_FILE, 64)) == NULL) {
+        fprintf(stderr, "Cannot create the estimate store.\n");
+        ret = -1;
+    }
+    else {
+        estimate.nominal_rate = 1000000;
+        c4_store_update(store, (struct sockaddr*)&a4, &estimate, 0, C4_CHECK_CACHE_TTL);
+        estimate.nominal_rate = 2000000;
+        c4_store_update(store, (struct sockaddr*)&a4, &estimate, 1, C4_CHECK_CACHE_TTL);
+        c4_store_close(store);
+        /* Reopen with another size, the file keeps its own */
+        if ((store = c4_store_open(C4_CHECK_STORE_FILE, 4)) == NULL) {
+            fprintf(stderr, "Cannot reopen the estimate store.\n");
+            ret = -1;
+        }
+        else {
+            check_cache_addr4(&a4, 10, 2, 0, 99);
+            if (!check_store_lookup(store, (struct sockaddr*)&a4, 1500000, 2, 2)) {
+                fprintf(stderr, "The merged record is not kept when the store is reopened.\n");
+                ret = -1;
+            }
+            if (c4_store_lookup(store, (struct sockaddr*)&a4, &record, late_time, C4_CHECK_CACHE_TTL) == 0) {
+                fprintf(stderr, "Store lookup returns an expired record.\n");
+                ret = -1;
+            }
+            estimate.nominal_rate = 3000000;
+            c4_store_update(store, (struct sockaddr*)&a4, &estimate, late_time, C4_CHECK_CACHE_TTL);
+            if (!check_store_lookup(store, (struct sockaddr*)&a4, 3000000, 1, late_time)) {
+                fprintf(stderr, "An expired record is merged instead of replaced.\n");
+                ret = -1;
+            }
+            c4_store_close(store);
+        }
+    }
+    if (ret == 0) {
+        if (check_store_corrupt(C4_CHECK_STORE_FILE) != 0 ||
+            (store = c4_store_open(C4_CHECK_STORE_FILE, 64)) == NULL) {
+            fprintf(stderr, "Cannot corrupt and reopen the estimate store.\n");
+            ret = -1;
+        }
+        else {
+            if (c4_store_lookup(store, (struct sockaddr*)&a4, &record, late_time, C4_CHECK_CACHE_TTL) == 0) {
+                fprintf(stderr, "Store lookup returns a record with a bad checksum.\n");
+                ret = -1;
+            }
+            estimate.nominal_rate = 4000000;
+            c4_store_update(store, (struct sockaddr*)&a4, &estimate, late_time, C4_CHECK_CACHE_TTL);
+            if (!check_store_lookup(store, (struct sockaddr*)&a4, 4000000, 1, late_time)) {
+                fprintf(stderr, "A record with a bad checksum is not replaced.\n");
+                ret = -1;
+            }
+            c4_store_close(store);
+        }
+    }
+    (void)remove(C4_CHECK_STORE_FILE);
+    if (ret == 0) {
+        printf("Estimate store: merge, reopen, expiry and bad checksums as expected.\n");
+    }
+    return ret;
+}
+
+/* Random value between 2^min_log and 2^max_log, log uniform */
+static uint64_t check_bulk_random_log(uint32_t* seed, int min_log, int max_log)
+{
+    int l = min_log + (int)(check_mp_random(seed) % (uint32_t)(max_log - min_log));
+    uint64_t base = ((uint64_t)1) << l;
+
+    return base + (((uint64_t)check_mp_random(seed) * base) >> 15);
+}
+
+/* Compare c4_bulk_evaluate with the per path code. For each trial, the
+* state of a path is set to random values with c4_apply_check, which also
+* sets the CWIN and pacing rate as the per path code does. The bulk table
+* is then loaded, evaluated and applied: it must update the paths that
+* are not in the initial state or the first phases of careful resume, and
+* leave the CWIN and pacing rate of all paths unchanged.
+ */
+static int check_bulk(uint64_t nb_trials)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    picoquic_path_t** saved_path = NULL;
+    int saved_nb_paths = 0;
+    picoquic_path_t model_path[C4_CHECK_BULK_PATHS];
+    picoquic_path_t* paths[C4_CHECK_BULK_PATHS];
+    c4_bulk_t* bulk = c4_bulk_create(C4_CHECK_BULK_PATHS);
+    uint32_t seed = 1;
+    uint64_t nb_compared = 0;
+    struct sockaddr_in addr;
+
+    memset(model_path, 0, sizeof(model_path));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4443);
+
+    if (bulk == NULL || (quic = picoquic_create(8, NULL, NULL, NULL, "hq-interop", NULL, NULL, NULL, NULL, NULL,
+        simulated_time, &simulated_time, NULL, NULL, 0)) == NULL) {
+        ret = -1;
+    }
+    else if ((cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+        (struct sockaddr*)&addr, simulated_time, 0, "test.example.com", "hq-interop", 1)) == NULL) {
+        ret = -1;
+    }
+    else {
+        picoquic_set_congestion_algorithm(cnx, c4_algorithm);
+        saved_path = cnx->path;
+        saved_nb_paths = cnx->nb_paths;
+        cnx->path = paths;
+        cnx->nb_paths = C4_CHECK_BULK_PATHS;
+        cnx->cnx_state = picoquic_state_ready;
+        for (int i = 0; i < C4_CHECK_BULK_PATHS; i++) {
+            paths[i] = &model_path[i];
+            model_path[i].cnx = cnx;
+            model_path[i].smoothed_rtt = C4_CHECK_MP_LATENCY;
+            model_path[i].send_mtu = 1440;
+            c4_algorithm->alg_init(cnx, &model_path[i], NULL, 0);
+        }
+        while (ret == 0 && nb_compared < nb_trials) {
+            uint64_t cwin[C4_CHECK_BULK_PATHS];
+            uint64_t pacing_rate[C4_CHECK_BULK_PATHS];
+            size_t nb_expected = 0;
+            size_t nb_applied;
+
+            for (int i = 0; ret == 0 && i < C4_CHECK_BULK_PATHS; i++) {
+                int alg_state = (int)(check_mp_random(&seed) % C4_NB_STATES);
+                uint64_t nominal_rate = check_bulk_random_log(&seed, 10, 34);
+                uint32_t nominal_max_rtt = (uint32_t)check_bulk_random_log(&seed, 9, 20);
+                uint32_t alpha_1024 = 768 + check_mp_random(&seed) % 1536;
+
+                model_path[i].send_mtu = 1200 + check_mp_random(&seed) % 300;
+                if (c4_apply_check(&model_path[i], alg_state, nominal_rate, nominal_max_rtt, alpha_1024) != 0) {
+                    ret = -1;
+                }
+                cwin[i] = model_path[i].cwin;
+                pacing_rate[i] = model_path[i].pacing_rate;
+                if (alg_state != 0 && (alg_state < 4 || alg_state > 6)) {
+                    nb_expected++;
+                }
+            }
+            if (ret == 0) {
+                (void)c4_bulk_load(bulk, paths, C4_CHECK_BULK_PATHS);
+                c4_bulk_evaluate(bulk);
+                nb_applied = c4_bulk_apply(bulk, paths, C4_CHECK_BULK_PATHS);
+                if (nb_applied != nb_expected) {
+                    fprintf(stderr, "Bulk apply updated %zu paths, expected %zu.\n", nb_applied, nb_expected);
+                    ret = -1;
+                }
+            }
+            for (int i = 0; ret == 0 && i < C4_CHECK_BULK_PATHS; i++) {
+                if (model_path[i].cwin != cwin[i] || model_path[i].pacing_rate != pacing_rate[i]) {
+                    fprintf(stderr, "Bulk and per path results differ: cwin %" PRIu64 " vs %" PRIu64
+                        ", pacing %" PRIu64 " vs %" PRIu64 ".\n", model_path[i].cwin, cwin[i],
+                        model_path[i].pacing_rate, pacing_rate[i]);
+                    ret = -1;
+                }
+                nb_compared++;
+            }
+        }
+        for (int i = 0; i < C4_CHECK_BULK_PATHS; i++) {
+            c4_algorithm->alg_delete(&model_path[i]);
+        }
+        cnx->path = saved_path;
+        cnx->nb_paths = saved_nb_paths;
+    }
+    if (ret == 0) {
+        printf("Bulk evaluation: %" PRIu64 " random states, same CWIN and pacing as per path.\n", nb_compared);
+    }
+    else if (bulk == NULL || quic == NULL || cnx == NULL) {
+        fprintf(stderr, "Cannot set up the bulk evaluation check.\n");
+    }
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    if (bulk != NULL) {
+        c4_bulk_delete(bulk);
+    }
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    uint64_t nb_trials = C4_CHECK_DEFAULT_TRIALS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            if ((nb_trials = (uint64_t)strtoull(optarg, NULL, 10)) == 0) {
+                fprintf(stderr, "Invalid number of trials: %s\n", optarg);
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+    if (picoquic_register_cc_algorithm(c4_algorithm) != 0) {
+        fprintf(stderr, "Could not register the C4 algorithm.\n");
+        return 1;
+    }
+    if (check_loss_rate(nb_trials) != 0) {
+        fprintf(stderr, "Loss rate check failed.\n");
+        ret = 1;
+    }
+    if (check_coupled() != 0) {
+        fprintf(stderr, "Coupled multipath check failed.\n");
+        ret = 1;
+    }
+    if (check_batch() != 0) {
+        fprintf(stderr, "Batched notification check failed.\n");
+        ret = 1;
+    }
+    if (check_cache() != 0) {
+        fprintf(stderr, "Estimate cache check failed.\n");
+        ret = 1;
+    }
+    if (check_store() != 0) {
+        fprintf(stderr, "Estimate store check failed.\n");
+        ret = 1;
+    }
+    if (check_bulk(nb_trials) != 0) {
+        fprintf(stderr, "Bulk evaluation check failed.\n");
+        ret = 1;
+    }
+    return ret;
+}
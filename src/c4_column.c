@@ -0,0 +1,452 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "c4_column.h"
+#ifdef _WINDOWS
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Columnar trace file format.
+* The file starts with a 24 bytes header, followed by blocks. Each block
+* holds the rows of one table: an 8 bytes block header with the table
+* and the number of rows, then each column of the table in turn, as an
+* array of fixed width integers padded to a multiple of 8 bytes. The
+* columns of a table are ordered by decreasing width, so all the arrays
+* are aligned in a mapping of the file. Integers are in host byte order;
+* the byte order marker of the header lets readers on another host
+* reject the file. Rows of a table are in time order, but blocks of the
+* two tables are interleaved in the order in which they were filled.
+ */
+typedef struct st_c4_column_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t block_rows;
+    uint32_t reserved;
+} c4_column_header_t;
+
+typedef struct st_c4_column_block_header_t {
+    uint32_t table;
+    uint32_t nb_rows;
+} c4_column_block_header_t;
+
+/* Fail to compile if the padding of the file structures changes */
+typedef char c4_column_header_is_24_bytes[(sizeof(c4_column_header_t) == 24) ? 1 : -1];
+typedef char c4_column_block_header_is_8_bytes[(sizeof(c4_column_block_header_t) == 8) ? 1 : -1];
+
+#define C4_COLUMN_NB_SAMPLE_COLUMNS 10
+#define C4_COLUMN_NB_TRANSITION_COLUMNS 6
+#define C4_COLUMN_NB_COLUMNS_MAX C4_COLUMN_NB_SAMPLE_COLUMNS
+
+static const uint8_t c4_column_sample_widths[C4_COLUMN_NB_SAMPLE_COLUMNS] = { 8, 8, 8, 8, 8, 4, 4, 4, 1, 1 };
+static const uint8_t c4_column_transition_widths[C4_COLUMN_NB_TRANSITION_COLUMNS] = { 8, 8, 4, 4, 1, 1 };
+
+typedef struct st_c4_column_sample_block_t {
+    uint64_t current_time[C4_COLUMN_BLOCK_ROWS];
+    uint64_t rate_measurement[C4_COLUMN_BLOCK_ROWS];
+    uint64_t nominal_rate[C4_COLUMN_BLOCK_ROWS];
+    uint64_t bytes_delivered[C4_COLUMN_BLOCK_ROWS];
+    uint64_t bandwidth_estimate[C4_COLUMN_BLOCK_ROWS];
+    uint32_t rtt[C4_COLUMN_BLOCK_ROWS];
+    uint32_t send_delay[C4_COLUMN_BLOCK_ROWS];
+    uint32_t nominal_max_rtt[C4_COLUMN_BLOCK_ROWS];
+    uint8_t alg_state[C4_COLUMN_BLOCK_ROWS];
+    uint8_t congestion_notified[C4_COLUMN_BLOCK_ROWS];
+} c4_column_sample_block_t;
+
+typedef struct st_c4_column_transition_block_t {
+    uint64_t current_time[C4_COLUMN_BLOCK_ROWS];
+    uint64_t nominal_rate[C4_COLUMN_BLOCK_ROWS];
+    uint32_t nominal_max_rtt[C4_COLUMN_BLOCK_ROWS];
+    uint32_t running_min_rtt[C4_COLUMN_BLOCK_ROWS];
+    uint8_t old_state[C4_COLUMN_BLOCK_ROWS];
+    uint8_t new_state[C4_COLUMN_BLOCK_ROWS];
+} c4_column_transition_block_t;
+
+struct st_c4_column_writer_t {
+    FILE* F;
+    int is_failed;
+    size_t nb_samples;
+    size_t nb_transitions;
+    c4_column_sample_block_t samples;
+    c4_column_transition_block_t transitions;
+};
+
+struct st_c4_column_reader_t {
+    uint8_t* base;
+    size_t size;
+    size_t nb_blocks;
+    size_t* block_offsets;
+#ifdef _WINDOWS
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+static size_t c4_column_padded(size_t length)
+{
+    return (length + 7) & ~((size_t)7);
+}
+
+static size_t c4_column_block_size(uint8_t const* widths, size_t nb_columns, size_t nb_rows)
+{
+    size_t size = sizeof(c4_column_block_header_t);
+
+    for (size_t i = 0; i < nb_columns; i++) {
+        size += c4_column_padded(widths[i] * nb_rows);
+    }
+    return size;
+}
+
+static void c4_column_write_block(c4_column_writer_t* writer, c4_column_table_enum table, size_t nb_rows,
+    void const** columns, uint8_t const* widths, size_t nb_columns)
+{
+    static const uint8_t padding[8] = { 0 };
+    c4_column_block_header_t block_header;
+
+    block_header.table = (uint32_t)table;
+    block_header.nb_rows = (uint32_t)nb_rows;
+    if (!writer->is_failed && fwrite(&block_header, sizeof(block_header), 1, writer->F) != 1) {
+        writer->is_failed = 1;
+    }
+    for (size_t i = 0; i < nb_columns && !writer->is_failed; i++) {
+        size_t length = widths[i] * nb_rows;
+        size_t padding_length = c4_column_padded(length) - length;
+
+        if (fwrite(columns[i], 1, length, writer->F) != length ||
+            (padding_length > 0 && fwrite(padding, 1, padding_length, writer->F) != padding_length)) {
+            writer->is_failed = 1;
+        }
+    }
+}
+
+static void c4_column_flush_samples(c4_column_writer_t* writer)
+{
+    c4_column_sample_block_t* b = &writer->samples;
+    void const* columns[C4_COLUMN_NB_SAMPLE_COLUMNS] = {
+        b->current_time, b->rate_measurement, b->nominal_rate, b->bytes_delivered, b->bandwidth_estimate,
+        b->rtt, b->send_delay, b->nominal_max_rtt, b->alg_state, b->congestion_notified };
+
+    if (writer->nb_samples > 0) {
+        c4_column_write_block(writer, c4_column_table_sample, writer->nb_samples,
+            columns, c4_column_sample_widths, C4_COLUMN_NB_SAMPLE_COLUMNS);
+        writer->nb_samples = 0;
+    }
+}
+
+static void c4_column_flush_transitions(c4_column_writer_t* writer)
+{
+    c4_column_transition_block_t* b = &writer->transitions;
+    void const* columns[C4_COLUMN_NB_TRANSITION_COLUMNS] = {
+        b->current_time, b->nominal_rate, b->nominal_max_rtt, b->running_min_rtt, b->old_state, b->new_state };
+
+    if (writer->nb_transitions > 0) {
+        c4_column_write_block(writer, c4_column_table_transition, writer->nb_transitions,
+            columns, c4_column_transition_widths, C4_COLUMN_NB_TRANSITION_COLUMNS);
+        writer->nb_transitions = 0;
+    }
+}
+
+c4_column_writer_t* c4_column_open(char const* file_name)
+{
+    c4_column_writer_t* writer = (c4_column_writer_t*)malloc(sizeof(c4_column_writer_t));
+
+    if (writer != NULL) {
+        c4_column_header_t header;
+
+        memset(writer, 0, sizeof(c4_column_writer_t));
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, C4_COLUMN_MAGIC, sizeof(C4_COLUMN_MAGIC));
+        header.version = C4_COLUMN_VERSION;
+        header.byte_order = C4_COLUMN_BYTE_ORDER;
+        header.block_rows = C4_COLUMN_BLOCK_ROWS;
+        if ((writer->F = picoquic_file_open(file_name, "wb")) == NULL) {
+            free(writer);
+            writer = NULL;
+        }
+        else if (fwrite(&header, sizeof(header), 1, writer->F) != 1) {
+            writer->is_failed = 1;
+        }
+    }
+    return writer;
+}
+
+int c4_column_close(c4_column_writer_t* writer)
+{
+    int ret;
+
+    c4_column_flush_samples(writer);
+    c4_column_flush_transitions(writer);
+    ret = (writer->is_failed) ? -1 : 0;
+    (void)picoquic_file_close(writer->F);
+    free(writer);
+    return ret;
+}
+
+int c4_column_add_sample(c4_column_writer_t* writer, c4_column_sample_t const* sample)
+{
+    c4_column_sample_block_t* b = &writer->samples;
+    size_t i = writer->nb_samples;
+
+    b->current_time[i] = sample->current_time;
+    b->rate_measurement[i] = sample->rate_measurement;
+    b->nominal_rate[i] = sample->nominal_rate;
+    b->bytes_delivered[i] = sample->bytes_delivered;
+    b->bandwidth_estimate[i] = sample->bandwidth_estimate;
+    b->rtt[i] = sample->rtt;
+    b->send_delay[i] = sample->send_delay;
+    b->nominal_max_rtt[i] = sample->nominal_max_rtt;
+    b->alg_state[i] = sample->alg_state;
+    b->congestion_notified[i] = sample->congestion_notified;
+    if (++writer->nb_samples >= C4_COLUMN_BLOCK_ROWS) {
+        c4_column_flush_samples(writer);
+    }
+    return (writer->is_failed) ? -1 : 0;
+}
+
+int c4_column_add_transition(c4_column_writer_t* writer, c4_column_transition_t const* transition)
+{
+    c4_column_transition_block_t* b = &writer->transitions;
+    size_t i = writer->nb_transitions;
+
+    b->current_time[i] = transition->current_time;
+    b->nominal_rate[i] = transition->nominal_rate;
+    b->nominal_max_rtt[i] = transition->nominal_max_rtt;
+    b->running_min_rtt[i] = transition->running_min_rtt;
+    b->old_state[i] = transition->old_state;
+    b->new_state[i] = transition->new_state;
+    if (++writer->nb_transitions >= C4_COLUMN_BLOCK_ROWS) {
+        c4_column_flush_transitions(writer);
+    }
+    return (writer->is_failed) ? -1 : 0;
+}
+
+/* Map the whole file, read only. */
+#ifdef _WINDOWS
+static int c4_column_map(c4_column_reader_t* reader, char const* file_name)
+{
+    int ret = -1;
+    LARGE_INTEGER file_size;
+
+    reader->file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (reader->file == INVALID_HANDLE_VALUE) {
+        reader->file = NULL;
+    }
+    else if (GetFileSizeEx(reader->file, &file_size) && file_size.QuadPart >= (LONGLONG)sizeof(c4_column_header_t)) {
+        reader->size = (size_t)file_size.QuadPart;
+        reader->mapping = CreateFileMappingA(reader->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (reader->mapping != NULL &&
+            (reader->base = (uint8_t*)MapViewOfFile(reader->mapping, FILE_MAP_READ, 0, 0, reader->size)) != NULL) {
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+static void c4_column_unmap(c4_column_reader_t* reader)
+{
+    if (reader->base != NULL) {
+        (void)UnmapViewOfFile(reader->base);
+    }
+    if (reader->mapping != NULL) {
+        (void)CloseHandle(reader->mapping);
+    }
+    if (reader->file != NULL) {
+        (void)CloseHandle(reader->file);
+    }
+}
+#else
+static int c4_column_map(c4_column_reader_t* reader, char const* file_name)
+{
+    int ret = -1;
+    int fd;
+    struct stat st;
+
+    if ((fd = open(file_name, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(c4_column_header_t)) {
+        void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            reader->base = (uint8_t*)base;
+            reader->size = (size_t)st.st_size;
+#ifdef MADV_SEQUENTIAL
+            (void)madvise(base, reader->size, MADV_SEQUENTIAL);
+#endif
+            ret = 0;
+        }
+    }
+    /* The mapping remains valid after the file is closed */
+    (void)close(fd);
+    return ret;
+}
+
+static void c4_column_unmap(c4_column_reader_t* reader)
+{
+    if (reader->base != NULL) {
+        (void)munmap(reader->base, reader->size);
+    }
+}
+#endif
+
+static int c4_column_table_widths(uint32_t table, uint8_t const** widths, size_t* nb_columns)
+{
+    int ret = 0;
+
+    if (table == c4_column_table_sample) {
+        *widths = c4_column_sample_widths;
+        *nb_columns = C4_COLUMN_NB_SAMPLE_COLUMNS;
+    }
+    else if (table == c4_column_table_transition) {
+        *widths = c4_column_transition_widths;
+        *nb_columns = C4_COLUMN_NB_TRANSITION_COLUMNS;
+    }
+    else {
+        ret = -1;
+    }
+    return ret;
+}
+
+/* Check the header, and list the offsets of the complete blocks. */
+static int c4_column_index(c4_column_reader_t* reader)
+{
+    c4_column_header_t const* header = (c4_column_header_t const*)reader->base;
+    size_t offset = sizeof(c4_column_header_t);
+    size_t nb_blocks_max = 0;
+
+    if (memcmp(header->magic, C4_COLUMN_MAGIC, sizeof(C4_COLUMN_MAGIC)) != 0 ||
+        header->version != C4_COLUMN_VERSION || header->byte_order != C4_COLUMN_BYTE_ORDER) {
+        return -1;
+    }
+    while (offset + sizeof(c4_column_block_header_t) <= reader->size) {
+        c4_column_block_header_t const* block_header = (c4_column_block_header_t const*)(reader->base + offset);
+        uint8_t const* widths;
+        size_t nb_columns;
+        size_t block_size;
+
+        if (c4_column_table_widths(block_header->table, &widths, &nb_columns) != 0 ||
+            block_header->nb_rows == 0 || block_header->nb_rows > header->block_rows) {
+            return -1;
+        }
+        block_size = c4_column_block_size(widths, nb_columns, block_header->nb_rows);
+        if (offset + block_size > reader->size) {
+            break;
+        }
+        if (reader->nb_blocks >= nb_blocks_max) {
+            size_t new_max = (nb_blocks_max == 0) ? 64 : 2 * nb_blocks_max;
+            size_t* new_offsets = (size_t*)realloc(reader->block_offsets, new_max * sizeof(size_t));
+            if (new_offsets == NULL) {
+                return -1;
+            }
+            reader->block_offsets = new_offsets;
+            nb_blocks_max = new_max;
+        }
+        reader->block_offsets[reader->nb_blocks++] = offset;
+        offset += block_size;
+    }
+    return 0;
+}
+
+c4_column_reader_t* c4_column_reader_open(char const* file_name)
+{
+    c4_column_reader_t* reader = (c4_column_reader_t*)malloc(sizeof(c4_column_reader_t));
+
+    if (reader != NULL) {
+        memset(reader, 0, sizeof(c4_column_reader_t));
+        if (c4_column_map(reader, file_name) != 0 || c4_column_index(reader) != 0) {
+            c4_column_reader_close(reader);
+            reader = NULL;
+        }
+    }
+    return reader;
+}
+
+void c4_column_reader_close(c4_column_reader_t* reader)
+{
+    if (reader != NULL) {
+        c4_column_unmap(reader);
+        if (reader->block_offsets != NULL) {
+            free(reader->block_offsets);
+        }
+        free(reader);
+    }
+}
+
+size_t c4_column_reader_nb_blocks(c4_column_reader_t* reader)
+{
+    return reader->nb_blocks;
+}
+
+int c4_column_reader_get_block(c4_column_reader_t* reader, size_t block_index, c4_column_block_t* block)
+{
+    c4_column_block_header_t const* block_header;
+    uint8_t const* widths = NULL;
+    size_t nb_columns = 0;
+    void const* columns[C4_COLUMN_NB_COLUMNS_MAX];
+    uint8_t const* column;
+
+    if (block_index >= reader->nb_blocks) {
+        return -1;
+    }
+    block_header = (c4_column_block_header_t const*)(reader->base + reader->block_offsets[block_index]);
+    /* The table was checked when indexing the file */
+    (void)c4_column_table_widths(block_header->table, &widths, &nb_columns);
+    column = (uint8_t const*)(block_header + 1);
+    for (size_t i = 0; i < nb_columns; i++) {
+        columns[i] = column;
+        column += c4_column_padded(widths[i] * (size_t)block_header->nb_rows);
+    }
+    memset(block, 0, sizeof(c4_column_block_t));
+    block->table = (c4_column_table_enum)block_header->table;
+    block->nb_rows = block_header->nb_rows;
+    if (block->table == c4_column_table_sample) {
+        block->sample.current_time = (uint64_t const*)columns[0];
+        block->sample.rate_measurement = (uint64_t const*)columns[1];
+        block->sample.nominal_rate = (uint64_t const*)columns[2];
+        block->sample.bytes_delivered = (uint64_t const*)columns[3];
+        block->sample.bandwidth_estimate = (uint64_t const*)columns[4];
+        block->sample.rtt = (uint32_t const*)columns[5];
+        block->sample.send_delay = (uint32_t const*)columns[6];
+        block->sample.nominal_max_rtt = (uint32_t const*)columns[7];
+        block->sample.alg_state = (uint8_t const*)columns[8];
+        block->sample.congestion_notified = (uint8_t const*)columns[9];
+    }
+    else {
+        block->transition.current_time = (uint64_t const*)columns[0];
+        block->transition.nominal_rate = (uint64_t const*)columns[1];
+        block->transition.nominal_max_rtt = (uint32_t const*)columns[2];
+        block->transition.running_min_rtt = (uint32_t const*)columns[3];
+        block->transition.old_state = (uint8_t const*)columns[4];
+        block->transition.new_state = (uint8_t const*)columns[5];
+    }
+    return 0;
+}
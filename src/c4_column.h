@@ -0,0 +1,108 @@
+/*
+Columnar trace of the rate samples and state transitions of C4
+*/
+
+#ifndef C4_COLUMN_H
+#define C4_COLUMN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C4_COLUMN_MAGIC "C4COL"
+#define C4_COLUMN_VERSION 1
+#define C4_COLUMN_BYTE_ORDER 0x01020304
+#define C4_COLUMN_BLOCK_ROWS 1024
+
+    typedef enum {
+        c4_column_table_sample = 1,
+        c4_column_table_transition = 2
+    } c4_column_table_enum;
+
+    /* One row per ACK that carries a rate sample. Times and delays are in
+    * microseconds, rates in bytes per second.
+     */
+    typedef struct st_c4_column_sample_t {
+        uint64_t current_time;
+        uint64_t rate_measurement;
+        uint64_t nominal_rate;
+        uint64_t bytes_delivered;
+        uint64_t bandwidth_estimate;
+        uint32_t rtt;
+        uint32_t send_delay;
+        uint32_t nominal_max_rtt;
+        uint8_t alg_state;
+        uint8_t congestion_notified;
+    } c4_column_sample_t;
+
+    /* One row per change of state, with the estimates at the time of the change. */
+    typedef struct st_c4_column_transition_t {
+        uint64_t current_time;
+        uint64_t nominal_rate;
+        uint32_t nominal_max_rtt;
+        uint32_t running_min_rtt;
+        uint8_t old_state;
+        uint8_t new_state;
+    } c4_column_transition_t;
+
+    typedef struct st_c4_column_writer_t c4_column_writer_t;
+
+    /* Writer, used by C4 when the columnar trace is enabled.
+    * Rows are buffered per table, and each table is written to the file
+    * as a block of columns when C4_COLUMN_BLOCK_ROWS rows are buffered,
+    * or when the writer is closed. The functions return -1 if the file
+    * cannot be written.
+     */
+    c4_column_writer_t* c4_column_open(char const* file_name);
+    int c4_column_close(c4_column_writer_t* writer);
+    int c4_column_add_sample(c4_column_writer_t* writer, c4_column_sample_t const* sample);
+    int c4_column_add_transition(c4_column_writer_t* writer, c4_column_transition_t const* transition);
+
+    /* Reader. The file is mapped in memory, and the columns of a block
+    * point directly into the mapping, so they remain valid until the
+    * reader is closed. Only the pointers of the table of the block are set.
+     */
+    typedef struct st_c4_column_block_t {
+        c4_column_table_enum table;
+        size_t nb_rows;
+        struct {
+            uint64_t const* current_time;
+            uint64_t const* rate_measurement;
+            uint64_t const* nominal_rate;
+            uint64_t const* bytes_delivered;
+            uint64_t const* bandwidth_estimate;
+            uint32_t const* rtt;
+            uint32_t const* send_delay;
+            uint32_t const* nominal_max_rtt;
+            uint8_t const* alg_state;
+            uint8_t const* congestion_notified;
+        } sample;
+        struct {
+            uint64_t const* current_time;
+            uint64_t const* nominal_rate;
+            uint32_t const* nominal_max_rtt;
+            uint32_t const* running_min_rtt;
+            uint8_t const* old_state;
+            uint8_t const* new_state;
+        } transition;
+    } c4_column_block_t;
+
+    typedef struct st_c4_column_reader_t c4_column_reader_t;
+
+    /* Returns NULL if the file cannot be mapped or does not start with a
+    * valid header. A block cut short at the end of the file, for example
+    * if the writing process was killed, is ignored.
+     */
+    c4_column_reader_t* c4_column_reader_open(char const* file_name);
+    void c4_column_reader_close(c4_column_reader_t* reader);
+    size_t c4_column_reader_nb_blocks(c4_column_reader_t* reader);
+    /* Returns 0 and fills the block, or -1 if the index is out of range. */
+    int c4_column_reader_get_block(c4_column_reader_t* reader, size_t block_index, c4_column_block_t* block);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,296 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Reader of the columnar trace files written by C4 with the option 'B',
+* or after setting a trace directory. The files are mapped in memory and
+* read column by column, so summaries of large sets of files only touch
+* the columns that they use. The samples and transitions can also be
+* written to CSV files, for graphs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "c4_column.h"
+
+#ifdef _WINDOWS
+#include "../pico_sim_vs/pico_sim_vs/getopt.h"
+#else
+#include <unistd.h>
+#endif
+
+#define C4_COLUMNS_NB_STATES 8
+
+static char const* columns_state_names[C4_COLUMNS_NB_STATES] = {
+    "initial", "recovery", "cruising", "pushing",
+    "cr_reconnaissance", "cr_unvalidated", "cr_validating", "cr_safe_retreat" };
+
+typedef struct st_columns_summary_t {
+    uint64_t nb_samples;
+    uint64_t nb_transitions;
+    uint64_t first_time;
+    uint64_t last_time;
+    uint64_t rate_sum;
+    uint64_t rate_max;
+    uint64_t last_nominal_rate;
+    uint64_t rtt_sum;
+    uint32_t rtt_min;
+    uint32_t rtt_max;
+    uint64_t last_transition_time;
+    uint8_t current_state;
+    uint64_t nb_state_entries[C4_COLUMNS_NB_STATES];
+    uint64_t time_in_state[C4_COLUMNS_NB_STATES];
+} columns_summary_t;
+
+void usage()
+{
+    fprintf(stderr, "C4_columns, reader of the columnar trace files written by C4\n\n");
+    fprintf(stderr, "Usage: c4_columns [options] trace_file [trace_file ...]\n\n");
+    fprintf(stderr, "Prints a summary of each file: number of samples, rate and RTT\n");
+    fprintf(stderr, "statistics, and share of time in each state.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -s file    Write the rate samples of all the trace files to a CSV file.\n");
+    fprintf(stderr, "  -t file    Write the state transitions of all the trace files to a CSV file.\n");
+    fprintf(stderr, "             The first column of the CSV files is the index of the trace\n");
+    fprintf(stderr, "             file in the list of arguments, starting at 0.\n");
+    fprintf(stderr, "  -q         Do not print the summaries.\n");
+    fprintf(stderr, "  -h         Print this message.\n");
+}
+
+static void columns_summarize_samples(columns_summary_t* summary, c4_column_block_t const* block)
+{
+    size_t n = block->nb_rows;
+    uint64_t const* rate = block->sample.rate_measurement;
+    uint32_t const* rtt = block->sample.rtt;
+
+    if (summary->nb_samples == 0 && summary->nb_transitions == 0) {
+        summary->first_time = block->sample.current_time[0];
+    }
+    else if (block->sample.current_time[0] < summary->first_time) {
+        summary->first_time = block->sample.current_time[0];
+    }
+    if (block->sample.current_time[n - 1] > summary->last_time) {
+        summary->last_time = block->sample.current_time[n - 1];
+    }
+    for (size_t i = 0; i < n; i++) {
+        summary->rate_sum += rate[i];
+        if (rate[i] > summary->rate_max) {
+            summary->rate_max = rate[i];
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        summary->rtt_sum += rtt[i];
+        if (rtt[i] < summary->rtt_min) {
+            summary->rtt_min = rtt[i];
+        }
+        if (rtt[i] > summary->rtt_max) {
+            summary->rtt_max = rtt[i];
+        }
+    }
+    summary->last_nominal_rate = block->sample.nominal_rate[n - 1];
+    summary->nb_samples += n;
+}
+
+static void columns_summarize_transitions(columns_summary_t* summary, c4_column_block_t const* block)
+{
+    for (size_t i = 0; i < block->nb_rows; i++) {
+        uint64_t t = block->transition.current_time[i];
+        uint8_t old_state = block->transition.old_state[i] & (C4_COLUMNS_NB_STATES - 1);
+        uint8_t new_state = block->transition.new_state[i] & (C4_COLUMNS_NB_STATES - 1);
+
+        if (summary->nb_samples == 0 && summary->nb_transitions == 0) {
+            summary->first_time = t;
+            summary->last_transition_time = t;
+        }
+        else if (summary->nb_transitions == 0) {
+            /* The path was in the old state since the first sample */
+            summary->last_transition_time = summary->first_time;
+        }
+        if (t > summary->last_transition_time) {
+            summary->time_in_state[old_state] += t - summary->last_transition_time;
+            summary->last_transition_time = t;
+        }
+        if (t > summary->last_time) {
+            summary->last_time = t;
+        }
+        summary->nb_state_entries[new_state]++;
+        summary->current_state = new_state;
+        summary->nb_transitions++;
+    }
+}
+
+static void columns_write_samples(FILE* F, int file_index, c4_column_block_t const* block)
+{
+    for (size_t i = 0; i < block->nb_rows; i++) {
+        fprintf(F, "%d, %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %u, %u, %u, %d, %" PRIu64 ", %d\n",
+            file_index, block->sample.current_time[i], block->sample.rate_measurement[i],
+            block->sample.nominal_rate[i], block->sample.bytes_delivered[i],
+            block->sample.rtt[i], block->sample.send_delay[i], block->sample.nominal_max_rtt[i],
+            (int)block->sample.alg_state[i], block->sample.bandwidth_estimate[i],
+            (int)block->sample.congestion_notified[i]);
+    }
+}
+
+static void columns_write_transitions(FILE* F, int file_index, c4_column_block_t const* block)
+{
+    for (size_t i = 0; i < block->nb_rows; i++) {
+        fprintf(F, "%d, %" PRIu64 ", %d, %d, %" PRIu64 ", %u, %u\n",
+            file_index, block->transition.current_time[i],
+            (int)block->transition.old_state[i], (int)block->transition.new_state[i],
+            block->transition.nominal_rate[i], block->transition.nominal_max_rtt[i],
+            block->transition.running_min_rtt[i]);
+    }
+}
+
+static void columns_print_summary(char const* file_name, columns_summary_t* summary)
+{
+    uint64_t duration = summary->last_time - summary->first_time;
+
+    printf("%s: %" PRIu64 " samples, %" PRIu64 " transitions, %.3f s\n",
+        file_name, summary->nb_samples, summary->nb_transitions, ((double)duration) / 1000000.0);
+    if (summary->nb_samples > 0) {
+        printf("  rate: mean %" PRIu64 ", max %" PRIu64 ", last nominal %" PRIu64 " bytes/s\n",
+            summary->rate_sum / summary->nb_samples, summary->rate_max, summary->last_nominal_rate);
+        printf("  rtt: min %u, mean %" PRIu64 ", max %u us\n",
+            summary->rtt_min, summary->rtt_sum / summary->nb_samples, summary->rtt_max);
+    }
+    if (summary->nb_transitions > 0 && duration > 0) {
+        /* Account for the time in the last state, until the end of the trace */
+        if (summary->last_time > summary->last_transition_time) {
+            summary->time_in_state[summary->current_state] += summary->last_time - summary->last_transition_time;
+        }
+        printf("  states:");
+        for (int i = 0; i < C4_COLUMNS_NB_STATES; i++) {
+            if (summary->time_in_state[i] > 0 || summary->nb_state_entries[i] > 0) {
+                printf(" %s %.1f%% (%" PRIu64 ")", columns_state_names[i],
+                    100.0 * ((double)summary->time_in_state[i]) / ((double)duration), summary->nb_state_entries[i]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+static int columns_read_file(char const* file_name, int file_index, FILE* F_samples, FILE* F_transitions, int quiet)
+{
+    int ret = 0;
+    c4_column_reader_t* reader = c4_column_reader_open(file_name);
+
+    if (reader == NULL) {
+        fprintf(stderr, "Cannot read trace file <%s>\n", file_name);
+        ret = -1;
+    }
+    else {
+        columns_summary_t summary;
+        size_t nb_blocks = c4_column_reader_nb_blocks(reader);
+        c4_column_block_t block;
+
+        memset(&summary, 0, sizeof(summary));
+        summary.rtt_min = UINT32_MAX;
+        for (size_t i = 0; i < nb_blocks && c4_column_reader_get_block(reader, i, &block) == 0; i++) {
+            if (block.table == c4_column_table_sample) {
+                columns_summarize_samples(&summary, &block);
+                if (F_samples != NULL) {
+                    columns_write_samples(F_samples, file_index, &block);
+                }
+            }
+            else {
+                columns_summarize_transitions(&summary, &block);
+                if (F_transitions != NULL) {
+                    columns_write_transitions(F_transitions, file_index, &block);
+                }
+            }
+        }
+        if (!quiet) {
+            columns_print_summary(file_name, &summary);
+        }
+        c4_column_reader_close(reader);
+    }
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    char const* samples_file = NULL;
+    char const* transitions_file = NULL;
+    FILE* F_samples = NULL;
+    FILE* F_transitions = NULL;
+    int quiet = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:t:qh")) != -1) {
+        switch (opt) {
+        case 's':
+            samples_file = optarg;
+            break;
+        case 't':
+            transitions_file = optarg;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Expected at least one trace file.\n");
+        usage();
+        ret = -1;
+    }
+    else if (samples_file != NULL && (F_samples = picoquic_file_open(samples_file, "w")) == NULL) {
+        fprintf(stderr, "Cannot open file <%s>\n", samples_file);
+        ret = -1;
+    }
+    else if (transitions_file != NULL && (F_transitions = picoquic_file_open(transitions_file, "w")) == NULL) {
+        fprintf(stderr, "Cannot open file <%s>\n", transitions_file);
+        ret = -1;
+    }
+    else {
+        if (F_samples != NULL) {
+            fprintf(F_samples, "file, time, rate, n-rate, bytes, rtt, send-delay, nominal-rtt, state, path-bw, is_cc\n");
+        }
+        if (F_transitions != NULL) {
+            fprintf(F_transitions, "file, time, old-state, new-state, n-rate, nominal-rtt, min-rtt\n");
+        }
+        for (int i = optind; i < argc; i++) {
+            if (columns_read_file(argv[i], i - optind, F_samples, F_transitions, quiet) != 0) {
+                ret = -1;
+            }
+        }
+    }
+    if (F_samples != NULL) {
+        F_samples = picoquic_file_close(F_samples);
+    }
+    if (F_transitions != NULL) {
+        F_transitions = picoquic_file_close(F_transitions);
+    }
+    return ret;
+}
@@ -60,6 +60,9 @@ static const int default_server_port = 4443;
 static const char* default_server_name = "::";
 static const char* ticket_store_filename = "demo_ticket_store.bin";
 static const char* token_store_filename = "demo_token_store.bin";
+static const size_t estimate_cache_size = 4096;
+static const size_t estimate_store_size = 65536;
+static const int estimate_store_default_ttl = 86400;
 
 
 #include "picoquic.h"
@@ -85,6 +88,7 @@ static const char* token_store_filename = "demo_token_store.bin";
 #endif
 #include "picoquic_register_cc_algo.h"
 #include "c4.h"
+#include "c4_stats.h"
 
 void print_address(FILE* F_log, struct sockaddr* address, char* label, picoquic_connection_id_t cnx_id)
 {
@@ -268,7 +272,98 @@ int demoserver_post_callback(picoquic_cnx_t* cnx,
     return ret;
 }
 
-picohttp_server_path_item_t path_item_list[2] =
+/* Serve the statistics of the C4 paths in the Prometheus exposition format,
+ * at "/c4stats". The text is formatted when the GET is received, from the
+ * live paths of the server context, and from the paths of the process
+ * closed since the start and in the last minute.
+ */
+#define C4STATS_TEXT_MAX 16384
+
+typedef struct st_c4stats_ctx_t {
+    size_t nb_sent;
+    size_t response_length;
+    char text[C4STATS_TEXT_MAX];
+} c4stats_ctx_t;
+
+int c4stats_callback(picoquic_cnx_t* cnx,
+    uint8_t* bytes, size_t length,
+    picohttp_call_back_event_t event, h3zero_stream_ctx_t* stream_ctx,
+    void* callback_ctx)
+{
+    int ret = 0;
+    c4stats_ctx_t* ctx = (c4stats_ctx_t*)stream_ctx->path_callback_ctx;
+
+    switch (event) {
+    case picohttp_callback_get: /* Received a get command */
+        if (ctx == NULL) {
+            c4_stats_t live;
+            c4_stats_t closed;
+            c4_stats_t recent_closed;
+            uint64_t current_time = picoquic_get_quic_time(picoquic_get_quic_ctx(cnx));
+
+            ctx = (c4stats_ctx_t*)malloc(sizeof(c4stats_ctx_t));
+            if (ctx == NULL) {
+                return -1;
+            }
+            memset(ctx, 0, sizeof(c4stats_ctx_t));
+            stream_ctx->path_callback_ctx = (void*)ctx;
+            memset(&live, 0, sizeof(c4_stats_t));
+            memset(&closed, 0, sizeof(c4_stats_t));
+            (void)c4_stats_collect(&live, picoquic_get_quic_ctx(cnx));
+            if (c4_stats_format_prometheus(&live, (c4_stats_get_closed(&closed) == 0) ? &closed : NULL,
+                (c4_stats_get_recent_closed(&recent_closed, current_time) == 0) ? &recent_closed : NULL,
+                ctx->text, sizeof(ctx->text), &ctx->response_length) != 0) {
+                ret = -1;
+            }
+        }
+        else {
+            /* unexpected. Should not have a context here */
+            ret = -1;
+        }
+        break;
+    case picohttp_callback_provide_data:
+        if (ctx == NULL || ctx->nb_sent > ctx->response_length) {
+            ret = -1;
+        }
+        else
+        {
+            uint8_t* buffer;
+            size_t available = ctx->response_length - ctx->nb_sent;
+            int is_fin = 1;
+
+            if (available > length) {
+                available = length;
+                is_fin = 0;
+            }
+
+            buffer = picoquic_provide_stream_data_buffer(bytes, available, is_fin, !is_fin);
+            if (buffer != NULL) {
+                memcpy(buffer, ctx->text + ctx->nb_sent, available);
+                ctx->nb_sent += available;
+                ret = 0;
+            }
+            else {
+                ret = -1;
+            }
+        }
+        break;
+    case picohttp_callback_reset: /* stream is abandoned */
+        stream_ctx->path_callback = NULL;
+        stream_ctx->path_callback_ctx = NULL;
+
+        if (ctx != NULL) {
+            free(ctx);
+        }
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
+picohttp_server_path_item_t path_item_list[3] =
 {
     {
         "/post",
@@ -281,6 +376,12 @@ picohttp_server_path_item_t path_item_list[2] =
         6,
         wt_baton_callback,
         NULL
+    },
+    {
+        "/c4stats",
+        8,
+        c4stats_callback,
+        NULL
     }
 };
 
@@ -296,7 +397,7 @@ int quic_server(const char* server_name, picoquic_quic_config_t* config, int jus
     memset(&picoquic_file_param, 0, sizeof(picohttp_server_parameters_t));
     picoquic_file_param.web_folder = config->www_dir;
     picoquic_file_param.path_table = path_item_list;
-    picoquic_file_param.path_table_nb = 2;
+    picoquic_file_param.path_table_nb = 3;
 
     memset(&loop_cb_ctx, 0, sizeof(server_loop_cb_t));
     loop_cb_ctx.just_once = just_once;
@@ -1318,6 +1419,14 @@ void usage()
     fprintf(stderr, "                        -f 3  test migration to new address.\n");
     fprintf(stderr, "  -u nb                 trigger key update after receiving <nb> packets on client\n");
     fprintf(stderr, "  -1                    Once: close the server after processing 1 connection.\n");
+    fprintf(stderr, "  -y dir                Record the notifications of the C4 paths in the\n");
+    fprintf(stderr, "                        directory, for replay with c4_replay.\n");
+    fprintf(stderr, "  -Y seconds            Keep the C4 estimates of closed paths per peer prefix\n");
+    fprintf(stderr, "                        for <seconds>, and use them to seed new connections\n");
+    fprintf(stderr, "                        if careful resume is enabled with C4 option U.\n");
+    fprintf(stderr, "  -Z file               Also keep the C4 estimates in a store file, which survives\n");
+    fprintf(stderr, "                        restarts and can be shared by several servers. Records\n");
+    fprintf(stderr, "                        expire after the -Y duration, or after one day.\n");
 
     fprintf(stderr, "\nThe scenario argument specifies the set of files that should be retrieved,\n");
     fprintf(stderr, "and their order. The syntax is:\n");
@@ -1350,6 +1459,8 @@ int main(int argc, char** argv)
     int force_migration = 0;
     int just_once = 0;
     int is_client = 0;
+    int estimate_cache_ttl = 0;
+    char const* estimate_store_file = NULL;
     int ret;
 
 #ifdef _WINDOWS
@@ -1363,8 +1474,8 @@ int main(int argc, char** argv)
     }
     else {
         picoquic_config_init(&config);
-        memcpy(option_string, "A:u:f:1", 7);
-        ret = picoquic_config_option_letters(option_string + 7, sizeof(option_string) - 7, NULL);
+        memcpy(option_string, "A:u:f:1y:Y:Z:", 13);
+        ret = picoquic_config_option_letters(option_string + 13, sizeof(option_string) - 13, NULL);
     }
 
     if (ret == 0) {
@@ -1387,6 +1498,21 @@ int main(int argc, char** argv)
             case '1':
                 just_once = 1;
                 break;
+            case 'y':
+                if (c4_set_record_directory(optarg) != 0) {
+                    fprintf(stderr, "Invalid record directory: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'Y':
+                if ((estimate_cache_ttl = atoi(optarg)) <= 0) {
+                    fprintf(stderr, "Invalid cache duration: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'Z':
+                estimate_store_file = optarg;
+                break;
             case 'A':
                 config.multipath_alt_config = malloc(sizeof(char) * (strlen(optarg) + 1));
                 if (config.multipath_alt_config != NULL) {
@@ -1424,7 +1550,21 @@ int main(int argc, char** argv)
         usage();
     }
 
+    if (estimate_cache_ttl > 0 &&
+        c4_set_estimate_cache(estimate_cache_size, ((uint64_t)estimate_cache_ttl) * 1000000) != 0) {
+        fprintf(stderr, "Could not allocate the C4 estimate cache.\n");
+    }
+
+    if (estimate_store_file != NULL &&
+        c4_set_estimate_store(estimate_store_file, estimate_store_size,
+            ((uint64_t)((estimate_cache_ttl > 0) ? estimate_cache_ttl : estimate_store_default_ttl)) * 1000000) != 0) {
+        fprintf(stderr, "Could not open the C4 estimate store: %s\n", estimate_store_file);
+    }
+
     if (is_client == 0) {
+        if (c4_stats_enable_closed() != 0) {
+            fprintf(stderr, "Could not enable the C4 statistics of closed paths.\n");
+        }
         if (config.server_port == 0) {
             config.server_port = server_port;
         }
@@ -1456,5 +1596,8 @@ int main(int argc, char** argv)
         printf("Client exit with code = %d\n", ret);
     }
 
+    c4_stats_disable_closed();
+    c4_release_estimate_store();
+    c4_release_estimate_cache();
     picoquic_config_clear(&config);
 }
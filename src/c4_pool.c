@@ -0,0 +1,152 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "c4_pool.h"
+
+/* The pool allocates memory in chunks. Each chunk starts with a header,
+* padded to a cache line, followed by the slots. The chunk memory is
+* over allocated so that the first slot can be aligned on a cache line.
+* Free slots are chained through their first bytes.
+ */
+typedef struct st_c4_pool_chunk_t {
+    struct st_c4_pool_chunk_t* next_chunk;
+    void* raw_memory;
+} c4_pool_chunk_t;
+
+typedef struct st_c4_pool_free_slot_t {
+    struct st_c4_pool_free_slot_t* next_free;
+} c4_pool_free_slot_t;
+
+struct st_c4_pool_t {
+    size_t slot_size;
+    size_t nb_slots_per_chunk;
+    c4_pool_chunk_t* first_chunk;
+    c4_pool_free_slot_t* first_free;
+    uint64_t nb_live_slots;
+    uint64_t nb_peak_slots;
+    uint64_t nb_bytes;
+    int is_deleted;
+};
+
+#define C4_POOL_ROUND_UP(x) ((((x) + C4_POOL_CACHE_LINE - 1)/C4_POOL_CACHE_LINE)*C4_POOL_CACHE_LINE)
+
+c4_pool_t* c4_pool_create(size_t slot_size, size_t nb_slots_per_chunk)
+{
+    c4_pool_t* pool = NULL;
+
+    if (slot_size > 0 && nb_slots_per_chunk > 0 &&
+        (pool = (c4_pool_t*)malloc(sizeof(c4_pool_t))) != NULL) {
+        memset(pool, 0, sizeof(c4_pool_t));
+        pool->slot_size = C4_POOL_ROUND_UP(slot_size);
+        pool->nb_slots_per_chunk = nb_slots_per_chunk;
+    }
+    return pool;
+}
+
+static int c4_pool_add_chunk(c4_pool_t* pool)
+{
+    int ret = 0;
+    size_t header_size = C4_POOL_ROUND_UP(sizeof(c4_pool_chunk_t));
+    size_t alloc_size = header_size + pool->nb_slots_per_chunk * pool->slot_size + C4_POOL_CACHE_LINE - 1;
+    uint8_t* raw_memory = (uint8_t*)malloc(alloc_size);
+
+    if (raw_memory == NULL) {
+        ret = -1;
+    }
+    else {
+        uintptr_t aligned = ((uintptr_t)raw_memory + C4_POOL_CACHE_LINE - 1) & ~((uintptr_t)C4_POOL_CACHE_LINE - 1);
+        c4_pool_chunk_t* chunk = (c4_pool_chunk_t*)aligned;
+        uint8_t* slots = (uint8_t*)aligned + header_size;
+
+        chunk->raw_memory = raw_memory;
+        chunk->next_chunk = pool->first_chunk;
+        pool->first_chunk = chunk;
+        /* Chain the slots in the free list, in address order */
+        for (size_t i = pool->nb_slots_per_chunk; i > 0; i--) {
+            c4_pool_free_slot_t* slot = (c4_pool_free_slot_t*)(slots + (i - 1) * pool->slot_size);
+            slot->next_free = pool->first_free;
+            pool->first_free = slot;
+        }
+        pool->nb_bytes += alloc_size;
+    }
+    return ret;
+}
+
+void* c4_pool_alloc(c4_pool_t* pool)
+{
+    c4_pool_free_slot_t* slot = NULL;
+
+    if (!pool->is_deleted && (pool->first_free != NULL || c4_pool_add_chunk(pool) == 0)) {
+        slot = pool->first_free;
+        pool->first_free = slot->next_free;
+        pool->nb_live_slots++;
+        if (pool->nb_live_slots > pool->nb_peak_slots) {
+            pool->nb_peak_slots = pool->nb_live_slots;
+        }
+    }
+    return (void*)slot;
+}
+
+static void c4_pool_release(c4_pool_t* pool)
+{
+    while (pool->first_chunk != NULL) {
+        c4_pool_chunk_t* chunk = pool->first_chunk;
+        pool->first_chunk = chunk->next_chunk;
+        free(chunk->raw_memory);
+    }
+    free(pool);
+}
+
+void c4_pool_free(c4_pool_t* pool, void* slot)
+{
+    c4_pool_free_slot_t* free_slot = (c4_pool_free_slot_t*)slot;
+
+    free_slot->next_free = pool->first_free;
+    pool->first_free = free_slot;
+    pool->nb_live_slots--;
+    if (pool->is_deleted && pool->nb_live_slots == 0) {
+        c4_pool_release(pool);
+    }
+}
+
+void c4_pool_get_stats(c4_pool_t* pool, c4_pool_stats_t* stats)
+{
+    stats->nb_live_slots = pool->nb_live_slots;
+    stats->nb_peak_slots = pool->nb_peak_slots;
+    stats->nb_bytes = pool->nb_bytes;
+}
+
+size_t c4_pool_slot_size(c4_pool_t* pool)
+{
+    return pool->slot_size;
+}
+
+void c4_pool_delete(c4_pool_t* pool)
+{
+    if (pool->nb_live_slots == 0) {
+        c4_pool_release(pool);
+    }
+    else {
+        pool->is_deleted = 1;
+    }
+}
@@ -0,0 +1,44 @@
+/*
+Slab allocator for fixed size objects such as the C4 path state
+*/
+
+#ifndef C4_POOL_H
+#define C4_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C4_POOL_CACHE_LINE 64
+
+    typedef struct st_c4_pool_t c4_pool_t;
+
+    typedef struct st_c4_pool_stats_t {
+        uint64_t nb_live_slots; /* Slots currently allocated */
+        uint64_t nb_peak_slots; /* Largest number of slots allocated at the same time */
+        uint64_t nb_bytes; /* Bytes of memory held by the pool */
+    } c4_pool_stats_t;
+
+    /* Slots are rounded up to a multiple of the cache line size, and
+    * allocated from cache aligned chunks of nb_slots_per_chunk slots.
+    * Freed slots are kept in a free list and reused. Chunks are only
+    * released when the pool is deleted. The pool is not thread safe,
+    * and is meant to be used by a single network thread.
+     */
+    c4_pool_t* c4_pool_create(size_t slot_size, size_t nb_slots_per_chunk);
+    void* c4_pool_alloc(c4_pool_t* pool);
+    void c4_pool_free(c4_pool_t* pool, void* slot);
+    void c4_pool_get_stats(c4_pool_t* pool, c4_pool_stats_t* stats);
+    size_t c4_pool_slot_size(c4_pool_t* pool);
+    /* Delete the pool. If slots are still allocated, the deletion
+    * is deferred until the last of them is freed.
+     */
+    void c4_pool_delete(c4_pool_t* pool);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,420 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "picoquic_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "cc_common.h"
+#include "c4_record.h"
+
+/* Record file format.
+* The file starts with the magic string "C4REC" followed by a version byte.
+* Each record starts with a type byte and the difference between the
+* current time and the time of the previous record, zigzag encoded.
+* All integers are then encoded as variable length integers, 7 bits per
+* byte, low order bits first, with the high bit set if more bytes follow.
+* - init: option string length (one byte) and bytes, path, decision.
+* - notify: notification, has_ack_state byte, ack state if present, path, decision.
+* - batch: number of ack states, ack states, path, decision.
+* - delete: no content.
+* - hint: expected rate and burst size, path, decision.
+* The ack state is encoded as 9 integers followed by a flags byte.
+ */
+#define C4_RECORD_BUFFER_SIZE 0x10000
+#define C4_RECORD_MAX_INT_SIZE 10
+
+struct st_c4_record_t {
+    FILE* F;
+    uint64_t last_time;
+    size_t buffer_used;
+    int is_failed;
+    uint8_t buffer[C4_RECORD_BUFFER_SIZE];
+};
+
+struct st_c4_record_reader_t {
+    FILE* F;
+    uint64_t last_time;
+    size_t nb_ack_states_max;
+    picoquic_per_ack_state_t* ack_states;
+};
+
+static void c4_record_flush(c4_record_t* recorder)
+{
+    if (recorder->buffer_used > 0 && !recorder->is_failed) {
+        if (fwrite(recorder->buffer, 1, recorder->buffer_used, recorder->F) != recorder->buffer_used) {
+            recorder->is_failed = 1;
+        }
+    }
+    recorder->buffer_used = 0;
+}
+
+static void c4_record_put_byte(c4_record_t* recorder, uint8_t b)
+{
+    if (recorder->buffer_used >= C4_RECORD_BUFFER_SIZE) {
+        c4_record_flush(recorder);
+    }
+    recorder->buffer[recorder->buffer_used++] = b;
+}
+
+static void c4_record_put_int(c4_record_t* recorder, uint64_t v)
+{
+    if (recorder->buffer_used + C4_RECORD_MAX_INT_SIZE > C4_RECORD_BUFFER_SIZE) {
+        c4_record_flush(recorder);
+    }
+    while (v >= 0x80) {
+        recorder->buffer[recorder->buffer_used++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    recorder->buffer[recorder->buffer_used++] = (uint8_t)v;
+}
+
+static void c4_record_put_ack_state(c4_record_t* recorder, picoquic_per_ack_state_t const* ack_state)
+{
+    c4_record_put_int(recorder, ack_state->rtt_measurement);
+    c4_record_put_int(recorder, ack_state->one_way_delay);
+    c4_record_put_int(recorder, ack_state->send_delay);
+    c4_record_put_int(recorder, ack_state->nb_bytes_acknowledged);
+    c4_record_put_int(recorder, ack_state->nb_bytes_newly_lost);
+    c4_record_put_int(recorder, ack_state->nb_bytes_lost_since_packet_sent);
+    c4_record_put_int(recorder, ack_state->nb_bytes_delivered_since_packet_sent);
+    c4_record_put_int(recorder, ack_state->inflight_prior);
+    c4_record_put_int(recorder, ack_state->lost_packet_number);
+    c4_record_put_byte(recorder, (uint8_t)(ack_state->is_app_limited | (ack_state->is_cwnd_limited << 1)));
+}
+
+c4_record_t* c4_record_open(char const* file_name)
+{
+    c4_record_t* recorder = (c4_record_t*)malloc(sizeof(c4_record_t));
+
+    if (recorder != NULL) {
+        memset(recorder, 0, sizeof(c4_record_t));
+        if ((recorder->F = picoquic_file_open(file_name, "wb")) == NULL) {
+            free(recorder);
+            recorder = NULL;
+        }
+        else {
+            memcpy(recorder->buffer, C4_RECORD_MAGIC, strlen(C4_RECORD_MAGIC));
+            recorder->buffer_used = strlen(C4_RECORD_MAGIC);
+            recorder->buffer[recorder->buffer_used++] = C4_RECORD_VERSION;
+        }
+    }
+    return recorder;
+}
+
+void c4_record_close(c4_record_t* recorder)
+{
+    c4_record_flush(recorder);
+    (void)picoquic_file_close(recorder->F);
+    free(recorder);
+}
+
+void c4_record_capture_path(c4_record_event_t* ev, picoquic_cnx_t* cnx, picoquic_path_t* path_x)
+{
+    picoquic_packet_context_t* pkt_ctx;
+
+    ev->path.rtt_sample = path_x->rtt_sample;
+    ev->path.smoothed_rtt = path_x->smoothed_rtt;
+    ev->path.rtt_min = path_x->rtt_min;
+    ev->path.peak_bandwidth_estimate = path_x->peak_bandwidth_estimate;
+    ev->path.bandwidth_estimate = path_x->bandwidth_estimate;
+    ev->path.bytes_in_transit = path_x->bytes_in_transit;
+    ev->path.last_time_acked_data_frame_sent = path_x->last_time_acked_data_frame_sent;
+    ev->path.last_sender_limited_time = path_x->last_sender_limited_time;
+    ev->path.send_sequence = picoquic_cc_get_sequence_number(cnx, path_x);
+    ev->path.highest_acknowledged = picoquic_cc_get_ack_number(cnx, path_x);
+    ev->path.send_mtu = path_x->send_mtu;
+    pkt_ctx = (cnx->is_multipath_enabled) ? &path_x->pkt_ctx : &cnx->pkt_ctx[picoquic_packet_context_application];
+    ev->path.ecn_ce_total_remote = pkt_ctx->ecn_ce_total_remote;
+    ev->path.ecn_total_remote = pkt_ctx->ecn_ect0_total_remote + pkt_ctx->ecn_ect1_total_remote +
+        pkt_ctx->ecn_ce_total_remote;
+}
+
+void c4_record_capture_decision(c4_record_event_t* ev, picoquic_path_t* path_x, uint64_t alg_state)
+{
+    ev->decision.cwin = path_x->cwin;
+    ev->decision.pacing_rate = path_x->pacing_rate;
+    ev->decision.alg_state = alg_state;
+}
+
+int c4_record_write(c4_record_t* recorder, c4_record_event_t const* ev)
+{
+    /* Deletions do not carry a time, they are recorded at the time of the previous event */
+    uint64_t current_time = (ev->record_type == c4_record_delete) ? recorder->last_time : ev->current_time;
+    uint64_t delta = (current_time >= recorder->last_time) ?
+        ((current_time - recorder->last_time) << 1) :
+        (((recorder->last_time - current_time) << 1) | 1);
+
+    recorder->last_time = current_time;
+    c4_record_put_byte(recorder, (uint8_t)ev->record_type);
+    c4_record_put_int(recorder, delta);
+
+    switch (ev->record_type) {
+    case c4_record_init: {
+        size_t len = strlen(ev->option_string);
+        c4_record_put_byte(recorder, (uint8_t)len);
+        for (size_t i = 0; i < len; i++) {
+            c4_record_put_byte(recorder, (uint8_t)ev->option_string[i]);
+        }
+        break;
+    }
+    case c4_record_notify:
+        c4_record_put_int(recorder, (uint64_t)ev->notification);
+        c4_record_put_byte(recorder, (uint8_t)(ev->has_ack_state != 0));
+        if (ev->has_ack_state) {
+            c4_record_put_ack_state(recorder, ev->ack_states);
+        }
+        break;
+    case c4_record_batch:
+        c4_record_put_int(recorder, (uint64_t)ev->nb_ack_states);
+        for (size_t i = 0; i < ev->nb_ack_states; i++) {
+            c4_record_put_ack_state(recorder, &ev->ack_states[i]);
+        }
+        break;
+    case c4_record_hint:
+        c4_record_put_int(recorder, ev->hint_rate);
+        c4_record_put_int(recorder, ev->hint_burst);
+        break;
+    default:
+        break;
+    }
+    if (ev->record_type != c4_record_delete) {
+        c4_record_put_int(recorder, ev->path.rtt_sample);
+        c4_record_put_int(recorder, ev->path.smoothed_rtt);
+        c4_record_put_int(recorder, ev->path.rtt_min);
+        c4_record_put_int(recorder, ev->path.peak_bandwidth_estimate);
+        c4_record_put_int(recorder, ev->path.bandwidth_estimate);
+        c4_record_put_int(recorder, ev->path.bytes_in_transit);
+        c4_record_put_int(recorder, ev->path.last_time_acked_data_frame_sent);
+        c4_record_put_int(recorder, ev->path.last_sender_limited_time);
+        c4_record_put_int(recorder, ev->path.send_sequence);
+        c4_record_put_int(recorder, ev->path.highest_acknowledged);
+        c4_record_put_int(recorder, ev->path.send_mtu);
+        c4_record_put_int(recorder, ev->path.ecn_ce_total_remote);
+        c4_record_put_int(recorder, ev->path.ecn_total_remote);
+        c4_record_put_int(recorder, ev->decision.cwin);
+        c4_record_put_int(recorder, ev->decision.pacing_rate);
+        c4_record_put_int(recorder, ev->decision.alg_state);
+    }
+    return (recorder->is_failed) ? -1 : 0;
+}
+
+c4_record_reader_t* c4_record_reader_open(char const* file_name)
+{
+    c4_record_reader_t* reader = (c4_record_reader_t*)malloc(sizeof(c4_record_reader_t));
+
+    if (reader != NULL) {
+        uint8_t header[8];
+        size_t header_size = strlen(C4_RECORD_MAGIC) + 1;
+
+        memset(reader, 0, sizeof(c4_record_reader_t));
+        if ((reader->F = picoquic_file_open(file_name, "rb")) == NULL ||
+            fread(header, 1, header_size, reader->F) != header_size ||
+            memcmp(header, C4_RECORD_MAGIC, header_size - 1) != 0 ||
+            header[header_size - 1] != C4_RECORD_VERSION) {
+            c4_record_reader_close(reader);
+            reader = NULL;
+        }
+    }
+    return reader;
+}
+
+void c4_record_reader_close(c4_record_reader_t* reader)
+{
+    if (reader->F != NULL) {
+        (void)picoquic_file_close(reader->F);
+    }
+    if (reader->ack_states != NULL) {
+        free(reader->ack_states);
+    }
+    free(reader);
+}
+
+static int c4_record_get_byte(c4_record_reader_t* reader, uint8_t* b)
+{
+    int c = fgetc(reader->F);
+
+    if (c == EOF) {
+        return -1;
+    }
+    *b = (uint8_t)c;
+    return 0;
+}
+
+static int c4_record_get_int(c4_record_reader_t* reader, uint64_t* v)
+{
+    int ret = 0;
+    int shift = 0;
+    uint8_t b = 0x80;
+
+    *v = 0;
+    while (ret == 0 && (b & 0x80) != 0) {
+        if (shift > 63 || (ret = c4_record_get_byte(reader, &b)) != 0) {
+            ret = -1;
+        }
+        else {
+            *v |= ((uint64_t)(b & 0x7f)) << shift;
+            shift += 7;
+        }
+    }
+    return ret;
+}
+
+static int c4_record_get_ack_state(c4_record_reader_t* reader, picoquic_per_ack_state_t* ack_state)
+{
+    uint8_t flags = 0;
+    int ret = 0;
+
+    memset(ack_state, 0, sizeof(picoquic_per_ack_state_t));
+    if (c4_record_get_int(reader, &ack_state->rtt_measurement) != 0 ||
+        c4_record_get_int(reader, &ack_state->one_way_delay) != 0 ||
+        c4_record_get_int(reader, &ack_state->send_delay) != 0 ||
+        c4_record_get_int(reader, &ack_state->nb_bytes_acknowledged) != 0 ||
+        c4_record_get_int(reader, &ack_state->nb_bytes_newly_lost) != 0 ||
+        c4_record_get_int(reader, &ack_state->nb_bytes_lost_since_packet_sent) != 0 ||
+        c4_record_get_int(reader, &ack_state->nb_bytes_delivered_since_packet_sent) != 0 ||
+        c4_record_get_int(reader, &ack_state->inflight_prior) != 0 ||
+        c4_record_get_int(reader, &ack_state->lost_packet_number) != 0 ||
+        c4_record_get_byte(reader, &flags) != 0) {
+        ret = -1;
+    }
+    else {
+        ack_state->is_app_limited = flags & 1;
+        ack_state->is_cwnd_limited = (flags >> 1) & 1;
+    }
+    return ret;
+}
+
+static int c4_record_reserve_ack_states(c4_record_reader_t* reader, size_t nb_ack_states)
+{
+    int ret = 0;
+
+    if (nb_ack_states > reader->nb_ack_states_max) {
+        size_t nb_max = (nb_ack_states < 16) ? 16 : nb_ack_states;
+        picoquic_per_ack_state_t* ack_states = (picoquic_per_ack_state_t*)malloc(
+            nb_max * sizeof(picoquic_per_ack_state_t));
+        if (ack_states == NULL) {
+            ret = -1;
+        }
+        else {
+            if (reader->ack_states != NULL) {
+                free(reader->ack_states);
+            }
+            reader->ack_states = ack_states;
+            reader->nb_ack_states_max = nb_max;
+        }
+    }
+    return ret;
+}
+
+int c4_record_read(c4_record_reader_t* reader, c4_record_event_t* ev)
+{
+    int ret = 0;
+    uint8_t record_type = 0;
+    uint64_t delta = 0;
+    uint64_t v = 0;
+
+    memset(ev, 0, sizeof(c4_record_event_t));
+    if (c4_record_get_byte(reader, &record_type) != 0) {
+        /* End of file */
+        return 0;
+    }
+    if (c4_record_get_int(reader, &delta) != 0) {
+        return -1;
+    }
+    reader->last_time = ((delta & 1) == 0) ? reader->last_time + (delta >> 1) : reader->last_time - (delta >> 1);
+    ev->current_time = reader->last_time;
+    ev->record_type = (c4_record_type_enum)record_type;
+
+    switch (ev->record_type) {
+    case c4_record_init: {
+        uint8_t len = 0;
+        if (c4_record_get_byte(reader, &len) != 0 ||
+            fread(ev->option_string, 1, len, reader->F) != len) {
+            ret = -1;
+        }
+        break;
+    }
+    case c4_record_notify: {
+        uint8_t has_ack_state = 0;
+        if (c4_record_get_int(reader, &v) != 0 ||
+            c4_record_get_byte(reader, &has_ack_state) != 0 ||
+            c4_record_reserve_ack_states(reader, 1) != 0) {
+            ret = -1;
+        }
+        else {
+            ev->notification = (picoquic_congestion_notification_t)v;
+            ev->has_ack_state = has_ack_state;
+            ev->ack_states = reader->ack_states;
+            ev->nb_ack_states = has_ack_state;
+            if (has_ack_state) {
+                ret = c4_record_get_ack_state(reader, ev->ack_states);
+            }
+        }
+        break;
+    }
+    case c4_record_batch:
+        if (c4_record_get_int(reader, &v) != 0 || v > SIZE_MAX / sizeof(picoquic_per_ack_state_t) ||
+            c4_record_reserve_ack_states(reader, (size_t)v) != 0) {
+            ret = -1;
+        }
+        else {
+            ev->nb_ack_states = (size_t)v;
+            ev->has_ack_state = 1;
+            ev->ack_states = reader->ack_states;
+            for (size_t i = 0; ret == 0 && i < ev->nb_ack_states; i++) {
+                ret = c4_record_get_ack_state(reader, &ev->ack_states[i]);
+            }
+        }
+        break;
+    case c4_record_delete:
+        break;
+    case c4_record_hint:
+        if (c4_record_get_int(reader, &ev->hint_rate) != 0 ||
+            c4_record_get_int(reader, &ev->hint_burst) != 0) {
+            ret = -1;
+        }
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+    if (ret == 0 && ev->record_type != c4_record_delete) {
+        if (c4_record_get_int(reader, &ev->path.rtt_sample) != 0 ||
+            c4_record_get_int(reader, &ev->path.smoothed_rtt) != 0 ||
+            c4_record_get_int(reader, &ev->path.rtt_min) != 0 ||
+            c4_record_get_int(reader, &ev->path.peak_bandwidth_estimate) != 0 ||
+            c4_record_get_int(reader, &ev->path.bandwidth_estimate) != 0 ||
+            c4_record_get_int(reader, &ev->path.bytes_in_transit) != 0 ||
+            c4_record_get_int(reader, &ev->path.last_time_acked_data_frame_sent) != 0 ||
+            c4_record_get_int(reader, &ev->path.last_sender_limited_time) != 0 ||
+            c4_record_get_int(reader, &ev->path.send_sequence) != 0 ||
+            c4_record_get_int(reader, &ev->path.highest_acknowledged) != 0 ||
+            c4_record_get_int(reader, &ev->path.send_mtu) != 0 ||
+            c4_record_get_int(reader, &ev->path.ecn_ce_total_remote) != 0 ||
+            c4_record_get_int(reader, &ev->path.ecn_total_remote) != 0 ||
+            c4_record_get_int(reader, &ev->decision.cwin) != 0 ||
+            c4_record_get_int(reader, &ev->decision.pacing_rate) != 0 ||
+            c4_record_get_int(reader, &ev->decision.alg_state) != 0) {
+            ret = -1;
+        }
+    }
+    return (ret == 0) ? 1 : -1;
+}
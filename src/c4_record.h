@@ -0,0 +1,99 @@
+/*
+Record and replay of the congestion notifications received by C4
+*/
+
+#ifndef C4_RECORD_H
+#define C4_RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "picoquic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C4_RECORD_MAGIC "C4REC"
+#define C4_RECORD_VERSION 2
+#define C4_RECORD_MAX_OPTIONS 255
+
+    typedef enum {
+        c4_record_init = 1,
+        c4_record_notify = 2,
+        c4_record_batch = 3,
+        c4_record_delete = 4,
+        c4_record_hint = 5
+    } c4_record_type_enum;
+
+    /* The path and connection fields read by C4 before processing
+    * the event, and the decisions observed after processing it.
+     */
+    typedef struct st_c4_record_path_t {
+        uint64_t rtt_sample;
+        uint64_t smoothed_rtt;
+        uint64_t rtt_min;
+        uint64_t peak_bandwidth_estimate;
+        uint64_t bandwidth_estimate;
+        uint64_t bytes_in_transit;
+        uint64_t last_time_acked_data_frame_sent;
+        uint64_t last_sender_limited_time;
+        uint64_t send_sequence;
+        uint64_t highest_acknowledged;
+        uint64_t send_mtu;
+        uint64_t ecn_ce_total_remote;
+        uint64_t ecn_total_remote;
+    } c4_record_path_t;
+
+    typedef struct st_c4_record_decision_t {
+        uint64_t cwin;
+        uint64_t pacing_rate;
+        uint64_t alg_state;
+    } c4_record_decision_t;
+
+    /* One recorded call. Notifications carry at most one ack state,
+    * which may be absent; batches carry nb_ack_states of them.
+    * Hints carry the rate hint set by the application. The notification
+    * field is only used by notify records: it is not written for the
+    * other records, and is left to zero when they are read.
+     */
+    typedef struct st_c4_record_event_t {
+        c4_record_type_enum record_type;
+        uint64_t current_time;
+        picoquic_congestion_notification_t notification;
+        int has_ack_state;
+        size_t nb_ack_states;
+        picoquic_per_ack_state_t* ack_states;
+        char option_string[C4_RECORD_MAX_OPTIONS + 1];
+        uint64_t hint_rate;
+        uint64_t hint_burst;
+        c4_record_path_t path;
+        c4_record_decision_t decision;
+    } c4_record_event_t;
+
+    typedef struct st_c4_record_t c4_record_t;
+
+    /* Writer, used by C4 when recording is enabled.
+    * Records are buffered, and written to the file when the buffer is
+    * full or when the recorder is closed.
+     */
+    c4_record_t* c4_record_open(char const* file_name);
+    void c4_record_close(c4_record_t* recorder);
+    void c4_record_capture_path(c4_record_event_t* ev, picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+    void c4_record_capture_decision(c4_record_event_t* ev, picoquic_path_t* path_x, uint64_t alg_state);
+    int c4_record_write(c4_record_t* recorder, c4_record_event_t const* ev);
+
+    /* Reader, used by the replay tool. The ack states of the returned
+    * events point to memory owned by the reader, which remains valid
+    * until the next call.
+     */
+    typedef struct st_c4_record_reader_t c4_record_reader_t;
+
+    c4_record_reader_t* c4_record_reader_open(char const* file_name);
+    void c4_record_reader_close(c4_record_reader_t* reader);
+    /* Returns 1 if an event was read, 0 at the end of file, -1 on format error. */
+    int c4_record_read(c4_record_reader_t* reader, c4_record_event_t* ev);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
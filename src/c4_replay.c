@@ -0,0 +1,262 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Replay of a C4 record file.
+* The notifications recorded from a live connection, with option 'R' or
+* after setting a record directory, are fed to C4 in the same order and
+* with the same path variables. The CWIN, pacing rate and state obtained
+* after each call are compared to the recorded values. The decisions can
+* also be written to a CSV file, so the output of two builds can be
+* compared on identical input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "picoquic.h"
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+
+#include "picoquic_register_cc_algo.h"
+#include "c4.h"
+#include "c4_record.h"
+
+#ifdef _WINDOWS
+#include "../pico_sim_vs/pico_sim_vs/getopt.h"
+#else
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#define C4_REPLAY_MAX_DIVERGENCES_PRINTED 10
+
+typedef struct st_replay_stats_t {
+    uint64_t nb_records;
+    uint64_t nb_notifications;
+    uint64_t nb_batches;
+    uint64_t nb_hints;
+    uint64_t nb_divergences;
+} replay_stats_t;
+
+static char const* replay_record_names[] = { "", "init", "notify", "batch", "delete", "hint" };
+
+void usage()
+{
+    fprintf(stderr, "C4_replay, replay of the notifications recorded from a C4 connection\n\n");
+    fprintf(stderr, "Usage: c4_replay [options] record_file\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -o file    Write the decisions after each record to a CSV file.\n");
+    fprintf(stderr, "  -v         Print all the divergences from the recorded decisions,\n");
+    fprintf(stderr, "             instead of only the first %d.\n", C4_REPLAY_MAX_DIVERGENCES_PRINTED);
+    fprintf(stderr, "  -h         Print this message.\n");
+}
+
+/* Copy the option string, without the record and columnar trace options,
+* so the replay does not produce new files.
+ */
+static void replay_options(char* options, char const* recorded)
+{
+    while (*recorded != 0) {
+        if (*recorded != 'R' && *recorded != 'B') {
+            *options++ = *recorded;
+        }
+        recorded++;
+    }
+    *options = 0;
+}
+
+static void replay_set_path(picoquic_cnx_t* cnx, picoquic_path_t* path_x, c4_record_path_t const* path)
+{
+    path_x->rtt_sample = path->rtt_sample;
+    path_x->smoothed_rtt = path->smoothed_rtt;
+    path_x->rtt_min = path->rtt_min;
+    path_x->peak_bandwidth_estimate = path->peak_bandwidth_estimate;
+    path_x->bandwidth_estimate = path->bandwidth_estimate;
+    path_x->bytes_in_transit = path->bytes_in_transit;
+    path_x->last_time_acked_data_frame_sent = path->last_time_acked_data_frame_sent;
+    path_x->last_sender_limited_time = path->last_sender_limited_time;
+    path_x->send_mtu = (uint32_t)path->send_mtu;
+    cnx->pkt_ctx[picoquic_packet_context_application].send_sequence = path->send_sequence;
+    cnx->pkt_ctx[picoquic_packet_context_application].highest_acknowledged = path->highest_acknowledged;
+    /* Only the totals matter to C4, so the ECT marks are all counted as ECT0 */
+    cnx->pkt_ctx[picoquic_packet_context_application].ecn_ce_total_remote = path->ecn_ce_total_remote;
+    cnx->pkt_ctx[picoquic_packet_context_application].ecn_ect0_total_remote =
+        path->ecn_total_remote - path->ecn_ce_total_remote;
+    cnx->pkt_ctx[picoquic_packet_context_application].ecn_ect1_total_remote = 0;
+}
+
+static int replay_file(char const* record_file, FILE* F_csv, int verbose, replay_stats_t* stats)
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    picoquic_quic_t* quic = NULL;
+    picoquic_cnx_t* cnx = NULL;
+    c4_record_reader_t* reader = NULL;
+    struct sockaddr_in addr;
+
+    memset(stats, 0, sizeof(replay_stats_t));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4443);
+
+    if ((reader = c4_record_reader_open(record_file)) == NULL) {
+        fprintf(stderr, "Cannot open record file <%s>\n", record_file);
+        ret = -1;
+    }
+    else if ((quic = picoquic_create(8, NULL, NULL, NULL, "hq-interop", NULL, NULL, NULL, NULL, NULL,
+        simulated_time, &simulated_time, NULL, NULL, 0)) == NULL ||
+        (cnx = picoquic_create_cnx(quic, picoquic_null_connection_id, picoquic_null_connection_id,
+            (struct sockaddr*)&addr, simulated_time, 0, "test.example.com", "hq-interop", 1)) == NULL) {
+        fprintf(stderr, "Cannot create the replay connection\n");
+        ret = -1;
+    }
+    else {
+        picoquic_path_t* path_x = cnx->path[0];
+        c4_record_event_t ev;
+        int is_deleted = 0;
+        int read_ret;
+
+        picoquic_set_congestion_algorithm(cnx, c4_algorithm);
+        cnx->cnx_state = picoquic_state_ready;
+
+        if (F_csv != NULL) {
+            fprintf(F_csv, "time, record, notification, cwin, pacing_rate, state, recorded_cwin, recorded_pacing_rate, recorded_state\n");
+        }
+
+        while (!is_deleted && (read_ret = c4_record_read(reader, &ev)) == 1) {
+            uint64_t cc_state = 0;
+            uint64_t cc_param = 0;
+
+            stats->nb_records++;
+            if (ev.record_type == c4_record_delete) {
+                is_deleted = 1;
+                continue;
+            }
+            replay_set_path(cnx, path_x, &ev.path);
+            if (ev.record_type == c4_record_init) {
+                char options[C4_RECORD_MAX_OPTIONS + 1];
+                replay_options(options, ev.option_string);
+                c4_algorithm->alg_init(cnx, path_x, options, ev.current_time);
+            }
+            else if (ev.record_type == c4_record_notify) {
+                stats->nb_notifications++;
+                c4_algorithm->alg_notify(cnx, path_x, ev.notification,
+                    (ev.has_ack_state) ? ev.ack_states : NULL, ev.current_time);
+            }
+            else if (ev.record_type == c4_record_hint) {
+                stats->nb_hints++;
+                c4_set_rate_hint(path_x, ev.hint_rate, ev.hint_burst);
+            }
+            else {
+                stats->nb_batches++;
+                c4_notify_ack_batch(cnx, path_x, ev.ack_states, ev.nb_ack_states, ev.current_time);
+            }
+            c4_algorithm->alg_observe(path_x, &cc_state, &cc_param);
+
+            if (path_x->cwin != ev.decision.cwin || path_x->pacing_rate != ev.decision.pacing_rate ||
+                cc_state != ev.decision.alg_state) {
+                stats->nb_divergences++;
+                if (verbose || stats->nb_divergences <= C4_REPLAY_MAX_DIVERGENCES_PRINTED) {
+                    printf("Divergence at record %" PRIu64 " (%s), time %" PRIu64 ": cwin %" PRIu64 " vs %" PRIu64
+                        ", pacing rate %" PRIu64 " vs %" PRIu64 ", state %" PRIu64 " vs %" PRIu64 "\n",
+                        stats->nb_records, replay_record_names[ev.record_type], ev.current_time,
+                        path_x->cwin, ev.decision.cwin, path_x->pacing_rate, ev.decision.pacing_rate,
+                        cc_state, ev.decision.alg_state);
+                }
+            }
+            if (F_csv != NULL) {
+                fprintf(F_csv, "%" PRIu64 ", %s, %d, %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
+                    ev.current_time, replay_record_names[ev.record_type],
+                    (ev.record_type == c4_record_notify) ? (int)ev.notification : -1,
+                    path_x->cwin, path_x->pacing_rate, cc_state,
+                    ev.decision.cwin, ev.decision.pacing_rate, ev.decision.alg_state);
+            }
+        }
+        if (!is_deleted && read_ret < 0) {
+            fprintf(stderr, "Format error after record %" PRIu64 " in <%s>\n", stats->nb_records, record_file);
+            ret = -1;
+        }
+    }
+    if (cnx != NULL) {
+        picoquic_delete_cnx(cnx);
+    }
+    if (quic != NULL) {
+        picoquic_free(quic);
+    }
+    if (reader != NULL) {
+        c4_record_reader_close(reader);
+    }
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    char const* csv_file = NULL;
+    FILE* F_csv = NULL;
+    int verbose = 0;
+    replay_stats_t stats;
+    int opt;
+
+    if (picoquic_register_cc_algorithm(c4_algorithm) != 0) {
+        fprintf(stderr, "Could not register the C4 algorithm.\n");
+        return -1;
+    }
+
+    while ((opt = getopt(argc, argv, "o:vh")) != -1) {
+        switch (opt) {
+        case 'o':
+            csv_file = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Expected exactly one record file.\n");
+        usage();
+        ret = -1;
+    }
+    else if (csv_file != NULL && (F_csv = picoquic_file_open(csv_file, "w")) == NULL) {
+        fprintf(stderr, "Cannot open file <%s>\n", csv_file);
+        ret = -1;
+    }
+    else if ((ret = replay_file(argv[optind], F_csv, verbose, &stats)) == 0) {
+        printf("Replayed %" PRIu64 " records, %" PRIu64 " notifications, %" PRIu64 " batches, %" PRIu64 " hints, %" PRIu64 " divergences.\n",
+            stats.nb_records, stats.nb_notifications, stats.nb_batches, stats.nb_hints, stats.nb_divergences);
+        ret = (stats.nb_divergences == 0) ? 0 : 1;
+    }
+    if (F_csv != NULL) {
+        F_csv = picoquic_file_close(F_csv);
+    }
+    return ret;
+}
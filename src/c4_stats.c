@@ -0,0 +1,420 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Aggregation of the per path counters of C4, and formatting in the
+* Prometheus text exposition format, so that servers can expose the
+* health of the congestion control like any other metric.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "picoquic_internal.h"
+#include "picoquic_utils.h"
+#include "c4_stats.h"
+
+/* Upper bounds of the histogram buckets, in bytes per second and in microseconds */
+static const uint64_t c4_stats_rate_bounds[C4_STATS_NB_RATE_BUCKETS] = {
+    10000, 30000, 100000, 300000, 1000000, 3000000,
+    10000000, 30000000, 100000000, 300000000, 1000000000 };
+static const uint64_t c4_stats_rtt_bounds[C4_STATS_NB_RTT_BUCKETS] = {
+    1000, 2000, 5000, 10000, 20000, 50000,
+    100000, 200000, 500000, 1000000, 2000000, 5000000 };
+
+static char const* c4_stats_state_names[C4_NB_STATES] = {
+    "initial", "recovery", "cruising", "pushing",
+    "cr_reconnaissance", "cr_unvalidated", "cr_validating", "cr_safe_retreat" };
+static char const* c4_stats_cause_names[C4_NB_CONGESTION_TYPES] = {
+    "push_end", "delay", "ecn", "loss" };
+
+static int c4_stats_bucket(uint64_t value, uint64_t const* bounds, int nb_bounds)
+{
+    int i = 0;
+
+    while (i < nb_bounds && value > bounds[i]) {
+        i++;
+    }
+    return i;
+}
+
+void c4_stats_add_path(c4_stats_t* stats, c4_path_stats_t const* path_stats)
+{
+    stats->nb_paths++;
+    for (int i = 0; i < C4_NB_STATES; i++) {
+        stats->nb_state_entries[i] += path_stats->nb_state_entries[i];
+        stats->time_in_state[i] += path_stats->time_in_state[i];
+    }
+    for (int i = 0; i < C4_NB_CONGESTION_TYPES; i++) {
+        stats->nb_recoveries[i] += path_stats->nb_recoveries[i];
+    }
+    stats->nb_push_succeeded += path_stats->nb_push_succeeded;
+    stats->nb_push_failed += path_stats->nb_push_failed;
+    stats->nb_cascades += path_stats->nb_cascades;
+    stats->nb_jitter_restarts += path_stats->nb_jitter_restarts;
+    stats->nb_pacing_updates += path_stats->nb_pacing_updates;
+    stats->nb_pacing_updates_skipped += path_stats->nb_pacing_updates_skipped;
+    stats->rate_buckets[c4_stats_bucket(path_stats->nominal_rate, c4_stats_rate_bounds, C4_STATS_NB_RATE_BUCKETS)]++;
+    stats->rate_sum += path_stats->nominal_rate;
+    stats->rtt_buckets[c4_stats_bucket(path_stats->nominal_max_rtt, c4_stats_rtt_bounds, C4_STATS_NB_RTT_BUCKETS)]++;
+    stats->rtt_sum += path_stats->nominal_max_rtt;
+}
+
+void c4_stats_merge(c4_stats_t* stats, c4_stats_t const* other)
+{
+    stats->nb_paths += other->nb_paths;
+    for (int i = 0; i < C4_NB_STATES; i++) {
+        stats->nb_paths_in_state[i] += other->nb_paths_in_state[i];
+        stats->nb_state_entries[i] += other->nb_state_entries[i];
+        stats->time_in_state[i] += other->time_in_state[i];
+    }
+    for (int i = 0; i < C4_NB_CONGESTION_TYPES; i++) {
+        stats->nb_recoveries[i] += other->nb_recoveries[i];
+    }
+    stats->nb_push_succeeded += other->nb_push_succeeded;
+    stats->nb_push_failed += other->nb_push_failed;
+    stats->nb_cascades += other->nb_cascades;
+    stats->nb_jitter_restarts += other->nb_jitter_restarts;
+    stats->nb_pacing_updates += other->nb_pacing_updates;
+    stats->nb_pacing_updates_skipped += other->nb_pacing_updates_skipped;
+    for (int i = 0; i <= C4_STATS_NB_RATE_BUCKETS; i++) {
+        stats->rate_buckets[i] += other->rate_buckets[i];
+    }
+    stats->rate_sum += other->rate_sum;
+    for (int i = 0; i <= C4_STATS_NB_RTT_BUCKETS; i++) {
+        stats->rtt_buckets[i] += other->rtt_buckets[i];
+    }
+    stats->rtt_sum += other->rtt_sum;
+}
+
+size_t c4_stats_collect(c4_stats_t* stats, picoquic_quic_t* quic)
+{
+    size_t nb_added = 0;
+    picoquic_cnx_t* cnx = picoquic_get_first_cnx(quic);
+
+    while (cnx != NULL) {
+        for (int i = 0; i < cnx->nb_paths; i++) {
+            c4_path_stats_t path_stats;
+
+            if (c4_get_path_stats(cnx->path[i], &path_stats, sizeof(c4_path_stats_t)) == 0) {
+                c4_stats_add_path(stats, &path_stats);
+                if (path_stats.alg_state < C4_NB_STATES) {
+                    stats->nb_paths_in_state[path_stats.alg_state]++;
+                }
+                nb_added++;
+            }
+        }
+        cnx = picoquic_get_next_cnx(cnx);
+    }
+    return nb_added;
+}
+
+/* Statistics of the closed paths. The totals since the start are kept
+* with the recent closures, in slots of C4_STATS_RECENT_WINDOW divided
+* by C4_STATS_NB_RECENT_SLOTS. A slot is cleared when it is reused for
+* a new time interval. The recent statistics are the sum of the slots
+* of the current window, so they cover the last 50 to 60 seconds.
+ */
+#define C4_STATS_NB_RECENT_SLOTS 6
+#define C4_STATS_RECENT_SLOT_DURATION (C4_STATS_RECENT_WINDOW / C4_STATS_NB_RECENT_SLOTS)
+
+typedef struct st_c4_closed_stats_t {
+    c4_stats_t total;
+    c4_stats_t recent[C4_STATS_NB_RECENT_SLOTS];
+    uint64_t recent_interval[C4_STATS_NB_RECENT_SLOTS]; /* Interval number plus 1, 0 if the slot is empty */
+} c4_closed_stats_t;
+
+static c4_closed_stats_t* c4_closed_stats;
+static picoquic_mutex_t c4_closed_stats_mutex;
+
+int c4_stats_enable_closed(void)
+{
+    int ret = -1;
+
+    if (c4_closed_stats == NULL && picoquic_create_mutex(&c4_closed_stats_mutex) == 0) {
+        if ((c4_closed_stats = (c4_closed_stats_t*)malloc(sizeof(c4_closed_stats_t))) == NULL) {
+            (void)picoquic_delete_mutex(&c4_closed_stats_mutex);
+        }
+        else {
+            memset(c4_closed_stats, 0, sizeof(c4_closed_stats_t));
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+void c4_stats_disable_closed(void)
+{
+    if (c4_closed_stats != NULL) {
+        free(c4_closed_stats);
+        c4_closed_stats = NULL;
+        (void)picoquic_delete_mutex(&c4_closed_stats_mutex);
+    }
+}
+
+int c4_stats_is_closed_enabled(void)
+{
+    return c4_closed_stats != NULL;
+}
+
+void c4_stats_add_closed_path(c4_path_stats_t const* path_stats, uint64_t current_time)
+{
+    if (c4_closed_stats != NULL) {
+        uint64_t interval = current_time / C4_STATS_RECENT_SLOT_DURATION + 1;
+        int slot = (int)(interval % C4_STATS_NB_RECENT_SLOTS);
+
+        (void)picoquic_lock_mutex(&c4_closed_stats_mutex);
+        c4_stats_add_path(&c4_closed_stats->total, path_stats);
+        if (c4_closed_stats->recent_interval[slot] != interval) {
+            memset(&c4_closed_stats->recent[slot], 0, sizeof(c4_stats_t));
+            c4_closed_stats->recent_interval[slot] = interval;
+        }
+        c4_stats_add_path(&c4_closed_stats->recent[slot], path_stats);
+        (void)picoquic_unlock_mutex(&c4_closed_stats_mutex);
+    }
+}
+
+int c4_stats_get_closed(c4_stats_t* stats)
+{
+    int ret = -1;
+
+    if (c4_closed_stats != NULL) {
+        (void)picoquic_lock_mutex(&c4_closed_stats_mutex);
+        *stats = c4_closed_stats->total;
+        (void)picoquic_unlock_mutex(&c4_closed_stats_mutex);
+        ret = 0;
+    }
+    return ret;
+}
+
+int c4_stats_get_recent_closed(c4_stats_t* stats, uint64_t current_time)
+{
+    int ret = -1;
+
+    if (c4_closed_stats != NULL) {
+        uint64_t interval = current_time / C4_STATS_RECENT_SLOT_DURATION + 1;
+
+        memset(stats, 0, sizeof(c4_stats_t));
+        (void)picoquic_lock_mutex(&c4_closed_stats_mutex);
+        for (int i = 0; i < C4_STATS_NB_RECENT_SLOTS; i++) {
+            uint64_t slot_interval = c4_closed_stats->recent_interval[i];
+            if (slot_interval != 0 && slot_interval <= interval &&
+                slot_interval + C4_STATS_NB_RECENT_SLOTS > interval) {
+                c4_stats_merge(stats, &c4_closed_stats->recent[i]);
+            }
+        }
+        (void)picoquic_unlock_mutex(&c4_closed_stats_mutex);
+        ret = 0;
+    }
+    return ret;
+}
+
+/* Formatting */
+typedef struct st_c4_stats_text_t {
+    char* text;
+    size_t text_max;
+    size_t length;
+    int ret;
+} c4_stats_text_t;
+
+static void c4_stats_print(c4_stats_text_t* t, char const* fmt, ...)
+{
+    if (t->ret == 0) {
+        va_list args;
+        int nb_chars;
+
+        va_start(args, fmt);
+        nb_chars = vsnprintf(t->text + t->length, t->text_max - t->length, fmt, args);
+        va_end(args);
+        if (nb_chars < 0 || (size_t)nb_chars >= t->text_max - t->length) {
+            t->ret = -1;
+        }
+        else {
+            t->length += nb_chars;
+        }
+    }
+}
+
+static void c4_stats_print_counter(c4_stats_text_t* t, char const* name, char const* help, uint64_t value)
+{
+    c4_stats_print(t, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name, value);
+}
+
+static void c4_stats_print_gauge(c4_stats_text_t* t, char const* name, char const* help, double value)
+{
+    c4_stats_print(t, "# HELP %s %s\n# TYPE %s gauge\n%s %g\n", name, help, name, name, value);
+}
+
+/* Sums of the counters of the paths. They are counters, named with the
+* suffix _total, if the closed paths are included, and gauges of the
+* live paths otherwise.
+ */
+static void c4_stats_print_sum_header(c4_stats_text_t* t, char const* name, char const* help, int is_counter)
+{
+    if (is_counter) {
+        c4_stats_print(t, "# HELP %s_total %s\n# TYPE %s_total counter\n", name, help, name);
+    }
+    else {
+        c4_stats_print(t, "# HELP %s %s Live paths only.\n# TYPE %s gauge\n", name, help, name);
+    }
+}
+
+static void c4_stats_print_sum(c4_stats_text_t* t, char const* name, char const* help, int is_counter, uint64_t value)
+{
+    c4_stats_print_sum_header(t, name, help, is_counter);
+    c4_stats_print(t, "%s%s %" PRIu64 "\n", name, (is_counter) ? "_total" : "", value);
+}
+
+/* Histograms are only used for values observed once, such as the last
+* estimates of closed paths. The distribution of the live paths goes up
+* and down, so it is exposed as gauges of the cumulated number of paths
+* per bucket, with the sum of the values as a separate gauge.
+ */
+static void c4_stats_print_histogram(c4_stats_text_t* t, char const* name, char const* help,
+    uint64_t const* buckets, uint64_t const* bounds, int nb_bounds, double unit, uint64_t sum)
+{
+    uint64_t cumulated = 0;
+
+    c4_stats_print(t, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (int i = 0; i < nb_bounds; i++) {
+        cumulated += buckets[i];
+        c4_stats_print(t, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, (double)bounds[i] / unit, cumulated);
+    }
+    cumulated += buckets[nb_bounds];
+    c4_stats_print(t, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, cumulated);
+    c4_stats_print(t, "%s_sum %g\n%s_count %" PRIu64 "\n", name, (double)sum / unit, name, cumulated);
+}
+
+static void c4_stats_print_gauge_buckets(c4_stats_text_t* t, char const* name, char const* help,
+    uint64_t const* buckets, uint64_t const* bounds, int nb_bounds, double unit)
+{
+    uint64_t cumulated = 0;
+
+    c4_stats_print(t, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+    for (int i = 0; i < nb_bounds; i++) {
+        cumulated += buckets[i];
+        c4_stats_print(t, "%s{le=\"%g\"} %" PRIu64 "\n", name, (double)bounds[i] / unit, cumulated);
+    }
+    cumulated += buckets[nb_bounds];
+    c4_stats_print(t, "%s{le=\"+Inf\"} %" PRIu64 "\n", name, cumulated);
+}
+
+/* Distribution of the estimates of a set of paths that may change, as gauges */
+static void c4_stats_print_distribution(c4_stats_text_t* t, char const* prefix, char const* paths_help, c4_stats_t const* stats)
+{
+    char name[128];
+    char help[256];
+
+    (void)snprintf(name, sizeof(name), "%s_paths_by_nominal_rate", prefix);
+    (void)snprintf(help, sizeof(help), "%s, with a nominal rate up to le bytes per second.", paths_help);
+    c4_stats_print_gauge_buckets(t, name, help, stats->rate_buckets, c4_stats_rate_bounds, C4_STATS_NB_RATE_BUCKETS, 1.0);
+    (void)snprintf(name, sizeof(name), "%s_nominal_rate_bytes_per_second_sum", prefix);
+    (void)snprintf(help, sizeof(help), "%s, sum of the nominal rates.", paths_help);
+    c4_stats_print_gauge(t, name, help, (double)stats->rate_sum);
+    (void)snprintf(name, sizeof(name), "%s_paths_by_nominal_max_rtt", prefix);
+    (void)snprintf(help, sizeof(help), "%s, with a nominal max RTT up to le seconds.", paths_help);
+    c4_stats_print_gauge_buckets(t, name, help, stats->rtt_buckets, c4_stats_rtt_bounds, C4_STATS_NB_RTT_BUCKETS, 1000000.0);
+    (void)snprintf(name, sizeof(name), "%s_nominal_max_rtt_seconds_sum", prefix);
+    (void)snprintf(help, sizeof(help), "%s, sum of the nominal max RTT.", paths_help);
+    c4_stats_print_gauge(t, name, help, (double)stats->rtt_sum / 1000000.0);
+}
+
+int c4_stats_format_prometheus(c4_stats_t const* live, c4_stats_t const* closed, c4_stats_t const* recent_closed,
+    char* text, size_t text_max, size_t* text_length)
+{
+    c4_stats_text_t t = { text, text_max, 0, 0 };
+    c4_stats_t all;
+    c4_stats_t empty;
+    int is_counter = (closed != NULL);
+    char const* suffix = (is_counter) ? "_total" : "";
+
+    memset(&all, 0, sizeof(c4_stats_t));
+    memset(&empty, 0, sizeof(c4_stats_t));
+    if (live != NULL) {
+        c4_stats_merge(&all, live);
+    }
+    if (closed != NULL) {
+        c4_stats_merge(&all, closed);
+    }
+    if (text_max == 0) {
+        return -1;
+    }
+    text[0] = 0;
+
+    c4_stats_print(&t, "# HELP c4_paths Live C4 paths, by state.\n# TYPE c4_paths gauge\n");
+    for (int i = 0; i < C4_NB_STATES; i++) {
+        c4_stats_print(&t, "c4_paths{state=\"%s\"} %" PRIu64 "\n", c4_stats_state_names[i],
+            (live == NULL) ? 0 : live->nb_paths_in_state[i]);
+    }
+    c4_stats_print_distribution(&t, "c4_live", "Live C4 paths", (live == NULL) ? &empty : live);
+    if (closed != NULL) {
+        c4_stats_print_counter(&t, "c4_closed_paths_total", "C4 paths deleted since the start.", closed->nb_paths);
+        c4_stats_print_histogram(&t, "c4_closed_nominal_rate_bytes_per_second",
+            "Last nominal rate of the C4 paths deleted since the start.",
+            closed->rate_buckets, c4_stats_rate_bounds, C4_STATS_NB_RATE_BUCKETS, 1.0, closed->rate_sum);
+        c4_stats_print_histogram(&t, "c4_closed_nominal_max_rtt_seconds",
+            "Last nominal max RTT of the C4 paths deleted since the start.",
+            closed->rtt_buckets, c4_stats_rtt_bounds, C4_STATS_NB_RTT_BUCKETS, 1000000.0, closed->rtt_sum);
+    }
+    if (recent_closed != NULL) {
+        c4_stats_print_gauge(&t, "c4_recently_closed_paths", "C4 paths deleted in the last minute.",
+            (double)recent_closed->nb_paths);
+        c4_stats_print_distribution(&t, "c4_recently_closed", "C4 paths deleted in the last minute", recent_closed);
+        c4_stats_print(&t, "# HELP c4_recently_closed_recoveries Entries into recovery of the C4 paths deleted in the last minute, by cause.\n"
+            "# TYPE c4_recently_closed_recoveries gauge\n");
+        for (int i = 0; i < C4_NB_CONGESTION_TYPES; i++) {
+            c4_stats_print(&t, "c4_recently_closed_recoveries{cause=\"%s\"} %" PRIu64 "\n", c4_stats_cause_names[i],
+                recent_closed->nb_recoveries[i]);
+        }
+        c4_stats_print(&t, "# HELP c4_recently_closed_pushes Pushes of the C4 paths deleted in the last minute, by result.\n"
+            "# TYPE c4_recently_closed_pushes gauge\n");
+        c4_stats_print(&t, "c4_recently_closed_pushes{result=\"succeeded\"} %" PRIu64 "\n", recent_closed->nb_push_succeeded);
+        c4_stats_print(&t, "c4_recently_closed_pushes{result=\"failed\"} %" PRIu64 "\n", recent_closed->nb_push_failed);
+    }
+    /* The sums only grow if the closed paths are included. Otherwise they
+     * drop when a path closes, which scrapers would read as a counter reset,
+     * so they are exported as gauges, without the _total suffix. */
+    c4_stats_print_sum_header(&t, "c4_state_entries", "Entries into each C4 state.", is_counter);
+    for (int i = 0; i < C4_NB_STATES; i++) {
+        c4_stats_print(&t, "c4_state_entries%s{state=\"%s\"} %" PRIu64 "\n", suffix, c4_stats_state_names[i], all.nb_state_entries[i]);
+    }
+    c4_stats_print_sum_header(&t, "c4_state_seconds", "Time spent in each C4 state.", is_counter);
+    for (int i = 0; i < C4_NB_STATES; i++) {
+        c4_stats_print(&t, "c4_state_seconds%s{state=\"%s\"} %.6f\n", suffix, c4_stats_state_names[i],
+            (double)all.time_in_state[i] / 1000000.0);
+    }
+    c4_stats_print_sum_header(&t, "c4_recoveries", "Entries into recovery, by cause.", is_counter);
+    for (int i = 0; i < C4_NB_CONGESTION_TYPES; i++) {
+        c4_stats_print(&t, "c4_recoveries%s{cause=\"%s\"} %" PRIu64 "\n", suffix, c4_stats_cause_names[i], all.nb_recoveries[i]);
+    }
+    c4_stats_print_sum_header(&t, "c4_pushes", "Pushes, by result.", is_counter);
+    c4_stats_print(&t, "c4_pushes%s{result=\"succeeded\"} %" PRIu64 "\n", suffix, all.nb_push_succeeded);
+    c4_stats_print(&t, "c4_pushes%s{result=\"failed\"} %" PRIu64 "\n", suffix, all.nb_push_failed);
+    c4_stats_print_sum(&t, "c4_cascades", "Returns to the initial state after successful pushes.", is_counter, all.nb_cascades);
+    c4_stats_print_sum(&t, "c4_jitter_restarts", "Returns to the initial state after a jitter increase.", is_counter, all.nb_jitter_restarts);
+    c4_stats_print_sum(&t, "c4_pacing_updates", "Updates of the pacing rate.", is_counter, all.nb_pacing_updates);
+    c4_stats_print_sum(&t, "c4_pacing_updates_skipped", "Updates of the pacing rate skipped because the inputs did not change.",
+        is_counter, all.nb_pacing_updates_skipped);
+
+    *text_length = t.length;
+    return t.ret;
+}
@@ -0,0 +1,85 @@
+/*
+Aggregated statistics of the C4 paths, in Prometheus exposition format
+*/
+
+#ifndef C4_STATS_H
+#define C4_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "picoquic.h"
+#include "c4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C4_STATS_NB_RATE_BUCKETS 11
+#define C4_STATS_NB_RTT_BUCKETS 12
+#define C4_STATS_RECENT_WINDOW 60000000 /* Window of the recently closed paths, one minute */
+
+    /* Sums of the counters of a set of paths, and histograms of their
+    * nominal rate and max RTT. The last bucket of each histogram counts
+    * the values above the largest bound. The number of paths per state
+    * is only counted for live paths, by c4_stats_collect.
+     */
+    typedef struct st_c4_stats_t {
+        uint64_t nb_paths;
+        uint64_t nb_paths_in_state[C4_NB_STATES];
+        uint64_t nb_state_entries[C4_NB_STATES];
+        uint64_t time_in_state[C4_NB_STATES];
+        uint64_t nb_recoveries[C4_NB_CONGESTION_TYPES];
+        uint64_t nb_push_succeeded;
+        uint64_t nb_push_failed;
+        uint64_t nb_cascades;
+        uint64_t nb_jitter_restarts;
+        uint64_t nb_pacing_updates;
+        uint64_t nb_pacing_updates_skipped;
+        uint64_t rate_buckets[C4_STATS_NB_RATE_BUCKETS + 1];
+        uint64_t rate_sum;
+        uint64_t rtt_buckets[C4_STATS_NB_RTT_BUCKETS + 1];
+        uint64_t rtt_sum;
+    } c4_stats_t;
+
+    void c4_stats_add_path(c4_stats_t* stats, c4_path_stats_t const* path_stats);
+    void c4_stats_merge(c4_stats_t* stats, c4_stats_t const* other);
+    /* Add the live C4 paths of the QUIC context. This reads the path
+    * states without locks, so it shall be called from the thread that
+    * runs the packet loop of the context, e.g., from an HTTP callback.
+    * Returns the number of paths added.
+     */
+    size_t c4_stats_collect(c4_stats_t* stats, picoquic_quic_t* quic);
+
+    /* Statistics of the closed paths, shared by all the connections of the
+    * process. When enabled, the counters and last estimates of each C4
+    * path are added when the path is deleted, both to the totals since
+    * the start and to the paths closed during the last
+    * C4_STATS_RECENT_WINDOW. The mutex protecting them is only held while
+    * adding one path or copying the statistics, so the packet loops are
+    * never blocked for long. Enabling should be done before the network
+    * threads start, and disabling after they stop.
+     */
+    int c4_stats_enable_closed(void);
+    void c4_stats_disable_closed(void);
+    int c4_stats_is_closed_enabled(void);
+    void c4_stats_add_closed_path(c4_path_stats_t const* path_stats, uint64_t current_time);
+    /* Returns -1 if the statistics of closed paths are not enabled */
+    int c4_stats_get_closed(c4_stats_t* stats);
+    int c4_stats_get_recent_closed(c4_stats_t* stats, uint64_t current_time);
+
+    /* Format the statistics as text in the Prometheus exposition format.
+    * The distribution of the estimates of the live and recently closed
+    * paths is exported as gauges, since it goes up and down. Histograms
+    * are only used for the closed paths since the start. The counters
+    * are the sums of the live and closed paths. If closed is NULL, these
+    * sums would drop when paths close, so they are exported as gauges of
+    * the live paths, without the _total suffix. Any set may be NULL.
+    * Returns -1 if the text does not fit in text_max bytes.
+     */
+    int c4_stats_format_prometheus(c4_stats_t const* live, c4_stats_t const* closed, c4_stats_t const* recent_closed,
+        char* text, size_t text_max, size_t* text_length);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
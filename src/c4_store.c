@@ -0,0 +1,412 @@
+/*
+* Author: Christian Huitema
+* Copyright (c) 2025, Private Octopus, Inc.
+* All rights reserved.
+*
+* Permission to use, copy, modify, and distribute this software for any
+* purpose with or without fee is hereby granted, provided that the above
+* copyright notice and this permission notice appear in all copies.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL Private Octopus, Inc. BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "c4_store.h"
+#ifdef _WINDOWS
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Store file format.
+* The file starts with a 64 bytes header, followed by the records, in
+* sets of C4_CACHE_NB_WAYS. Integers are in host byte order, since the
+* file is only shared by the processes of one host. The set of a prefix
+* is found by hashing it with the salt chosen when the file was created.
+* The checksum of a record covers all the bytes that follow it, and is
+* also seeded with the salt. Records with a zero family are empty.
+ */
+typedef struct st_c4_store_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_sets;
+    uint32_t nb_ways;
+    uint32_t record_size;
+    uint64_t salt;
+    uint8_t reserved[32];
+} c4_store_header_t;
+
+typedef struct st_c4_store_slot_t {
+    uint64_t checksum;
+    uint64_t timestamp;
+    uint64_t nominal_rate;
+    uint32_t nominal_max_rtt;
+    uint32_t running_min_rtt;
+    uint16_t confidence;
+    uint8_t family;
+    uint8_t prefix[C4_CACHE_PREFIX_BYTES_IPV6];
+    uint8_t reserved[7];
+} c4_store_slot_t;
+
+/* Fail to compile if the padding of the file structures changes */
+typedef char c4_store_header_is_64_bytes[(sizeof(c4_store_header_t) == 64) ? 1 : -1];
+typedef char c4_store_slot_is_48_bytes[(sizeof(c4_store_slot_t) == 48) ? 1 : -1];
+
+struct st_c4_store_t {
+    uint8_t* base;
+    size_t size;
+    c4_store_slot_t* slots;
+    size_t nb_sets;
+    uint64_t salt;
+#ifdef _WINDOWS
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+static size_t c4_store_file_size(size_t nb_sets)
+{
+    return sizeof(c4_store_header_t) + nb_sets * C4_CACHE_NB_WAYS * sizeof(c4_store_slot_t);
+}
+
+static void c4_store_init_header(c4_store_header_t* header, size_t nb_sets)
+{
+    memset(header, 0, sizeof(c4_store_header_t));
+    memcpy(header->magic, C4_STORE_MAGIC, sizeof(C4_STORE_MAGIC));
+    header->version = C4_STORE_VERSION;
+    header->nb_sets = (uint32_t)nb_sets;
+    header->nb_ways = C4_CACHE_NB_WAYS;
+    header->record_size = (uint32_t)sizeof(c4_store_slot_t);
+    header->salt = picoquic_public_random_64();
+}
+
+static int c4_store_check_header(c4_store_header_t const* header, size_t file_size)
+{
+    return (memcmp(header->magic, C4_STORE_MAGIC, sizeof(C4_STORE_MAGIC)) == 0 &&
+        header->version == C4_STORE_VERSION &&
+        header->nb_ways == C4_CACHE_NB_WAYS &&
+        header->record_size == sizeof(c4_store_slot_t) &&
+        header->nb_sets > 0 && (header->nb_sets & (header->nb_sets - 1)) == 0 &&
+        c4_store_file_size(header->nb_sets) == file_size) ? 0 : -1;
+}
+
+/* If a process stopped after sizing a new file but before writing the
+* header, the file is left with a header of zeros. Such a file is
+* initialized as new, with the number of sets that fits its size, so
+* that the store does not stay unusable. Returns 1 if the header was
+* initialized.
+ */
+static int c4_store_recover_header(c4_store_header_t* header, size_t file_size)
+{
+    int ret = 0;
+    uint8_t const* x = (uint8_t const*)header;
+    size_t i = 0;
+
+    while (i < sizeof(c4_store_header_t) && x[i] == 0) {
+        i++;
+    }
+    if (i == sizeof(c4_store_header_t)) {
+        size_t nb_sets = (file_size - sizeof(c4_store_header_t)) / (C4_CACHE_NB_WAYS * sizeof(c4_store_slot_t));
+
+        if (nb_sets > 0 && (nb_sets & (nb_sets - 1)) == 0 && c4_store_file_size(nb_sets) == file_size) {
+            c4_store_init_header(header, nb_sets);
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+/* Map the file, and initialize it if it is empty, or if its header was
+* never written. The file is locked while doing so, so that processes
+* opening the store at the same time do not both initialize it.
+ */
+#ifdef _WINDOWS
+static int c4_store_map(c4_store_t* store, char const* file_name, size_t nb_sets)
+{
+    int ret = -1;
+    OVERLAPPED overlapped = { 0 };
+    LARGE_INTEGER file_size;
+
+    store->file = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (store->file == INVALID_HANDLE_VALUE) {
+        store->file = NULL;
+        return -1;
+    }
+    if (!LockFileEx(store->file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped)) {
+        return -1;
+    }
+    if (GetFileSizeEx(store->file, &file_size)) {
+        int is_new = (file_size.QuadPart == 0);
+
+        store->size = (is_new) ? c4_store_file_size(nb_sets) : (size_t)file_size.QuadPart;
+        /* Creating the mapping extends a new file to the requested size */
+        store->mapping = CreateFileMappingA(store->file, NULL, PAGE_READWRITE,
+            (DWORD)(((uint64_t)store->size) >> 32), (DWORD)(store->size & 0xFFFFFFFF), NULL);
+        if (store->mapping != NULL &&
+            (store->base = (uint8_t*)MapViewOfFile(store->mapping, FILE_MAP_ALL_ACCESS, 0, 0, store->size)) != NULL) {
+            if (is_new) {
+                c4_store_init_header((c4_store_header_t*)store->base, nb_sets);
+            }
+            else if (store->size >= sizeof(c4_store_header_t)) {
+                (void)c4_store_recover_header((c4_store_header_t*)store->base, store->size);
+            }
+            ret = c4_store_check_header((c4_store_header_t*)store->base, store->size);
+        }
+    }
+    (void)UnlockFileEx(store->file, 0, 1, 0, &overlapped);
+    return ret;
+}
+
+static void c4_store_unmap(c4_store_t* store)
+{
+    if (store->base != NULL) {
+        (void)UnmapViewOfFile(store->base);
+    }
+    if (store->mapping != NULL) {
+        (void)CloseHandle(store->mapping);
+    }
+    if (store->file != NULL) {
+        (void)CloseHandle(store->file);
+    }
+}
+#else
+static int c4_store_map(c4_store_t* store, char const* file_name, size_t nb_sets)
+{
+    int ret = -1;
+    struct stat st;
+
+    if ((store->fd = open(file_name, O_RDWR | O_CREAT, 0644)) < 0) {
+        return -1;
+    }
+    if (flock(store->fd, LOCK_EX) != 0) {
+        return -1;
+    }
+    if (fstat(store->fd, &st) == 0) {
+        int is_new = (st.st_size == 0);
+
+        store->size = (is_new) ? c4_store_file_size(nb_sets) : (size_t)st.st_size;
+        if (!is_new || ftruncate(store->fd, (off_t)store->size) == 0) {
+            void* base = mmap(NULL, store->size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+            if (base != MAP_FAILED) {
+                store->base = (uint8_t*)base;
+                if (is_new) {
+                    c4_store_init_header((c4_store_header_t*)store->base, nb_sets);
+                }
+                else if (store->size >= sizeof(c4_store_header_t)) {
+                    (void)c4_store_recover_header((c4_store_header_t*)store->base, store->size);
+                }
+                ret = c4_store_check_header((c4_store_header_t*)store->base, store->size);
+            }
+        }
+    }
+    (void)flock(store->fd, LOCK_UN);
+    return ret;
+}
+
+static void c4_store_unmap(c4_store_t* store)
+{
+    if (store->base != NULL) {
+        (void)munmap(store->base, store->size);
+    }
+    if (store->fd >= 0) {
+        (void)close(store->fd);
+    }
+}
+#endif
+
+c4_store_t* c4_store_open(char const* file_name, size_t nb_records_max)
+{
+    c4_store_t* store = NULL;
+    size_t nb_sets = 1;
+
+    if (nb_records_max == 0 || nb_records_max > UINT32_MAX) {
+        return NULL;
+    }
+    while (nb_sets * C4_CACHE_NB_WAYS < nb_records_max) {
+        nb_sets *= 2;
+    }
+    if ((store = (c4_store_t*)malloc(sizeof(c4_store_t))) != NULL) {
+        memset(store, 0, sizeof(c4_store_t));
+#ifndef _WINDOWS
+        store->fd = -1;
+#endif
+        if (c4_store_map(store, file_name, nb_sets) != 0) {
+            c4_store_close(store);
+            store = NULL;
+        }
+        else {
+            c4_store_header_t* header = (c4_store_header_t*)store->base;
+
+            store->nb_sets = header->nb_sets;
+            store->salt = header->salt;
+            store->slots = (c4_store_slot_t*)(store->base + sizeof(c4_store_header_t));
+        }
+    }
+    return store;
+}
+
+void c4_store_close(c4_store_t* store)
+{
+    if (store != NULL) {
+        c4_store_unmap(store);
+        free(store);
+    }
+}
+
+static uint64_t c4_store_hash(uint64_t salt, uint8_t const* bytes, size_t length)
+{
+    /* FNV-1a, starting from the salted offset basis */
+    uint64_t h = 0xcbf29ce484222325ull ^ salt;
+
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static uint64_t c4_store_checksum(c4_store_t* store, c4_store_slot_t const* slot)
+{
+    return c4_store_hash(store->salt, ((uint8_t const*)slot) + sizeof(uint64_t),
+        sizeof(c4_store_slot_t) - sizeof(uint64_t));
+}
+
+static c4_store_slot_t* c4_store_get_set(c4_store_t* store, uint8_t family, uint8_t const* prefix)
+{
+    uint8_t key[1 + C4_CACHE_PREFIX_BYTES_IPV6];
+    uint64_t h;
+
+    key[0] = family;
+    memcpy(key + 1, prefix, C4_CACHE_PREFIX_BYTES_IPV6);
+    h = c4_store_hash(store->salt, key, sizeof(key));
+    h ^= h >> 32;
+    return &store->slots[(h & (store->nb_sets - 1)) * C4_CACHE_NB_WAYS];
+}
+
+/* Copy the slot from the shared memory, and check that it is valid.
+* Other processes may write the slot at the same time, in which case
+* the checksum will almost certainly not match.
+ */
+static int c4_store_read_slot(c4_store_t* store, c4_store_slot_t const* shared, c4_store_slot_t* slot)
+{
+    memcpy(slot, shared, sizeof(c4_store_slot_t));
+    return (slot->family != 0 && slot->checksum == c4_store_checksum(store, slot)) ? 0 : -1;
+}
+
+static int c4_store_is_expired(uint64_t timestamp, uint64_t current_time, uint64_t ttl)
+{
+    return (current_time > timestamp && current_time - timestamp > ttl);
+}
+
+void c4_store_update(c4_store_t* store, const struct sockaddr* addr, c4_estimate_t const* estimate,
+    uint64_t current_time, uint64_t ttl)
+{
+    uint8_t prefix[C4_CACHE_PREFIX_BYTES_IPV6];
+    uint8_t family = c4_cache_get_prefix(addr, prefix);
+
+    if (store != NULL && family != 0) {
+        c4_store_slot_t* set = c4_store_get_set(store, family, prefix);
+        c4_store_slot_t* target = NULL;
+        uint64_t target_time = UINT64_MAX;
+        c4_store_slot_t slot;
+
+        /* Merge with the record of the same prefix if there is one, else
+         * replace an invalid record, else the oldest one. */
+        for (int i = 0; i < C4_CACHE_NB_WAYS; i++) {
+            c4_store_slot_t current;
+
+            if (c4_store_read_slot(store, &set[i], &current) != 0) {
+                if (target_time > 0) {
+                    target = &set[i];
+                    target_time = 0;
+                    memset(&slot, 0, sizeof(slot));
+                }
+            }
+            else if (current.family == family && memcmp(current.prefix, prefix, C4_CACHE_PREFIX_BYTES_IPV6) == 0) {
+                target = &set[i];
+                if (c4_store_is_expired(current.timestamp, current_time, ttl)) {
+                    /* Do not merge with estimates that are too old */
+                    memset(&slot, 0, sizeof(slot));
+                }
+                else {
+                    slot = current;
+                }
+                break;
+            }
+            else if (current.timestamp < target_time) {
+                target = &set[i];
+                target_time = current.timestamp;
+                memset(&slot, 0, sizeof(slot));
+            }
+        }
+        if (slot.confidence > 0) {
+            uint64_t w = slot.confidence;
+
+            slot.nominal_rate = (w * slot.nominal_rate + estimate->nominal_rate) / (w + 1);
+            slot.nominal_max_rtt = (uint32_t)((w * slot.nominal_max_rtt + estimate->nominal_max_rtt) / (w + 1));
+            slot.running_min_rtt = (uint32_t)((w * slot.running_min_rtt + estimate->running_min_rtt) / (w + 1));
+            if (slot.confidence < C4_STORE_CONFIDENCE_MAX) {
+                slot.confidence++;
+            }
+        }
+        else {
+            slot.family = family;
+            memcpy(slot.prefix, prefix, C4_CACHE_PREFIX_BYTES_IPV6);
+            slot.nominal_rate = estimate->nominal_rate;
+            slot.nominal_max_rtt = estimate->nominal_max_rtt;
+            slot.running_min_rtt = estimate->running_min_rtt;
+            slot.confidence = 1;
+        }
+        slot.timestamp = current_time;
+        slot.checksum = c4_store_checksum(store, &slot);
+        memcpy(target, &slot, sizeof(c4_store_slot_t));
+    }
+}
+
+int c4_store_lookup(c4_store_t* store, const struct sockaddr* addr, c4_store_record_t* record,
+    uint64_t current_time, uint64_t ttl)
+{
+    int ret = -1;
+    uint8_t prefix[C4_CACHE_PREFIX_BYTES_IPV6];
+    uint8_t family = c4_cache_get_prefix(addr, prefix);
+
+    if (store != NULL && family != 0) {
+        c4_store_slot_t* set = c4_store_get_set(store, family, prefix);
+
+        for (int i = 0; i < C4_CACHE_NB_WAYS; i++) {
+            c4_store_slot_t slot;
+
+            if (c4_store_read_slot(store, &set[i], &slot) == 0 &&
+                slot.family == family && memcmp(slot.prefix, prefix, C4_CACHE_PREFIX_BYTES_IPV6) == 0) {
+                if (!c4_store_is_expired(slot.timestamp, current_time, ttl)) {
+                    record->estimate.nominal_rate = slot.nominal_rate;
+                    record->estimate.nominal_max_rtt = slot.nominal_max_rtt;
+                    record->estimate.running_min_rtt = slot.running_min_rtt;
+                    record->timestamp = slot.timestamp;
+                    record->confidence = slot.confidence;
+                    ret = 0;
+                }
+                break;
+            }
+        }
+    }
+    return ret;
+}
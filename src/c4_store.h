@@ -0,0 +1,56 @@
+/*
+Persistent store of the path estimates of C4, per peer address prefix
+*/
+
+#ifndef C4_STORE_H
+#define C4_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "picoquic.h"
+#include "c4_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define C4_STORE_MAGIC "C4STORE"
+#define C4_STORE_VERSION 1
+#define C4_STORE_CONFIDENCE_MAX 8
+
+    typedef struct st_c4_store_t c4_store_t;
+
+    /* The store is a file mapped in memory, organized like the estimate
+    * cache in sets of C4_CACHE_NB_WAYS records, so that it keeps a fixed
+    * size. Several processes can map the same file. Records are written
+    * without locks; each record carries a checksum, and records that were
+    * torn by concurrent writes or by a crash are ignored.
+    * The confidence of a record is the number of paths merged into it,
+    * up to C4_STORE_CONFIDENCE_MAX. New estimates are merged with a weight
+    * of 1/(confidence + 1), so the record follows the recent paths.
+    * Timestamps use the time of the QUIC context, which is the wall clock
+    * time in microseconds outside of simulations.
+     */
+    typedef struct st_c4_store_record_t {
+        c4_estimate_t estimate;
+        uint64_t timestamp;
+        uint16_t confidence;
+    } c4_store_record_t;
+
+    /* Open the store, creating the file with room for nb_records_max records
+    * if it does not exist. An existing file keeps its own size.
+    * Returns NULL if the file cannot be created or is not a valid store.
+     */
+    c4_store_t* c4_store_open(char const* file_name, size_t nb_records_max);
+    void c4_store_close(c4_store_t* store);
+    /* Merge the estimate in the record of the prefix, or replace the record if it is older than ttl. */
+    void c4_store_update(c4_store_t* store, const struct sockaddr* addr, c4_estimate_t const* estimate,
+        uint64_t current_time, uint64_t ttl);
+    /* Returns 0 and fills the record if a valid record not older than ttl is found, -1 otherwise. */
+    int c4_store_lookup(c4_store_t* store, const struct sockaddr* addr, c4_store_record_t* record,
+        uint64_t current_time, uint64_t ttl);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <ctype.h>
 #include "picoquic.h"
 #include "picoquic_ns.h"
@@ -18,6 +19,7 @@
  Declare here the algorithm[s] that we want to test
  */
 #include "c4.h"
+#include "c4_stats.h"
 
 int parse_spec_file(picoquic_ns_spec_t* spec, FILE* F);
 void release_spec_data(picoquic_ns_spec_t* spec);
@@ -43,9 +45,27 @@ void usage()
     fprintf(stderr, "  -S path  Path to the picoquic source directory, where the\n");
     fprintf(stderr, "           code will find the key and certificates used for\n");
     fprintf(stderr, "           setting test connections.\n");
+    fprintf(stderr, "  -R dir   Record the notifications of the C4 paths in the\n");
+    fprintf(stderr, "           directory, for replay with c4_replay.\n");
+    fprintf(stderr, "  -B dir   Write the rate samples and state transitions of the\n");
+    fprintf(stderr, "           C4 paths to columnar trace files in the directory,\n");
+    fprintf(stderr, "           for analysis with c4_columns.\n");
     fprintf(stderr, "  -h       Print this message.\n");
 }
 
+/* The statistics of the C4 paths are added when the paths are deleted,
+* at the end of each connection, and reported once the simulation is done.
+ */
+static void report_c4_pacing_updates(FILE* F)
+{
+    c4_stats_t stats;
+
+    if (c4_stats_get_closed(&stats) == 0 && stats.nb_paths > 0) {
+        fprintf(F, "C4 paths closed: %" PRIu64 ", pacing updates: %" PRIu64 ", skipped: %" PRIu64 "\n",
+            stats.nb_paths, stats.nb_pacing_updates, stats.nb_pacing_updates_skipped);
+    }
+}
+
 int main(int argc, char** argv)
 {
     int ret = 0;
@@ -53,17 +73,15 @@ int main(int argc, char** argv)
     FILE* F = NULL;
     char const * spec_file_name = NULL;
     char const* source_dir = PICOQUIC_DIR;
-    char const* option_string = "S:h";
+    char const* option_string = "S:R:B:h";
     int opt;
 
     /* Load the available set of congestion control algorithms */
     picoquic_register_all_congestion_control_algorithms();
-#ifdef C4_H
     if (picoquic_register_cc_algorithm(c4_algorithm) != 0) {
         fprintf(stderr, "Could not register the C4 algorithm.\n");
         return -1;
     }
-#endif
 
     /* Get the parameters */
     while ((opt = getopt(argc, argv, option_string)) != -1) {
@@ -71,6 +89,18 @@ int main(int argc, char** argv)
         case 'S':
             source_dir = optarg;
             break;
+        case 'R':
+            if (c4_set_record_directory(optarg) != 0) {
+                fprintf(stderr, "Invalid record directory: %s\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'B':
+            if (c4_set_column_directory(optarg) != 0) {
+                fprintf(stderr, "Invalid trace directory: %s\n", optarg);
+                exit(-1);
+            }
+            break;
         case 'h':
             usage();
             exit(0);
@@ -96,7 +126,13 @@ int main(int argc, char** argv)
             fprintf(stderr, "Error when processing file <%s>\n", spec_file_name);
         }
         else {
+            int closed_stats_enabled = (c4_stats_enable_closed() == 0);
+
             ret = picoquic_ns(&spec, stderr);
+            if (closed_stats_enabled) {
+                report_c4_pacing_updates(stderr);
+                c4_stats_disable_closed();
+            }
         }
         F = picoquic_file_close(F);
         release_spec_data(&spec);